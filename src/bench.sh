@@ -0,0 +1,23 @@
+#!/bin/bash
+# Times git-print-index over the index files given as arguments, see "make bench".
+# lookup: header parsing and a lookup of a missing path, without the checksum
+# checksum: the same, with the checksum
+# stat, ls: the views, without the checksum
+
+BIN=${BIN:-./git-print-index}
+TIMEFORMAT=%3R
+
+run() {
+	{ time "$BIN" "$@" > /dev/null 2>&1; } 2>&1
+}
+
+printf "%-28s %8s %9s %8s %9s %8s %8s\n" index entries MiB lookup checksum stat ls
+for index in "$@"; do
+	entries=$(od -An -N4 -j8 --endian=big -tu4 "$index" | tr -d ' ')
+	mib=$(( $(stat -c %s "$index") / 1048576 ))
+	printf "%-28s %8s %9s %8s %9s %8s %8s\n" "$(basename "$index")" "$entries" "$mib" \
+		"$(run --no-verify --path=/missing "$index")" \
+		"$(run --path=/missing "$index")" \
+		"$(run --no-verify --stat "$index")" \
+		"$(run --no-verify --ls "$index")"
+done
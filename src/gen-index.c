@@ -0,0 +1,446 @@
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <openssl/evp.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// Writes synthetic index files, for benchmarks.
+// Paths are laid out as a full tree of a_depth directory levels with the same fanout at every level, the last one
+// possibly incomplete, and every name has the same length. This way the numbering order is the sorting order.
+
+
+#if 0
+#pragma mark Structures
+#endif
+
+struct params {
+	uint32_t entry_count;
+	uint32_t version;
+	uint32_t depth; // Directory levels above the files
+	uint32_t name_len; // Length of every path component
+	bool tree; // With a TREE extension
+	uint32_t ieot_blocks; // With EOIE and IEOT extensions when not 0
+	uint64_t seed;
+};
+
+// Output with its running checksum
+struct writer {
+	FILE *file;
+	EVP_MD_CTX *sha_ctx;
+	uint64_t offset;
+	bool failed;
+};
+
+struct buffer {
+	uint8_t *data;
+	size_t len;
+	size_t size;
+};
+
+struct layout {
+	uint32_t fanout;
+	uint32_t digits; // Of the largest component number
+	uint64_t level_size[33]; // Entries below a directory of each level, level_size[0] being the whole index
+};
+
+
+#if 0
+#pragma mark Utility methods
+#endif
+
+static void emit( struct writer *a_writer, const void *a_ptr, size_t a_len )
+{
+	if (fwrite( a_ptr, 1, a_len, a_writer->file ) != a_len) a_writer->failed = true;
+	EVP_DigestUpdate( a_writer->sha_ctx, a_ptr, a_len );
+	a_writer->offset += a_len;
+}
+
+
+static void emit_u32( struct writer *a_writer, uint32_t a_value )
+{
+	a_value = htonl( a_value );
+	emit( a_writer, &a_value, 4 );
+}
+
+
+static int buffer_append( struct buffer *a_buffer, const void *a_ptr, size_t a_len )
+{
+	if (!a_len) return 0;
+	if (a_buffer->len + a_len > a_buffer->size) {
+		size_t new_size = a_buffer->size ? a_buffer->size : 4096;
+		while (new_size < a_buffer->len + a_len) new_size *= 2;
+		uint8_t *new_data = realloc( a_buffer->data, new_size );
+		if (!new_data) {
+			perror( "realloc" );
+			return 1;
+		}
+		a_buffer->data = new_data;
+		a_buffer->size = new_size;
+	}
+
+	memcpy( a_buffer->data + a_buffer->len, a_ptr, a_len );
+	a_buffer->len += a_len;
+
+	return 0;
+}
+
+
+// xorshift64*
+static uint64_t next_random( uint64_t *a_state )
+{
+	*a_state ^= *a_state >> 12;
+	*a_state ^= *a_state << 25;
+	*a_state ^= *a_state >> 27;
+
+	return *a_state * 0x2545F4914F6CDD1DULL;
+}
+
+
+static void random_hash( uint64_t *a_state, uint8_t *a_hash )
+{
+	uint64_t words[3] = { next_random( a_state ), next_random( a_state ), next_random( a_state ) };
+
+	memcpy( a_hash, words, 20 );
+}
+
+
+// Same encoding as read_offset_delta decodes. Returns the number of bytes stored in a_buf.
+static size_t encode_offset_delta( uint8_t *a_buf, uint64_t a_value )
+{
+	uint8_t varint[16];
+	size_t pos = sizeof( varint ) - 1;
+
+	varint[pos] = a_value & 127;
+	while (a_value >>= 7) {
+		varint[--pos] = 128 | (--a_value & 127);
+	}
+	memcpy( a_buf, varint + pos, sizeof( varint ) - pos );
+
+	return sizeof( varint ) - pos;
+}
+
+
+#if 0
+#pragma mark Paths
+#endif
+
+static int init_layout( const struct params *a_params, struct layout *a_layout )
+{
+	uint32_t levels = a_params->depth + 1;
+	uint64_t fanout = 1;
+	uint64_t total;
+
+	// Smallest fanout giving room for every entry
+	do {
+		fanout++;
+		total = 1;
+		for (uint32_t idx = 0; idx < levels && total < a_params->entry_count; idx++) total *= fanout;
+	} while (total < a_params->entry_count);
+
+	a_layout->fanout = fanout;
+	a_layout->digits = 1;
+	for (uint64_t max = fanout - 1; max >= 10; max /= 10) a_layout->digits++;
+	if (a_params->name_len < a_layout->digits + 1) {
+		fprintf( stderr, "Names need at least %u characters\n", a_layout->digits + 1 );
+		return 1;
+	}
+
+	a_layout->level_size[levels] = 1;
+	for (uint32_t level = levels; level > 0; level--) {
+		a_layout->level_size[level - 1] = a_layout->level_size[level] * fanout;
+	}
+
+	return 0;
+}
+
+
+// Name of the a_number-th component of a level: a letter, zeros and the number.
+static void make_component( const struct params *a_params, char a_letter, uint64_t a_number, char *a_dest )
+{
+	memset( a_dest, '0', a_params->name_len );
+	a_dest[0] = a_letter;
+	for (size_t pos = a_params->name_len - 1; a_number; pos--) {
+		a_dest[pos] = '0' + a_number % 10;
+		a_number /= 10;
+	}
+}
+
+
+// Path of entry a_idx into a_dest, which needs room for (depth + 1) * (name_len + 1) bytes.
+// Returns its length.
+static size_t make_path( const struct params *a_params, const struct layout *a_layout, uint64_t a_idx, char *a_dest )
+{
+	char *ptr = a_dest;
+
+	for (uint32_t level = 1; level <= a_params->depth + 1; level++) {
+		uint64_t number = (a_idx / a_layout->level_size[level]) % a_layout->fanout;
+		make_component( a_params, level <= a_params->depth ? 'd' : 'f', number, ptr );
+		ptr += a_params->name_len;
+		if (level <= a_params->depth) *ptr++ = '/';
+	}
+
+	return ptr - a_dest;
+}
+
+
+#if 0
+#pragma mark Extensions
+#endif
+
+// Appends the TREE records of the directory holding entries a_first to a_end at a_level, then of its subdirectories.
+static int append_tree( const struct params *a_params, const struct layout *a_layout, struct buffer *a_tree, uint64_t *a_random,
+	const char *a_name, size_t a_name_len, uint32_t a_level, uint64_t a_first, uint64_t a_end )
+{
+	char counts[32];
+	uint8_t hash[20];
+	uint64_t child_size = a_layout->level_size[a_level + 1];
+	uint64_t subtrees = a_level < a_params->depth ? (a_end - a_first + child_size - 1) / child_size : 0;
+	int result;
+
+	random_hash( a_random, hash );
+	snprintf( counts, sizeof( counts ), "%lu %lu\n", (unsigned long) (a_end - a_first), (unsigned long) subtrees );
+	result = buffer_append( a_tree, a_name, a_name_len );
+	result = result || buffer_append( a_tree, "", 1 );
+	result = result || buffer_append( a_tree, counts, strlen( counts ) );
+	result = result || buffer_append( a_tree, hash, 20 );
+
+	for (uint64_t child = 0; child < subtrees && !result; child++) {
+		char name[a_params->name_len];
+		uint64_t first = a_first + child * child_size;
+		make_component( a_params, 'd', child, name );
+		result = append_tree( a_params, a_layout, a_tree, a_random, name, a_params->name_len, a_level + 1,
+			first, first + child_size < a_end ? first + child_size : a_end );
+	}
+
+	return result;
+}
+
+
+#if 0
+#pragma mark Index
+#endif
+
+int write_index( const struct params *a_params, struct writer *a_writer )
+{
+	struct layout layout;
+	uint64_t random = a_params->seed ? a_params->seed : 1;
+	size_t path_size = (a_params->depth + 1) * (a_params->name_len + 1);
+	char *path = malloc( path_size );
+	char *prev_path = malloc( path_size );
+	size_t prev_len = 0;
+	uint32_t block_size = a_params->ieot_blocks ? (a_params->entry_count + a_params->ieot_blocks - 1) / a_params->ieot_blocks : 0;
+	struct buffer ieot = { .data = NULL, .len = 0, .size = 0 };
+	struct buffer tree = { .data = NULL, .len = 0, .size = 0 };
+	EVP_MD_CTX *eoie_ctx = EVP_MD_CTX_new();
+	int result = 0;
+
+	if (!path || !prev_path || !eoie_ctx || init_layout( a_params, &layout )) {
+		if (!path || !prev_path || !eoie_ctx) perror( "malloc" );
+		EVP_MD_CTX_free( eoie_ctx );
+		free( path );
+		free( prev_path );
+		return 1;
+	}
+
+	emit( a_writer, "DIRC", 4 );
+	emit_u32( a_writer, a_params->version );
+	emit_u32( a_writer, a_params->entry_count );
+
+	uint32_t ieot_version = htonl( 1 );
+	result = buffer_append( &ieot, &ieot_version, 4 );
+
+	for (uint32_t idx = 0; idx < a_params->entry_count && !result; idx++) {
+		size_t path_len;
+		uint8_t buf[62 + 2 + 16];
+		size_t len = 62;
+		uint32_t fields[10];
+		uint32_t mode = idx % 7 ? 0100644 : 0100755;
+		uint32_t mtime = 1500000000 + next_random( &random ) % 200000000;
+		bool extended = a_params->version >= 3 && idx % 16 == 0;
+		bool block_start = block_size && idx % block_size == 0;
+		uint16_t flags;
+
+		if (block_start) {
+			uint32_t count = a_params->entry_count - idx < block_size ? a_params->entry_count - idx : block_size;
+			uint32_t block[2] = { htonl( a_writer->offset ), htonl( count ) };
+			result = buffer_append( &ieot, block, 8 );
+		}
+
+		path_len = make_path( a_params, &layout, idx, path );
+
+		fields[0] = htonl( mtime - next_random( &random ) % 1000 );
+		fields[1] = htonl( next_random( &random ) % 1000000000 );
+		fields[2] = htonl( mtime );
+		fields[3] = htonl( next_random( &random ) % 1000000000 );
+		fields[4] = htonl( 64769 );
+		fields[5] = htonl( idx + 1 );
+		fields[6] = htonl( mode );
+		fields[7] = htonl( 0 );
+		fields[8] = htonl( 0 );
+		fields[9] = htonl( next_random( &random ) % 100000 );
+		memcpy( buf, fields, 40 );
+		random_hash( &random, buf + 40 );
+		flags = (path_len < 0xFFF ? path_len : 0xFFF) | (extended ? 0x4000 : 0);
+		buf[60] = flags >> 8;
+		buf[61] = flags & 0xFF;
+		if (extended) {
+			buf[len++] = 0x40; // skip-worktree
+			buf[len++] = 0;
+		}
+
+		if (a_params->version >= 4) {
+			// Prefix compression: the number of bytes to remove from the previous path, then what replaces them.
+			// As git does, a block shares nothing with the previous one.
+			size_t common = 0;
+			if (!block_start) {
+				while (common < path_len && common < prev_len && prev_path[common] == path[common]) common++;
+			}
+			len += encode_offset_delta( buf + len, prev_len - common );
+			emit( a_writer, buf, len );
+			emit( a_writer, path + common, path_len - common );
+			emit( a_writer, "", 1 );
+		} else {
+			// NUL-padded to a multiple of 8 bytes, at least one NUL
+			static const uint8_t zeros[8] = { 0 };
+			emit( a_writer, buf, len );
+			emit( a_writer, path, path_len );
+			emit( a_writer, zeros, 8 - (len + path_len) % 8 );
+		}
+		char *swap = prev_path;
+		prev_path = path;
+		path = swap;
+		prev_len = path_len;
+	}
+
+	uint32_t entries_end = a_writer->offset;
+	EVP_DigestInit_ex( eoie_ctx, EVP_sha1(), NULL );
+
+	if (block_size && !result) {
+		uint32_t header[2] = { 0, htonl( ieot.len ) };
+		memcpy( header, "IEOT", 4 );
+		emit( a_writer, header, 8 );
+		EVP_DigestUpdate( eoie_ctx, header, 8 );
+		emit( a_writer, ieot.data, ieot.len );
+	}
+
+	if (a_params->tree && !result) {
+		result = append_tree( a_params, &layout, &tree, &random, "", 0, 0, 0, a_params->entry_count );
+		if (!result) {
+			uint32_t header[2] = { 0, htonl( tree.len ) };
+			memcpy( header, "TREE", 4 );
+			emit( a_writer, header, 8 );
+			EVP_DigestUpdate( eoie_ctx, header, 8 );
+			emit( a_writer, tree.data, tree.len );
+		}
+	}
+
+	if (block_size && !result) {
+		// EOIE is last, its hash covering the headers of the other extensions.
+		uint8_t md[20];
+		EVP_DigestFinal_ex( eoie_ctx, md, NULL );
+		emit( a_writer, "EOIE", 4 );
+		emit_u32( a_writer, 4 + 20 );
+		emit_u32( a_writer, entries_end );
+		emit( a_writer, md, 20 );
+	}
+
+	if (!result) {
+		uint8_t md[20];
+		EVP_DigestFinal_ex( a_writer->sha_ctx, md, NULL );
+		if (fwrite( md, 1, 20, a_writer->file ) != 20) a_writer->failed = true;
+	}
+
+	EVP_MD_CTX_free( eoie_ctx );
+	free( tree.data );
+	free( ieot.data );
+	free( path );
+	free( prev_path );
+
+	return result || a_writer->failed;
+}
+
+
+void usage( const char *a_name )
+{
+	fprintf( stderr, "Usage: %s [options]\n", a_name );
+	fprintf( stderr, "Writes a synthetic index file to the standard output.\n" );
+	fprintf( stderr, "\t--entries=<n>\t\tNumber of entries (default: 1000)\n" );
+	fprintf( stderr, "\t--index-version=<n>\t2, 3 or 4 (default: 2)\n" );
+	fprintf( stderr, "\t--depth=<n>\t\tDirectory levels above the files (default: 2)\n" );
+	fprintf( stderr, "\t--name-length=<n>\tLength of every path component (default: 8)\n" );
+	fprintf( stderr, "\t--tree\t\t\tAdd a TREE extension\n" );
+	fprintf( stderr, "\t--ieot=<n>\t\tAdd an IEOT extension of n blocks, and the EOIE extension\n" );
+	fprintf( stderr, "\t--seed=<n>\t\tSeed of the stat data and hashes\n" );
+	fprintf( stderr, "\t--output=<file>\t\tWrite to that file\n" );
+}
+
+
+int main( int argc, char * argv[] )
+{
+	struct params params = { .entry_count = 1000, .version = 2, .depth = 2, .name_len = 8, .tree = false, .ieot_blocks = 0, .seed = 1 };
+	struct writer writer = { .file = stdout, .sha_ctx = NULL, .offset = 0, .failed = false };
+	const char *output = NULL;
+	int opt;
+
+	static const struct option options[] = {
+		{ "entries", required_argument, NULL, 'n' },
+		{ "index-version", required_argument, NULL, 'v' },
+		{ "depth", required_argument, NULL, 'd' },
+		{ "name-length", required_argument, NULL, 'l' },
+		{ "tree", no_argument, NULL, 't' },
+		{ "ieot", required_argument, NULL, 'i' },
+		{ "seed", required_argument, NULL, 's' },
+		{ "output", required_argument, NULL, 'o' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	while ((opt = getopt_long( argc, argv, "hn:o:", options, NULL )) != -1) {
+		switch (opt) {
+		case 'n': params.entry_count = strtoul( optarg, NULL, 10 ); break;
+		case 'v': params.version = strtoul( optarg, NULL, 10 ); break;
+		case 'd': params.depth = strtoul( optarg, NULL, 10 ); break;
+		case 'l': params.name_len = strtoul( optarg, NULL, 10 ); break;
+		case 't': params.tree = true; break;
+		case 'i': params.ieot_blocks = strtoul( optarg, NULL, 10 ); break;
+		case 's': params.seed = strtoull( optarg, NULL, 10 ); break;
+		case 'o': output = optarg; break;
+		case 'h': usage( argv[0] ); return 0;
+		default: usage( argv[0] ); return 1;
+		}
+	}
+
+	if (params.version < 2 || params.version > 4 || params.depth > 31) {
+		usage( argv[0] );
+		return 1;
+	}
+	if (params.ieot_blocks > params.entry_count) params.ieot_blocks = params.entry_count;
+
+	if (output) {
+		writer.file = fopen( output, "w" );
+		if (!writer.file) {
+			perror( "Opening file" );
+			return 1;
+		}
+	}
+
+	writer.sha_ctx = EVP_MD_CTX_new();
+	if (!writer.sha_ctx) {
+		perror( "malloc" );
+		return 1;
+	}
+	EVP_DigestInit_ex( writer.sha_ctx, EVP_sha1(), NULL );
+	int result = write_index( &params, &writer );
+	EVP_MD_CTX_free( writer.sha_ctx );
+
+	if (fclose( writer.file ) || writer.failed) {
+		perror( "Writing index" );
+		result = 1;
+	}
+
+	return result;
+}
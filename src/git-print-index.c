@@ -1,15 +1,29 @@
 #include <arpa/inet.h>
 #include <assert.h>
+#include <dirent.h>
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
 #include <grp.h>
 #include <limits.h>
 #include <openssl/sha.h>
+#include <pthread.h>
 #include <pwd.h>
+#include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <time.h>
+#include <unistd.h>
+
+#include "gitindex.h"
 
 
 #if 0
@@ -17,66 +31,369 @@
 #endif
 
 // These are set once during initialisation and act as constants
-static const size_t g_max_offset_delta_len = (8 * sizeof( ssize_t ) - 1 + 6) / 7;
-static ssize_t g_max_offset_delta;
+static char g_hex_pairs[256][2]; // "00" to "FF"
+static char g_hex_lower_pairs[256][2]; // "00" to "ff"
+static char g_json_escapes[256]; // Character following the backslash, 'u' for \u00XX, 0 when not escaped
+static char g_dec_pairs[100][2]; // "00" to "99"
 
 
 #if 0
 #pragma mark Structures
 #endif
 
-struct header {
+struct extension {
 	char signature[4];
-	uint32_t version;
+	uint32_t len;
+};
+
+// Bump allocator, everything allocated from it being freed at once by arena_free.
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;
+	size_t used;
+	max_align_t data[];
+};
+
+#define STATS_EXTENSIONS 16
+
+// What --stats reports. Only gathered when ctx->stats isn't NULL, times being in seconds.
+struct stats {
+	struct timespec start;
+	double header;
+	double load; // Entries decoded ahead, by load_entries_threaded or select_entries
+	double decode; // Entries decoded by the views
+	double view; // The views, decode and output included
+	double output; // Writing
+	double checksum_thread; // Hashing a mapped file, on its own thread
+	double checksum; // Hashing in the reading thread, or waiting for the hashing thread
+	struct {
+		char signature[4];
+		uint32_t len;
+		double seconds;
+	} extensions[STATS_EXTENSIONS];
+	size_t extension_count;
+	unsigned long arena_allocs; // The strings kept from streams, and the other short-lived allocations
+	unsigned long arena_chunks;
+	unsigned long reallocs;
+};
+
+struct arena {
+	struct arena_chunk *head; // Chunk being filled, followed by the full ones
+	struct arena_chunk *spare; // Chunks released by arena_reset, kept for reuse
+	struct stats *stats;
+};
+
+// Position in an arena to roll back to with arena_reset.
+struct arena_mark {
+	struct arena_chunk *chunk;
+	size_t used;
+};
+
+// Buffered output, written to fd in large blocks.
+struct out {
+	int fd;
+	bool line_buffered; // Flush at each end of line, as stdio does for terminals
+	bool failed;
+	char *buf;
+	size_t len;
+	size_t size;
+	struct stats *stats;
+};
+
+// Cache of time2str
+#define TZ_WINDOW 900
+#define TZ_CACHE_SIZE 16
+#define TIME_CACHE_SIZE 64
+
+struct tz_window {
+	int64_t window; // Seconds since the epoch divided by TZ_WINDOW
+	long gmtoff;
+	bool used;
+};
+
+struct time_slot {
+	int64_t sec;
+	bool used;
+	char text[19]; // yyyy-mm-dd hh:mm:ss
+	char zone[5]; // ±hhmm
+};
+
+struct time_cache {
+	struct tz_window windows[TZ_CACHE_SIZE];
+	struct time_slot seconds[TIME_CACHE_SIZE];
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long localtime_calls;
+};
+
+// How entries are printed
+enum view {
+	VIEW_STAT,
+	VIEW_LS,
+	VIEW_FIELDS, // Only the fields selected with --fields, tab-separated
+	VIEW_NDJSON, // One JSON object per entry
+	VIEW_BINARY, // struct bin_header, then a struct bin_record per entry, then the paths
+	VIEW_SUMMARY, // Aggregates of the entries
+	VIEW_DU, // Totals by directory
+};
+
+struct field;
+
+// Column widths of the ls view
+struct ls_widths {
+	int dev;
+	int inode;
+	int user;
+	int group;
+	int size;
+};
+
+// Growable NUL-terminated path, see path_buf_apply.
+struct path_buf {
+	char *buf;
+	size_t len;
+	size_t size;
+	struct stats *stats;
+};
+
+// Resolved names of user or group ids, see name_cache_get.
+struct name_slot {
+	uint32_t id;
+	bool used;
+	const char *name; // NULL when the id doesn't resolve
+	int width;
+};
+
+struct name_cache {
+	const char *(*resolve)( uint32_t a_id );
+	struct name_slot *slots;
+	size_t size; // Power of two
+	size_t used;
+	unsigned long hits;
+	unsigned long misses;
+	pthread_mutex_t *lock; // NULL unless shared between threads
+};
+
+// Shared index decoded by load_shared_index, see read_shared_index.
+struct shared_slot {
+	struct shared_slot *next;
+	uint8_t oid[GI_HASH_MAX_LEN]; // Its checksum, which names it
+	const uint8_t *data; // Mapped
+	size_t data_len;
+	struct gi_entry *entries; // With their whole path
+	uint32_t entry_count;
+	struct arena arena; // v4 paths
+};
+
+// Shared indexes kept for every split index of a run naming them, see shared_cache_find.
+struct shared_cache {
+	struct shared_slot *slots;
+	pthread_mutex_t *lock; // NULL unless shared between threads
+};
+
+// One entry of the IEOT extension: a block of entries starting at offset.
+struct ieot_block {
+	uint32_t offset;
+	uint32_t entry_count;
+};
+
+// Entries as a structure of arrays, see load_columns. Path n is names.buf[name_offsets[n]] up to
+// names.buf[name_offsets[n + 1]], without terminator.
+struct columns {
+	size_t count;
+	void *block; // Holds all the arrays but names
+	int64_t *mtime; // Nanoseconds since the epoch
+	int64_t *ctime;
+	uint32_t *mode;
+	uint32_t *file_size;
+	uint32_t *uid;
+	uint16_t *flags;
+	uint16_t *extended_flags;
+	size_t *name_offsets; // count + 1 of them
+	struct path_buf names;
+};
+
+// The binary view is little-endian and made of:
+// - a struct bin_header,
+// - entry_count records of record_size bytes: a struct bin_stat, the object id (20 or 32 bytes), a struct bin_tail,
+// - the NUL-terminated paths, path_offset being counted from the end of the records.
+// All the fields are aligned to their size when the file is mapped.
+struct bin_header {
+	char magic[4]; // "GPIB"
+	uint32_t version; // BIN_VERSION
 	uint32_t entry_count;
+	uint32_t record_size; // 72 with SHA-1, 84 with SHA-256
 };
 
-struct entry {
-	// ctime and mtime should be struct timespec as they correspond to stat(2) values.
-	// However struct timespec { time_t tv_sec; long tv_nsec; } are 64-bit fields 
-	int32_t ctime;
-	int32_t ctime_ns;
-	int32_t mtime;
-	int32_t mtime_ns;
+#define BIN_VERSION 1
+
+struct bin_stat {
+	uint32_t ctime;
+	uint32_t ctime_ns;
+	uint32_t mtime;
+	uint32_t mtime_ns;
 	uint32_t dev;
 	uint32_t ino;
 	uint32_t mode;
 	uint32_t uid;
 	uint32_t gid;
 	uint32_t file_size;
-	char sha1[20];
+};
+
+struct bin_tail {
 	uint16_t flags;
-	char * file_name; // 62th byte in v2
-	char * pad_bytes;
-	// v3
 	uint16_t extended_flags;
-	// v4
-	size_t prefix;
-	// Added members
-	size_t file_name_len;
-	size_t pad_bytes_len;
+	uint32_t path_offset;
+	uint32_t path_len;
 };
 
-struct extension {
-	char signature[4];
-	uint32_t len;
+_Static_assert( sizeof( struct bin_header ) == 16, "struct bin_header isn't packed" );
+_Static_assert( sizeof( struct bin_stat ) == 40, "struct bin_stat isn't packed" );
+_Static_assert( sizeof( struct bin_tail ) == 12, "struct bin_tail isn't packed" );
+
+// A cache file of --cache holds the entries of an index as the binary view prints them, after a struct cache_key
+// telling which index they are those of. The key is in the byte order of the machine, caches aren't meant to be moved.
+struct cache_key {
+	char magic[4]; // "GPIC"
+	uint32_t version; // CACHE_VERSION
+	uint64_t index_size;
+	int64_t index_mtime;
+	int64_t index_mtime_ns;
+	uint64_t extensions_pos; // End of the entries in the index
+	uint32_t hash_len;
+	uint32_t merged; // Whether the entries are those of a split index merged with its shared index
+	uint32_t shared_entry_count; // Entries of that shared index
+	uint32_t reserved;
+	uint8_t checksum[GI_HASH_MAX_LEN]; // Trailing checksum of the index
+};
+
+#define CACHE_VERSION 1
+#define CACHE_SUFFIX ".gpi-cache"
+
+_Static_assert( sizeof( struct cache_key ) % 8 == 0, "struct cache_key breaks the alignment of the records" );
+
+// Level of walk_tree: the subtrees of a tree.
+struct tree_frame {
+	unsigned remaining; // Subtrees left to read at this level
+	size_t prefix_len;
+	uint32_t parent; // Node of their parent in the tree_index, if any
 };
 
-struct tree {
-	char *path;
+#define TREE_NO_NODE UINT32_MAX
+
+// Tree of the TREE extension in a tree_index. Its path is only stored as its name and its parent's node, so that
+// deep trees don't take quadratic space; hash is that of the whole path, extended from the parent's.
+struct tree_node {
+	const char *name;
+	size_t name_len;
+	size_t path_len;
+	uint32_t parent; // TREE_NO_NODE for the root
+	uint32_t hash;
 	int entry_count;
 	unsigned subtrees;
-	char sha1[20];
-	char *file_name;
+	char oid[GI_HASH_MAX_LEN];
+};
+
+// Trees of the TREE extension by path, see tree_index_get.
+struct tree_index {
+	struct tree_node *nodes;
+	uint32_t node_count;
+	uint32_t node_size;
+	uint32_t *slots; // Node index + 1, 0 when free
+	size_t size; // Power of two
+	struct arena arena; // Names
+};
+
+struct ctx;
+
+union hash_ctx {
+	SHA_CTX sha1;
+	SHA256_CTX sha256;
+};
+
+// Object format of the repository, which sets the length of object ids and of the trailing checksum.
+struct hash_algo {
+	const char *name;
+	size_t len;
+	void (*init)( union hash_ctx *a_hash_ctx );
+	void (*update)( union hash_ctx *a_hash_ctx, const void *a_ptr, size_t a_len );
+	void (*final)( unsigned char *a_md, union hash_ctx *a_hash_ctx );
+	// parse_index_entry of streams, specialized for len
+	int (*parse_entry)( struct ctx *a_ctx, struct gi_entry *entry );
 };
 
 struct ctx {
 	FILE *file;
 	long file_pos; // ftell doesn't work on FIFOs, so we need to maintain our position ourselves.
-	SHA_CTX sha_ctx;
+	const struct hash_algo *hash;
+	union hash_ctx hash_ctx;
+	// Input window, data[0] being at offset data_off in the file.
+	// Regular files are mapped as a whole, so the window never moves and pointers into it stay valid.
+	// Other inputs (stdin, FIFOs…) are read into buffer, and the window slides as the file is consumed.
+	const uint8_t *data;
+	long data_off;
+	size_t data_len;
+	bool mapped;
+	uint8_t *buffer;
+	size_t buffer_size;
+	// Strings copied out of a stream's window
+	struct arena arena;
+	// Checksum. Mapped files are hashed in one go by sha_thread, streams as their window slides.
+	bool verify;
+	long hashed_pos;
+	bool sha_threaded;
+	pthread_t sha_thread;
 	// From the header
 	uint32_t version;
 	uint32_t entry_count;
+	// Entries decoded ahead of the printers by load_entries_threaded, NULL when parsed as they are printed.
+	unsigned threads;
+	struct gi_entry *entries;
+	struct name_cache *users;
+	struct name_cache *groups;
+	struct time_cache *times;
+	// Fixed column widths of the ls view, NULL to compute them
+	const struct ls_widths *ls_widths;
+	// Index in the file of each of the entries, NULL unless they were selected with --path
+	uint32_t *entry_indexes;
+	// Fields of the fields view
+	const struct field **fields;
+	size_t field_count;
+	// Directory levels of the du view
+	unsigned du_depth;
+	struct out *out;
+	struct stats *stats; // NULL unless --stats
+	size_t extensions_pos; // Start of the extensions of a mapped file once found by extensions_start, else 0
+	// Shared index of a split index once merged by load_shared_index, see release_shared_index
+	const struct shared_slot *shared_slot;
+	struct shared_cache *shared_cache; // NULL to decode the shared index of each split index on its own
+	uint32_t shared_entry_count;
+	bool merged; // By load_shared_index, or in the cache the entries were taken from
+	// Cache file whose entries are those of the index, mapped until close_input by open_cache, next_entry decoding them
+	const uint8_t *cache_data;
+	size_t cache_data_len;
+	// Bit n set for entry n when not valid for fsmonitor, NULL unless read ahead by load_fsmonitor for the ls view
+	struct bitmap *fsmonitor_dirty;
+	// Members printed first in each object of the ndjson view, see print_ndjson_entry
+	const char *ndjson_tag;
+};
+
+// What main prints of each index, besides what its struct ctx holds.
+struct options {
+	enum view view;
+	bool plain_tree;
+	bool untracked_tree;
+	char **specs; // --path
+	size_t spec_count;
+	char **tree_queries; // --cache-tree
+	size_t tree_query_count;
+	const char *diff_path; // --diff
+	bool check_wt; // --worktree
+	const char *worktree; // NULL to find it from the path of the index
+	bool batch;
+	bool cache; // --cache
+	bool watch; // --watch
+	bool validate; // --validate
 };
 
 
@@ -84,781 +401,6458 @@ struct ctx {
 #pragma mark Utility methods
 #endif
 
-// Same as fgetc, but updates sha_ctx and file_pos.
-int c_fgetc( struct ctx *a_ctx )
+// Starts timing something for a_stats, if it isn't NULL.
+static inline void stats_start( const struct stats *a_stats, struct timespec *a_since )
 {
-	assert( a_ctx );
+	if (a_stats) clock_gettime( CLOCK_MONOTONIC, a_since );
+}
 
-	int result = fgetc( a_ctx->file );
 
-	if (result != EOF) {
-		char byte = result;
-		SHA1_Update( &a_ctx->sha_ctx, &byte, 1 );
-		a_ctx->file_pos++;
-	}
+// Seconds elapsed since a_since
+static double stats_elapsed( const struct timespec *a_since )
+{
+	struct timespec now;
 
-	return result;
+	clock_gettime( CLOCK_MONOTONIC, &now );
+
+	return (now.tv_sec - a_since->tv_sec) + (now.tv_nsec - a_since->tv_nsec) / 1e9;
 }
 
 
-// Same as fread with the size element set to 1, but updates sha_ctx and file_pos.
-size_t c_fread( void *a_ptr, size_t a_nmemb, struct ctx *a_ctx )
+// Sets up the input window on a_ctx->file, which must be open.
+// Regular files are mapped, anything else goes through a sliding buffer.
+// Returns 0 on success.
+int open_input( struct ctx *a_ctx )
 {
 	assert( a_ctx );
+	assert( a_ctx->file );
+
+	struct stat st;
+
+	a_ctx->data = NULL;
+	a_ctx->data_off = 0;
+	a_ctx->data_len = 0;
+	a_ctx->mapped = false;
+	a_ctx->buffer = NULL;
+	a_ctx->arena.head = NULL;
+	a_ctx->arena.spare = NULL;
+
+	if (fstat( fileno( a_ctx->file ), &st ) == 0 && S_ISREG( st.st_mode ) && st.st_size > 0) {
+		void *map = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno( a_ctx->file ), 0 );
+		if (map != MAP_FAILED) {
+			madvise( map, st.st_size, MADV_SEQUENTIAL );
+			a_ctx->data = map;
+			a_ctx->data_len = st.st_size;
+			a_ctx->mapped = true;
+			return 0;
+		}
+		// else fall back to reading
+	}
 
-	size_t result = fread( a_ptr, 1, a_nmemb, a_ctx->file );
-	SHA1_Update( &a_ctx->sha_ctx, a_ptr, result );
-	a_ctx->file_pos += result;
+	a_ctx->buffer_size = 65536;
+	a_ctx->buffer = malloc( a_ctx->buffer_size );
+	if (!a_ctx->buffer) {
+		perror( "malloc" );
+		return 1;
+	}
+	a_ctx->data = a_ctx->buffer;
 
-	return result;
+	return 0;
 }
 
 
-// Forward seek, roughly corresponding to fseek( a_ctx->file, a_offset, SEEK_CUR ) with a_offset ≥ 0.
-// Updates sha_ctx and file_pos.
-// Returns the effectively seeked amount, which might be less than a_offset in case of error / EOF.
-long seek( struct ctx *a_ctx, long a_offset )
+static void *sha_thread_main( void *a_ctx )
 {
-	assert( a_ctx );
-	assert( a_offset >= 0 );
-
-	char buffer[4096];
-	size_t read = 4096;
-	long remain = a_offset;
+	struct ctx *ctx = a_ctx;
+	struct timespec since;
 
-	// Allow short reads as long as we read at least one byte.
-	while (remain && read > 0) {
-		read = c_fread( buffer, remain < 4096 ? remain : 4096, a_ctx );
-		remain -= read;
-	}
+	stats_start( ctx->stats, &since );
+	ctx->hash->update( &ctx->hash_ctx, ctx->data, ctx->data_len - ctx->hash->len );
+	if (ctx->stats) ctx->stats->checksum_thread = stats_elapsed( &since );
 
-	return a_offset - remain;
+	return NULL;
 }
 
 
-// Allocates a NUL-terminated string read from the file in context,
-// with the provided char as a terminator, which can be EOF.
-// Updates sha_ctx and file_pos.
-// Returns:
-//	- string length as strlen would, not counting the final \0.
-//	- (-1) when growing the buffer fails, or EOF is reached unexpectedly, in which case *a_string is set to NULL.
-ssize_t alloc_string( int a_char, struct ctx * a_ctx, char ** a_string )
+// Starts computing the checksum of everything but the trailing checksum.
+// For mapped files, this runs on its own thread while the content is being parsed.
+void start_checksum( struct ctx *a_ctx )
 {
-	assert( a_char == EOF || (a_char >=0 && a_char <= 255) );
-	assert( a_ctx );
-	assert( a_string );
-
-	char *buffer = NULL;
-	size_t buf_len = 0;
-	size_t buf_used = 0;
-	int next_char;
+	a_ctx->hash->init( &a_ctx->hash_ctx );
+	a_ctx->hashed_pos = 0;
+	a_ctx->sha_threaded = false;
 
-	do {
-		if (buf_used >= buf_len) {
-			buf_len += 4096;
-			char *upd_buffer = realloc( buffer, buf_len );
-			if (!upd_buffer) {
-				perror( "realloc" );
-				free( buffer );
-			}
-			buffer = upd_buffer;
+	if (a_ctx->verify && a_ctx->mapped && a_ctx->data_len > a_ctx->hash->len) {
+		if (pthread_create( &a_ctx->sha_thread, NULL, sha_thread_main, a_ctx ) == 0) {
+			a_ctx->sha_threaded = true;
+		} else {
+			sha_thread_main( a_ctx );
 		}
+	}
+}
 
-		if (buffer) {
-			next_char = c_fgetc( a_ctx );
-			if (next_char == a_char) {
-				buffer[buf_used++] = 0;
-			} else if (next_char < 0) { // EOF
-				fprintf( stderr, "Unexpected end of file while scanning string.\n" );
-				free( buffer );
-				buffer = NULL;
-			} else {
-				buffer[buf_used++] = next_char;
-			}
-		}
-	} while (buffer && next_char != a_char);
 
-	if (buffer) {
-		char *upd_buffer = realloc( buffer, buf_used );
-		if (upd_buffer) buffer = upd_buffer;
-		// else keep the bigger-than-needed buffer
+// Completes the checksum once the input has been consumed up to the trailing checksum.
+void finish_checksum( struct ctx *a_ctx, unsigned char *a_md )
+{
+	struct timespec since;
+
+	stats_start( a_ctx->stats, &since );
+	if (a_ctx->sha_threaded) {
+		pthread_join( a_ctx->sha_thread, NULL );
+		a_ctx->sha_threaded = false;
+	} else if (a_ctx->verify && !a_ctx->mapped) {
+		a_ctx->hash->update( &a_ctx->hash_ctx, a_ctx->buffer + (a_ctx->hashed_pos - a_ctx->data_off), a_ctx->file_pos - a_ctx->hashed_pos );
+		a_ctx->hashed_pos = a_ctx->file_pos;
 	}
-
-	*a_string = buffer;
-	
-	return buffer ? buf_used - 1 : -1;
+	a_ctx->hash->final( a_md, &a_ctx->hash_ctx );
+	if (a_ctx->stats) a_ctx->stats->checksum += stats_elapsed( &since );
 }
 
 
-void print_hex_string( size_t a_len, const void *a_ptr )
+void close_input( struct ctx *a_ctx )
 {
-	assert( a_ptr );
+	if (a_ctx->cache_data) munmap( (void *) a_ctx->cache_data, a_ctx->cache_data_len );
+	a_ctx->cache_data = NULL;
+	if (a_ctx->mapped) {
+		munmap( (void *) a_ctx->data, a_ctx->data_len );
+	} else {
+		free( a_ctx->buffer );
+	}
+	a_ctx->data = NULL;
+	a_ctx->buffer = NULL;
+}
 
-	const uint8_t *ptr = (const uint8_t *) a_ptr;
 
-	while (a_len--) printf( "%02X", *ptr++ );
+// The mapped file of a_ctx, as libgitindex sees it. The entry count is the one of the header until
+// load_shared_index merges the entries.
+static struct gi_index index_view( const struct ctx *a_ctx )
+{
+	struct gi_index index = { .data = a_ctx->data, .len = a_ctx->data_len, .hash_len = a_ctx->hash->len, .version = a_ctx->version, .entry_count = a_ctx->entry_count };
+
+	return index;
 }
 
 
-// Implementation according to:
-//	https://kernel.org/pub/software/scm/git/docs/technical/pack-format.txt
-// (see OFS_DELTA, offset encoding).
-//
-// Warn if an overflow occured.
-//
-// Returns:
-// - a positive value corresponding to the decoded integer on success
-// - (-1) if a read error occured.
-// - other negative vales are possible on overflow
-ssize_t read_offset_delta( struct ctx * a_ctx )
+// Makes a_len bytes starting at file_pos available in the input window, as far as the file goes.
+// For streams, this may slide the window, invalidating pointers previously obtained from it.
+// Returns the number of bytes available at file_pos, at most a_len.
+size_t c_fill( struct ctx *a_ctx, size_t a_len )
 {
 	assert( a_ctx );
 
-	ssize_t offset = 0;
-	int next_char;
-	uint8_t buffer;
-	uint8_t first_char = 0;
-	size_t byte_count = 0;
-
-	do {
-		next_char = c_fgetc( a_ctx );
-		if (next_char != EOF) {
-			buffer = next_char;
-			if (!first_char) first_char = buffer;
-			offset = (offset << 7) | (buffer & 0x7F);
-			byte_count++;
+	size_t start = a_ctx->file_pos - a_ctx->data_off;
+	size_t avail = a_ctx->data_len - start;
+
+	if (avail < a_len && !a_ctx->mapped) {
+		// Bytes about to leave the window have been consumed, so they can't be the trailing checksum.
+		if (a_ctx->verify) {
+			struct timespec since;
+			stats_start( a_ctx->stats, &since );
+			a_ctx->hash->update( &a_ctx->hash_ctx, a_ctx->buffer + (a_ctx->hashed_pos - a_ctx->data_off), a_ctx->file_pos - a_ctx->hashed_pos );
+			a_ctx->hashed_pos = a_ctx->file_pos;
+			if (a_ctx->stats) a_ctx->stats->checksum += stats_elapsed( &since );
 		}
-	} while (next_char != EOF && (next_char & 0x80));
 
-	if (next_char != EOF) {
-		if (byte_count > g_max_offset_delta_len) {
-			fprintf( stderr, "Encoded offset overflow.\n" );
-		} else if (byte_count == g_max_offset_delta_len) {
-			// We need to check first_char to ensure no set bits have been lost while shifting
-			int bits = byte_count * 7 - (sizeof( ssize_t ) * 8 - 1);
-			uint8_t mask = ((1 << bits) - 1) << (7-bits);
-			if (first_char & mask) {
-				fprintf( stderr, "Encoded offset overflow.\n" );
+		// Move the unread bytes to the front of the buffer, and grow it if it's still too small.
+		memmove( a_ctx->buffer, a_ctx->buffer + start, avail );
+		a_ctx->data_off = a_ctx->file_pos;
+		a_ctx->data_len = avail;
+
+		if (a_len > a_ctx->buffer_size) {
+			size_t new_size = a_ctx->buffer_size;
+			while (new_size < a_len) new_size *= 2;
+			uint8_t *new_buffer = realloc( a_ctx->buffer, new_size );
+			if (a_ctx->stats) a_ctx->stats->reallocs++;
+			if (new_buffer) {
+				a_ctx->buffer = new_buffer;
+				a_ctx->buffer_size = new_size;
+			} else {
+				perror( "realloc" );
 			}
 		}
+		a_ctx->data = a_ctx->buffer;
 
-		for (size_t pow7 = 0x80; --byte_count; pow7<<=7) {
-			offset += pow7;
-		}
-
-		if (offset < 0) {
-			fprintf( stderr, "Encoded offset overflow.\n" );
+		while (a_ctx->data_len < a_len) {
+			size_t read = fread( a_ctx->buffer + a_ctx->data_len, 1, a_ctx->buffer_size - a_ctx->data_len, a_ctx->file );
+			if (read == 0) break;
+			a_ctx->data_len += read;
 		}
-	} else {
-		fprintf( stderr, "Unexpected end of file while scanning encoded offset\n" );
-		offset = -1;
+		avail = a_ctx->data_len;
 	}
 
-	return offset;
+	return avail < a_len ? avail : a_len;
 }
 
 
-// Allocates a_tree->path
-ssize_t parse_tree_entry( struct ctx *a_ctx, struct tree * a_tree )
+// Returns a pointer to the a_len bytes at file_pos without consuming them, or NULL if the file is too short.
+const uint8_t *c_peek( struct ctx *a_ctx, size_t a_len )
 {
-	ssize_t result;
-	char *entry_count;
-	char *subtrees;
-	char *end_ptr;
+	if (c_fill( a_ctx, a_len ) < a_len) return NULL;
 
-	result = alloc_string( '\0', a_ctx, &a_tree->path );
-	if (result == -1) goto pte_exit1;
-	result = alloc_string( ' ', a_ctx, &entry_count );
-	if (result == -1) goto pte_exit1;
-	result = alloc_string( '\n', a_ctx, &subtrees );
-	if (result == -1) goto pte_exit2;
+	return a_ctx->data + (a_ctx->file_pos - a_ctx->data_off);
+}
 
-	a_tree->entry_count = strtoul( entry_count, &end_ptr, 10 );
-	a_tree->subtrees = strtoul( subtrees, &end_ptr, 10 );
 
-	free( entry_count );
-	free( subtrees );
+// Consumes a_len bytes, returning a pointer to them, or NULL (consuming nothing) if the file is too short.
+// Updates file_pos.
+const uint8_t *c_fetch( struct ctx *a_ctx, size_t a_len )
+{
+	const uint8_t *result = c_peek( a_ctx, a_len );
 
-	if (a_tree->entry_count >= 0) {
-		result = c_fread( a_tree->sha1, 20, a_ctx );
+	if (result) {
+		a_ctx->file_pos += a_len;
 	}
 
 	return result;
-
-pte_exit2:
-	free( entry_count );
-pte_exit1:
-	return result;
 }
 
 
-void pretty_read_tree( struct ctx *a_ctx, long a_endpos, int a_level, bool a_last, const char * tree_str )
+// Same as fgetc, but updates file_pos.
+int c_fgetc( struct ctx *a_ctx )
 {
-	if (a_ctx->file_pos >= a_endpos) {
-		if (a_level > 0) {
-			fprintf( stderr, "Incomplete tree\n" );
-		} // else parsing finished
-	} else {
-		struct tree tree;
-		char *new_tree_str;
-
-		parse_tree_entry( a_ctx, &tree );
-
-		if (tree.entry_count >= 0) {
-			print_hex_string( 20, tree.sha1 );
-		} else {
-			printf( "                                        " );
-		}
+	assert( a_ctx );
 
-		printf( "  %s", tree_str );
-		if (a_level > 0) {
-			if (a_last) {
-				printf( "└─ " );
-				new_tree_str = malloc( strlen( tree_str ) + 4 );
-				sprintf( new_tree_str, "%s   ", tree_str );
-			} else {
-				printf( "├─ " );
-				new_tree_str = malloc( strlen( tree_str ) + 6 ); // '│' uses 3 bytes
-				sprintf( new_tree_str, "%s│  ", tree_str );
-			}
-		} else {
-			new_tree_str = strdup( tree_str );
-		}
-		printf( "'%s', %d entries\n", tree.path, tree.entry_count );
-		free( tree.path );
+	const uint8_t *byte = c_fetch( a_ctx, 1 );
 
-		if (tree.subtrees > 0) {
-			for (int i=0; i < tree.subtrees - 1; i++) {
-				pretty_read_tree( a_ctx, a_endpos, a_level + 1, false, new_tree_str );
-			}
-			pretty_read_tree( a_ctx, a_endpos, a_level + 1, true, new_tree_str );
-		}
-		free( new_tree_str );
-	}
+	return byte ? *byte : EOF;
 }
 
-void read_tree( struct ctx *a_ctx, long a_endpos )
+
+// Same as fread with the size element set to 1, but updates file_pos.
+size_t c_fread( void *a_ptr, size_t a_nmemb, struct ctx *a_ctx )
 {
-	while (a_ctx->file_pos < a_endpos ) {
-		struct tree tree;
+	assert( a_ctx );
 
-		parse_tree_entry( a_ctx, &tree );
+	size_t result = c_fill( a_ctx, a_nmemb );
+	memcpy( a_ptr, c_fetch( a_ctx, result ), result );
 
-		printf( "Path: '%s'\n", tree.path );
-		printf( "Entry count: %d, subtrees: %u\n", tree.entry_count, tree.subtrees );
-		if (tree.entry_count >= 0) {
-			printf( "Object name: " );
-			print_hex_string( 20, tree.sha1 );
-			printf( "\n" );
-		}
-		printf( "\n" );
-//		printf( "\n%ld bytes remaining\n\n", endpos - a_ctx->file_pos );
-		free( tree.path );
-	}
-	if (a_ctx->file_pos > a_endpos) {
-		printf( "We read too much\n" );
-	}
+	return result;
 }
 
-// str must have enough space for 36/37 bytes:
-// yyyy-mm-ddThh:mm:ss,nnnnnnnnn±hh:mm
-// yyyy-mm-dd hh:mm:ss.nnnnnnnnn ±hh:mm
-void time2str( char *a_str, int32_t a_sec, int32_t a_nsec )
+
+// Forward seek, roughly corresponding to fseek( a_ctx->file, a_offset, SEEK_CUR ) with a_offset ≥ 0.
+// Updates file_pos.
+// Returns the effectively seeked amount, which might be less than a_offset in case of error / EOF.
+long seek( struct ctx *a_ctx, long a_offset )
 {
-	time_t time = (time_t) a_sec; // Extends to 64-bit
-	struct tm *tm = localtime( &time ); // or gmtime
-	char nanostr[12]; // Only 10 will be used if constraints are followed
-	if (a_nsec < 0 || a_nsec >= 1000000000) {
-		fprintf( stderr, "Invalid value nsec: %d\n", a_nsec );
+	assert( a_ctx );
+	assert( a_offset >= 0 );
+
+	size_t read = 1;
+	long remain = a_offset;
+
+	// For mapped files this is a single step; streams are consumed one window at a time.
+	while (remain && read > 0) {
+		read = c_fill( a_ctx, remain < 65536 ? remain : 65536 );
+		c_fetch( a_ctx, read );
+		remain -= read;
 	}
-//	strftime( a_str, 36, "%FT%T,xxxxxxxxx%z", tm );
-	strftime( a_str, 36, "%F %T.xxxxxxxxx %z", tm );
-	sprintf( nanostr, "%09d",  a_nsec );
-	memcpy( &a_str[20], nanostr, 9 );
-}
 
-void print_perm( char a_perm )
-{
-	printf( "%c%c%c", a_perm & 4 ? 'r' : '-', a_perm & 2 ? 'w' : '-', a_perm & 1 ? 'x' : '-' );
+	return a_offset - remain;
 }
 
-void print_flags( uint16_t a_flags )
+
+// Scans the input window from file_pos for the provided terminator, without consuming anything.
+// Returns the length of the string before the terminator, or (-1) if EOF is reached first.
+ssize_t c_scan( int a_char, struct ctx *a_ctx )
 {
-	// Merge stages:
-	// https://git-scm.com/book/en/v2/Git-Tools-Advanced-Merging
-	// 0: not in a merge conflict '-'
-	// 1: common ancestor 'c' / base
-	// 2: ours 'o'
-	// 3: theirs 't'
-	char merge;
-	switch ((a_flags >> 12) & 3) {
-	case 0: merge = '-'; break;
-	case 1: merge = 'c'; break;
-	case 2: merge = 'o'; break;
-	case 3: merge = 't'; break;
+	assert( a_char >= 0 && a_char <= 255 );
+	assert( a_ctx );
+
+	size_t scanned = 0;
+	size_t avail = c_fill( a_ctx, 256 );
+	const uint8_t *start;
+	const uint8_t *found;
+
+	for (;;) {
+		start = a_ctx->data + (a_ctx->file_pos - a_ctx->data_off);
+		found = memchr( start + scanned, a_char, avail - scanned );
+		if (found) break;
+		scanned = avail;
+		avail = c_fill( a_ctx, avail * 2 );
+		if (avail == scanned) {
+			fprintf( stderr, "Unexpected end of file while scanning string.\n" );
+			return -1;
+		}
 	}
-	printf( "%c%c%c", a_flags & 0x8000 ? 'v' : '-', a_flags & 0x4000 ? 'x' : '-', merge );
+
+	return found - start;
 }
 
-void print_flags_long( uint16_t a_flags )
-{
-	bool is_first = true;
-	int merge = (a_flags >> 12) & 3;
 
-	if (a_flags & 0x8000) {
-		printf( "assume-valid" );
-		is_first = false;
-	}
+#define ARENA_CHUNK_SIZE (64 * 1024)
 
-	if (a_flags & 0x4000) {
-		if (!is_first) printf( ", " );
-		printf( "extended" );
-		is_first = false;
-	}
+// Returns a_len bytes, suitably aligned for any type, or NULL if growing the arena fails.
+void *arena_alloc( struct arena *a_arena, size_t a_len )
+{
+	assert( a_arena );
 
-	if (merge) {
-		if (!is_first) printf( ", " );
-		switch (merge) {
-		case 1: printf( "merge_common_ancestor" ); break;
-		case 2: printf( "merge_ours" ); break;
-		case 3: printf( "merge_theirs" ); break;
+	struct arena_chunk *chunk = a_arena->head;
+	size_t aligned = (a_len + sizeof( max_align_t ) - 1) & ~(sizeof( max_align_t ) - 1);
+
+	if (!chunk || chunk->size - chunk->used < aligned) {
+		if (a_arena->spare && a_arena->spare->size >= aligned) {
+			chunk = a_arena->spare;
+			a_arena->spare = chunk->next;
+		} else {
+			size_t size = aligned > ARENA_CHUNK_SIZE ? aligned : ARENA_CHUNK_SIZE;
+			chunk = malloc( sizeof( struct arena_chunk ) + size );
+			if (a_arena->stats) a_arena->stats->arena_chunks++;
+			if (!chunk) {
+				perror( "malloc" );
+				return NULL;
+			}
+			chunk->size = size;
 		}
+		chunk->used = 0;
+		chunk->next = a_arena->head;
+		a_arena->head = chunk;
 	}
+
+	void *result = (char *) chunk->data + chunk->used;
+	chunk->used += aligned;
+	if (a_arena->stats) a_arena->stats->arena_allocs++;
+
+	return result;
 }
 
-void print_extended_flags( uint16_t a_flags )
+
+struct arena_mark arena_get_mark( struct arena *a_arena )
 {
-	printf( "%c%c%c", a_flags & 0x8000 ? 'r' : '-', a_flags & 0x4000 ? 's' : '-', a_flags & 0x2000 ? 'i' : '-' );
+	struct arena_mark mark = { .chunk = a_arena->head, .used = a_arena->head ? a_arena->head->used : 0 };
+
+	return mark;
 }
 
 
-void print_extended_flags_long( uint16_t a_flags )
+// Releases everything allocated since a_mark was taken.
+void arena_reset( struct arena *a_arena, struct arena_mark a_mark )
 {
-	bool is_first = true;
-
-	if (a_flags & 0x8000) {
-		printf( "reserved" );
-		is_first = false;
+	while (a_arena->head != a_mark.chunk) {
+		struct arena_chunk *chunk = a_arena->head;
+		a_arena->head = chunk->next;
+		chunk->next = a_arena->spare;
+		a_arena->spare = chunk;
 	}
+	if (a_arena->head) a_arena->head->used = a_mark.used;
+}
 
-	if (a_flags & 0x4000) {
-		if (!is_first) printf( ", " );
-		printf( "skip-worktree" );
-		is_first = false;
-	}
 
-	if (a_flags & 0x4000) {
-		if (!is_first) printf( ", " );
-		printf( "intent-to-add" );
-		is_first = false;
+void arena_free( struct arena *a_arena )
+{
+	struct arena_chunk *lists[] = { a_arena->head, a_arena->spare };
+
+	for (int idx = 0; idx < 2; idx++) {
+		while (lists[idx]) {
+			struct arena_chunk *next = lists[idx]->next;
+			free( lists[idx] );
+			lists[idx] = next;
+		}
 	}
+	a_arena->head = NULL;
+	a_arena->spare = NULL;
 }
 
 
-// Allocates entry->file_name
-int parse_index_entry( struct ctx * a_ctx, struct entry *entry )
+// Returns a pointer to a_len bytes from the input window which stays valid as long as the arena of a_ctx.
+// For mapped files this is a_ptr itself, otherwise a copy.
+const char *c_keep( struct ctx *a_ctx, const void *a_ptr, size_t a_len )
 {
-	size_t result = c_fread( entry, 62, a_ctx );
-	if (result == 62) {
-		entry->ctime = ntohl( entry->ctime );
-		entry->ctime_ns = ntohl( entry->ctime_ns );
-		entry->mtime = ntohl( entry->mtime );
-		entry->mtime_ns = ntohl( entry->mtime_ns );
-		entry->dev = ntohl( entry->dev );
-		entry->ino = ntohl( entry->ino );
-		entry->mode = ntohl( entry->mode );
-		entry->uid = ntohl( entry->uid );
-		entry->gid = ntohl( entry->gid );
-		entry->file_size = ntohl( entry->file_size );
-		entry->flags = ntohs( entry->flags );
+	if (a_ctx->mapped) return a_ptr;
 
-		if (a_ctx->version >=3 && (entry->flags & 0x4000)) {
-			c_fread( &entry->extended_flags, 2, a_ctx );
-			entry->extended_flags = ntohs( entry->extended_flags );
-		}
+	char *copy = arena_alloc( &a_ctx->arena, a_len );
+	if (copy) memcpy( copy, a_ptr, a_len );
 
-		if (a_ctx->version >= 4) {
-			entry->prefix = read_offset_delta( a_ctx );
-		}
+	return copy;
+}
 
-		entry->file_name_len = alloc_string( '\0', a_ctx, &entry->file_name );
 
-		if (entry->file_name) {
-			if (a_ctx->version < 4 && a_ctx->file_pos % 8 != 4) {
-				entry->pad_bytes_len = 8 - ((a_ctx->file_pos - 4) % 8);
-				entry->pad_bytes = malloc( entry->pad_bytes_len ); // XXX: allocate and read with entry->file_name
-				c_fread( entry->pad_bytes, entry->pad_bytes_len, a_ctx );
-			} else {
-				entry->pad_bytes_len = 0; // It should be possible to do better…
-			}
-			result = 0;
-		} else {
-			perror( "Allocating index entry file name" );
-			result = 1;
-		}
+// Consumes a string ending with the provided terminator, which is included in the returned view.
+// Updates file_pos.
+// Returns:
+//	- string length as strlen would, not counting the terminator.
+//	- (-1) when EOF is reached unexpectedly, in which case *a_string is set to NULL.
+ssize_t fetch_string( int a_char, struct ctx *a_ctx, const char **a_string )
+{
+	assert( a_string );
 
-	} else {
-		perror( "Reading index entry" );
-		result = 1;
-	}
+	ssize_t result = c_scan( a_char, a_ctx );
+
+	*a_string = result >= 0 ? (const char *) c_fetch( a_ctx, result + 1 ) : NULL;
 
 	return result;
 }
 
 
-int parse_index_stat( struct ctx * a_ctx )
+// Parses a decimal integer from a string which isn't necessarily NUL-terminated.
+long view_to_long( const char *a_ptr, size_t a_len )
 {
-	int result;
-	struct entry entry = { .extended_flags = 0 };
-	char *path_name = NULL;
+	char buffer[24];
 
-	for (int idx = 0; idx < a_ctx->entry_count; idx++) {
-		result = parse_index_entry( a_ctx, &entry );
+	if (a_len >= sizeof( buffer )) a_len = sizeof( buffer ) - 1;
+	memcpy( buffer, a_ptr, a_len );
+	buffer[a_len] = 0;
 
-		char ctimestr[37];
-		char mtimestr[37];
-		time2str( ctimestr, entry.ctime, entry.ctime_ns );
-		time2str( mtimestr, entry.mtime, entry.mtime_ns );
+	return strtol( buffer, NULL, 10 );
+}
 
-		const char *obj_type = NULL;
-		char objtype_c = '?';
-		switch ((entry.mode >> 12) & 0x0F) {
-		case 0x8: objtype_c = '-'; obj_type = "regular file"; break;
-		case 0xA: objtype_c = 'l'; obj_type = "symbolic link"; break;
-		case 0xE: objtype_c = 'g'; obj_type = "gitlink"; break;
-		}
 
-		struct passwd *user = getpwuid( entry.uid );
-		struct group *group = getgrgid( entry.gid );
+#if 0
+#pragma mark Output
+#endif
 
-		int col_width[] = {17, 0};
-		char dev_str[23];
-		char ino_str[11];
-		char *user_str = malloc( user ? strlen( user->pw_name ) + 14 : 14 );
-		size_t old_len;
+#define OUT_BUFFER_SIZE (256 * 1024)
 
-		sprintf( dev_str, "%Xh/%ud", entry.dev, entry.dev );
-		sprintf( ino_str, "%u", entry.ino );
-		sprintf( user_str, "(%u/%s)", entry.uid, user ? user->pw_name : "" );
+// out_mem for string literals
+#define OUT_LIT( a_out, a_literal ) out_mem( a_out, a_literal, sizeof( a_literal ) - 1 )
 
-		if (strlen( dev_str ) > col_width[0]) col_width[0] = strlen( dev_str );
-		if (strlen( obj_type ) - 7 > col_width[1]) col_width[1] = strlen( obj_type ) - 7;
-		if (strlen( ino_str ) > col_width[1]) col_width[1] = strlen( ino_str );
-		if (strlen( user_str ) > col_width[1]) col_width[1] = strlen( user_str );
+int out_init( struct out *a_out, int a_fd )
+{
+	a_out->fd = a_fd;
+	a_out->line_buffered = isatty( a_fd );
+	a_out->failed = false;
+	a_out->len = 0;
+	a_out->size = OUT_BUFFER_SIZE;
+	a_out->stats = NULL;
+	a_out->buf = malloc( a_out->size );
+	if (!a_out->buf) {
+		perror( "malloc" );
+		return 1;
+	}
+
+	return 0;
+}
+
+
+// Returns 0 on success, or 1 if writing failed now or earlier.
+int out_flush( struct out *a_out )
+{
+	size_t done = 0;
+	struct timespec since;
+
+	stats_start( a_out->stats, &since );
+	while (done < a_out->len && !a_out->failed) {
+		ssize_t written = write( a_out->fd, a_out->buf + done, a_out->len - done );
+		if (written > 0) {
+			done += written;
+		} else if (!written) {
+			// Nothing tells it would ever progress.
+			fprintf( stderr, "write: nothing written\n" );
+			a_out->failed = true;
+		} else if (errno != EINTR) {
+			perror( "write" );
+			a_out->failed = true;
+		}
+	}
+	a_out->len = 0;
+	if (a_out->stats) a_out->stats->output += stats_elapsed( &since );
+
+	return a_out->failed;
+}
+
+
+int out_free( struct out *a_out )
+{
+	int result = out_flush( a_out );
+
+	free( a_out->buf );
+	a_out->buf = NULL;
+
+	return result;
+}
+
+
+// Returns room for a_len bytes (at most OUT_BUFFER_SIZE), to be committed by adding to a_out->len.
+static inline char *out_reserve( struct out *a_out, size_t a_len )
+{
+	if (a_out->size - a_out->len < a_len) out_flush( a_out );
+
+	return a_out->buf + a_out->len;
+}
+
+
+void out_mem( struct out *a_out, const void *a_ptr, size_t a_len )
+{
+	if (a_out->size - a_out->len < a_len) {
+		out_flush( a_out );
+		if (a_len > a_out->size) {
+			// Too big to be worth copying
+			const char *saved = a_out->buf;
+			a_out->buf = (char *) a_ptr;
+			a_out->len = a_len;
+			out_flush( a_out );
+			a_out->buf = (char *) saved;
+			return;
+		}
+	}
+
+	memcpy( a_out->buf + a_out->len, a_ptr, a_len );
+	a_out->len += a_len;
+
+	if (a_out->line_buffered && memchr( a_ptr, '\n', a_len )) out_flush( a_out );
+}
+
+
+void out_str( struct out *a_out, const char *a_str )
+{
+	out_mem( a_out, a_str, strlen( a_str ) );
+}
+
+
+void out_char( struct out *a_out, char a_char )
+{
+	*out_reserve( a_out, 1 ) = a_char;
+	a_out->len++;
+
+	if (a_out->line_buffered && a_char == '\n') out_flush( a_out );
+}
+
+
+void out_pad( struct out *a_out, int a_count )
+{
+	while (a_count > 0) {
+		int len = a_count < 64 ? a_count : 64;
+		memset( out_reserve( a_out, len ), ' ', len );
+		a_out->len += len;
+		a_count -= len;
+	}
+}
+
+
+// Formats a_value in decimal into a_buf, which needs room for 20 characters.
+// Returns the number of characters written, no NUL terminator being added.
+size_t fmt_uint( char *a_buf, uint64_t a_value )
+{
+	char digits[20];
+	char *ptr = digits + sizeof( digits );
+
+	while (a_value >= 100) {
+		ptr -= 2;
+		memcpy( ptr, g_dec_pairs[a_value % 100], 2 );
+		a_value /= 100;
+	}
+	if (a_value >= 10) {
+		ptr -= 2;
+		memcpy( ptr, g_dec_pairs[a_value], 2 );
+	} else {
+		*--ptr = '0' + a_value;
+	}
+
+	size_t len = digits + sizeof( digits ) - ptr;
+	memcpy( a_buf, ptr, len );
+
+	return len;
+}
+
+
+// Same as fmt_uint for a signed value, which also takes 20 characters at most.
+size_t fmt_int( char *a_buf, int64_t a_value )
+{
+	if (a_value >= 0) return fmt_uint( a_buf, a_value );
+
+	*a_buf = '-';
+	return 1 + fmt_uint( a_buf + 1, -(uint64_t) a_value );
+}
+
+
+// Same as fmt_uint, in uppercase hexadecimal with at least a_min_digits digits (8 at most).
+size_t fmt_hex32( char *a_buf, uint32_t a_value, int a_min_digits )
+{
+	int digits = 1;
+
+	while (digits < 8 && (a_value >> (4 * digits))) digits++;
+	if (digits < a_min_digits) digits = a_min_digits;
+
+	for (int idx = digits - 1; idx >= 0; idx--) {
+		a_buf[idx] = "0123456789ABCDEF"[a_value & 15];
+		a_value >>= 4;
+	}
+
+	return digits;
+}
+
+
+void out_uint( struct out *a_out, uint64_t a_value )
+{
+	a_out->len += fmt_uint( out_reserve( a_out, 20 ), a_value );
+}
+
+
+void out_int( struct out *a_out, int64_t a_value )
+{
+	a_out->len += fmt_int( out_reserve( a_out, 20 ), a_value );
+}
+
+
+// Same as printf( "%*u" ), left-aligned when a_width is negative.
+void out_uint_w( struct out *a_out, uint64_t a_value, int a_width )
+{
+	char digits[20];
+	size_t len = fmt_uint( digits, a_value );
+
+	if (a_width > 0) out_pad( a_out, a_width - (int) len );
+	out_mem( a_out, digits, len );
+	if (a_width < 0) out_pad( a_out, -a_width - (int) len );
+}
+
+
+// Same as printf( "%*s" ), left-aligned when a_width is negative.
+void out_str_w( struct out *a_out, const char *a_str, size_t a_len, int a_width )
+{
+	if (a_width > 0) out_pad( a_out, a_width - (int) a_len );
+	out_mem( a_out, a_str, a_len );
+	if (a_width < 0) out_pad( a_out, -a_width - (int) a_len );
+}
+
+
+// Table-driven replacement for a loop of printf( "%02X" )
+void out_hex( struct out *a_out, size_t a_len, const void *a_ptr )
+{
+	assert( a_ptr );
+
+	const uint8_t *ptr = (const uint8_t *) a_ptr;
+
+	while (a_len) {
+		size_t chunk = a_len < 512 ? a_len : 512;
+		char *dest = out_reserve( a_out, chunk * 2 );
+		for (size_t idx = 0; idx < chunk; idx++) {
+			memcpy( dest + 2 * idx, g_hex_pairs[*ptr++], 2 );
+		}
+		a_out->len += chunk * 2;
+		a_len -= chunk;
+	}
+}
+
+
+// For the lines which aren't worth a dedicated formatter.
+__attribute__(( format( printf, 2, 3 ) ))
+void out_printf( struct out *a_out, const char *a_format, ... )
+{
+	va_list args;
+	char buffer[1024];
+
+	va_start( args, a_format );
+	int len = vsnprintf( buffer, sizeof( buffer ), a_format, args );
+	va_end( args );
+
+	if (len >= (int) sizeof( buffer )) {
+		char *big = malloc( len + 1 );
+		if (big) {
+			va_start( args, a_format );
+			vsnprintf( big, len + 1, a_format, args );
+			va_end( args );
+			out_mem( a_out, big, len );
+			free( big );
+		}
+	} else if (len > 0) {
+		out_mem( a_out, buffer, len );
+	}
+}
+
+
+// Decodes an offset encoded as the v4 path prefixes, see gi_decode_varint, from the file in context.
+//
+// Returns:
+// - a positive value corresponding to the decoded integer on success
+// - (-1) if a read error occured.
+// - (-2) on overflow
+ssize_t read_offset_delta( struct ctx * a_ctx )
+{
+	assert( a_ctx );
+
+	// No valid encoding is longer than GI_VARINT_MAX_LEN, allow one more byte to detect overflows.
+	size_t avail = c_fill( a_ctx, GI_VARINT_MAX_LEN + 1 );
+	size_t used;
+	ssize_t offset = gi_decode_varint( c_peek( a_ctx, avail ), avail, &used );
+
+	if (used) {
+		if (offset == -2) fprintf( stderr, "Encoded offset overflow.\n" );
+		c_fetch( a_ctx, used );
+	} else if (avail > GI_VARINT_MAX_LEN) {
+		fprintf( stderr, "Encoded offset overflow.\n" );
+		c_fetch( a_ctx, avail );
+		offset = -2;
+	} else {
+		fprintf( stderr, "Unexpected end of file while scanning encoded offset\n" );
+		offset = -1;
+	}
+
+	return offset;
+}
+
+
+// Rebuilds a v4 path from the previous one: drops a_strip bytes from its end, then appends a_suffix.
+// Each call costs O(a_suffix_len), the buffer being reused from one entry to the next.
+// Returns 0 on success, 1 if a_strip is larger than the previous path (which is then entirely dropped)
+// or the buffer can't grow.
+int path_buf_apply( struct path_buf *a_path, size_t a_strip, const char *a_suffix, size_t a_suffix_len )
+{
+	assert( a_path );
+
+	int result = 0;
+
+	if (a_strip > a_path->len) {
+		a_strip = a_path->len;
+		result = 1;
+	}
+	a_path->len -= a_strip;
+
+	if (a_path->len + a_suffix_len + 1 > a_path->size) {
+		size_t new_size = a_path->size ? a_path->size : 256;
+		while (new_size < a_path->len + a_suffix_len + 1) new_size *= 2;
+		char *new_buf = realloc( a_path->buf, new_size );
+		if (a_path->stats) a_path->stats->reallocs++;
+		if (!new_buf) {
+			perror( "realloc" );
+			return 1;
+		}
+		a_path->buf = new_buf;
+		a_path->size = new_size;
+	}
+
+	memcpy( a_path->buf + a_path->len, a_suffix, a_suffix_len );
+	a_path->len += a_suffix_len;
+	a_path->buf[a_path->len] = 0;
+
+	return result;
+}
+
+
+void tree_index_init( struct tree_index *a_index, struct stats *a_stats )
+{
+	a_index->nodes = NULL;
+	a_index->node_count = 0;
+	a_index->node_size = 0;
+	a_index->slots = NULL;
+	a_index->size = 0;
+	a_index->arena.head = NULL;
+	a_index->arena.spare = NULL;
+	a_index->arena.stats = a_stats;
+}
+
+
+void tree_index_free( struct tree_index *a_index )
+{
+	free( a_index->nodes );
+	free( a_index->slots );
+	arena_free( &a_index->arena );
+	tree_index_init( a_index, a_index->arena.stats );
+}
+
+
+#define PATH_HASH_INIT 2166136261u
+
+// FNV-1a, which can be extended one component at a time
+static uint32_t path_hash( uint32_t a_hash, const char *a_path, size_t a_len )
+{
+	for (size_t idx = 0; idx < a_len; idx++) {
+		a_hash = (a_hash ^ (uint8_t) a_path[idx]) * 16777619u;
+	}
+
+	return a_hash;
+}
+
+
+// Whether the path of a_node is a_path, compared from its end up to the root.
+static bool tree_node_matches( const struct tree_index *a_index, const struct tree_node *a_node, const char *a_path, size_t a_len )
+{
+	if (a_node->path_len != a_len) return false;
+
+	for (;;) {
+		if (a_node->name_len > a_len || memcmp( a_path + a_len - a_node->name_len, a_node->name, a_node->name_len )) return false;
+		a_len -= a_node->name_len;
+		if (a_node->parent == TREE_NO_NODE) return a_len == 0;
+		a_node = &a_index->nodes[a_node->parent];
+		if (a_node->path_len) {
+			if (!a_len || a_path[a_len - 1] != '/') return false;
+			a_len--;
+		}
+	}
+}
+
+
+// Adds a_tree as a subtree of the node a_parent, or as a root if it is TREE_NO_NODE.
+// Returns its node, or TREE_NO_NODE if memory runs out.
+uint32_t tree_index_add( struct tree_index *a_index, uint32_t a_parent, const struct gi_tree *a_tree, size_t a_hash_len )
+{
+	assert( a_index );
+
+	if (a_index->node_count == a_index->node_size) {
+		uint32_t new_size = a_index->node_size ? a_index->node_size * 2 : 64;
+		struct tree_node *new_nodes = new_size > a_index->node_size ? realloc( a_index->nodes, new_size * sizeof( struct tree_node ) ) : NULL;
+		if (a_index->arena.stats) a_index->arena.stats->reallocs++;
+		if (!new_nodes) {
+			perror( "realloc" );
+			return TREE_NO_NODE;
+		}
+		a_index->nodes = new_nodes;
+		a_index->node_size = new_size;
+	}
+
+	// Keep the load factor under 1/2.
+	if ((a_index->node_count + 1) * (size_t) 2 > a_index->size) {
+		size_t new_size = a_index->size ? a_index->size * 2 : 128;
+		uint32_t *new_slots = calloc( new_size, sizeof( uint32_t ) );
+		if (!new_slots) {
+			perror( "calloc" );
+			return TREE_NO_NODE;
+		}
+		for (uint32_t node = 0; node < a_index->node_count; node++) {
+			size_t idx = a_index->nodes[node].hash & (new_size - 1);
+			while (new_slots[idx]) idx = (idx + 1) & (new_size - 1);
+			new_slots[idx] = node + 1;
+		}
+		free( a_index->slots );
+		a_index->slots = new_slots;
+		a_index->size = new_size;
+	}
+
+	struct tree_node *node = &a_index->nodes[a_index->node_count];
+	char *name = arena_alloc( &a_index->arena, a_tree->path_len + 1 );
+	if (!name) return TREE_NO_NODE;
+	memcpy( name, a_tree->path, a_tree->path_len );
+	name[a_tree->path_len] = 0;
+
+	node->name = name;
+	node->name_len = a_tree->path_len;
+	node->parent = a_parent;
+	node->hash = PATH_HASH_INIT;
+	node->path_len = 0;
+	if (a_parent != TREE_NO_NODE) {
+		const struct tree_node *parent = &a_index->nodes[a_parent];
+		node->hash = parent->hash;
+		node->path_len = parent->path_len;
+		if (node->path_len) {
+			node->hash = path_hash( node->hash, "/", 1 );
+			node->path_len++;
+		}
+	}
+	node->hash = path_hash( node->hash, name, node->name_len );
+	node->path_len += node->name_len;
+	node->entry_count = a_tree->entry_count;
+	node->subtrees = a_tree->subtrees;
+	memcpy( node->oid, a_tree->oid, a_tree->entry_count >= 0 ? a_hash_len : 0 );
+
+	size_t idx = node->hash & (a_index->size - 1);
+	while (a_index->slots[idx]) idx = (idx + 1) & (a_index->size - 1);
+	a_index->slots[idx] = ++a_index->node_count;
+
+	return a_index->node_count - 1;
+}
+
+
+// Returns the tree of a_path, "" being the root, or NULL if there is none.
+// Should the extension list a path twice, its first tree is returned.
+const struct tree_node *tree_index_get( const struct tree_index *a_index, const char *a_path, size_t a_len )
+{
+	assert( a_index );
+
+	if (!a_index->size) return NULL;
+
+	uint32_t hash = path_hash( PATH_HASH_INIT, a_path, a_len );
+
+	for (size_t idx = hash & (a_index->size - 1); a_index->slots[idx]; idx = (idx + 1) & (a_index->size - 1)) {
+		const struct tree_node *node = &a_index->nodes[a_index->slots[idx] - 1];
+		if (node->hash == hash && tree_node_matches( a_index, node, a_path, a_len )) return node;
+	}
+
+	return NULL;
+}
+
+
+// Consumes an entry of the TREE extension without copying anything: a_tree->path points into the input window,
+// and is only valid until the input is read further.
+// Returns 0 on success, 1 if the entry is truncated or malformed.
+int parse_tree_entry( struct ctx *a_ctx, struct gi_tree * a_tree )
+{
+	ssize_t path_len = c_scan( '\0', a_ctx );
+	if (path_len == -1) return 1;
+
+	// Both counts take at most 12 bytes with their terminator.
+	size_t avail = c_fill( a_ctx, path_len + 1 + 2 * 12 + a_ctx->hash->len );
+	const char *start = (const char *) a_ctx->data + (a_ctx->file_pos - a_ctx->data_off);
+	const char *next;
+
+	switch (gi_parse_tree_entry( start, start + avail, a_ctx->hash->len, a_tree, &next )) {
+	case GI_OK: break;
+	case GI_TRUNCATED:
+		fprintf( stderr, "Unexpected end of file in TREE entry\n" );
+		return 1;
+	default:
+		fprintf( stderr, "Invalid TREE entry at offset %zu\n", (size_t) a_ctx->file_pos );
+		return 1;
+	}
+	c_fetch( a_ctx, next - start );
+
+	return 0;
+}
+
+
+// Reads the entries of the TREE extension from file_pos up to a_endpos, depth-first as they are stored.
+// Prints them as a tree if a_print, and adds them by path to a_index unless it is NULL.
+// The walk keeps its own stack and a single prefix buffer, however deep the trees.
+// Returns 0 on success, 1 if the trees are malformed or incomplete, file_pos being moved to a_endpos then.
+int walk_tree( struct ctx *a_ctx, long a_endpos, bool a_print, struct tree_index *a_index )
+{
+	struct out *out = a_ctx->out;
+	// The lines drawn before the trees of each level
+	struct path_buf prefix = { .buf = NULL, .len = 0, .size = 0, .stats = a_ctx->stats };
+	struct tree_frame *frames = NULL;
+	size_t frame_size = 0;
+	size_t depth = 0;
+	int result = 0;
+
+	path_buf_apply( &prefix, 0, "", 0 );
+
+	while (depth > 0 || a_ctx->file_pos < a_endpos) {
+		struct tree_frame *frame = depth ? &frames[depth - 1] : NULL;
+		if (frame && !frame->remaining) {
+			depth--;
+			continue;
+		}
+		if (a_ctx->file_pos >= a_endpos) {
+			fprintf( stderr, "Incomplete tree\n" );
+			result = 1;
+			break;
+		}
+
+		struct gi_tree tree;
+		if (parse_tree_entry( a_ctx, &tree )) {
+			result = 1;
+			break;
+		}
+
+		bool last = true;
+		uint32_t node = TREE_NO_NODE;
+		if (frame) {
+			last = !--frame->remaining;
+			path_buf_apply( &prefix, prefix.len - frame->prefix_len, "", 0 );
+		} else {
+			path_buf_apply( &prefix, prefix.len, "", 0 );
+		}
+		if (a_index) {
+			node = tree_index_add( a_index, frame ? frame->parent : TREE_NO_NODE, &tree, a_ctx->hash->len );
+			if (node == TREE_NO_NODE) {
+				result = 1;
+				break;
+			}
+		}
+
+		if (a_print) {
+			if (tree.entry_count >= 0) {
+				out_hex( out, a_ctx->hash->len, tree.oid );
+			} else {
+				out_pad( out, 2 * a_ctx->hash->len );
+			}
+			OUT_LIT( out, "  " );
+			out_mem( out, prefix.buf, prefix.len );
+			if (frame) {
+				if (last) {
+					out_str( out, "└─ " );
+					path_buf_apply( &prefix, 0, "   ", 3 );
+				} else {
+					out_str( out, "├─ " );
+					path_buf_apply( &prefix, 0, "│  ", strlen( "│  " ) );
+				}
+			}
+			out_char( out, '\'' );
+			out_mem( out, tree.path, tree.path_len );
+			OUT_LIT( out, "', " );
+			out_int( out, tree.entry_count );
+			OUT_LIT( out, " entries\n" );
+		}
+
+		if (tree.subtrees > 0) {
+			if (depth == frame_size) {
+				size_t new_size = frame_size ? frame_size * 2 : 16;
+				struct tree_frame *new_frames = realloc( frames, new_size * sizeof( struct tree_frame ) );
+				if (a_ctx->stats) a_ctx->stats->reallocs++;
+				if (!new_frames) {
+					perror( "realloc" );
+					result = 1;
+					break;
+				}
+				frames = new_frames;
+				frame_size = new_size;
+			}
+			frames[depth].remaining = tree.subtrees;
+			frames[depth].prefix_len = prefix.len;
+			frames[depth].parent = node;
+			depth++;
+		}
+	}
+
+	if (result && a_ctx->file_pos < a_endpos) seek( a_ctx, a_endpos - a_ctx->file_pos );
+	free( frames );
+	free( prefix.buf );
+
+	return result;
+}
+
+void read_tree( struct ctx *a_ctx, long a_endpos )
+{
+	struct out *out = a_ctx->out;
+
+	while (a_ctx->file_pos < a_endpos ) {
+		struct gi_tree tree;
+
+		if (parse_tree_entry( a_ctx, &tree )) {
+			if (a_ctx->file_pos < a_endpos) seek( a_ctx, a_endpos - a_ctx->file_pos );
+			break;
+		}
+
+		OUT_LIT( out, "Path: '" );
+		out_mem( out, tree.path, tree.path_len );
+		OUT_LIT( out, "'\nEntry count: " );
+		out_int( out, tree.entry_count );
+		OUT_LIT( out, ", subtrees: " );
+		out_uint( out, tree.subtrees );
+		out_char( out, '\n' );
+		if (tree.entry_count >= 0) {
+			OUT_LIT( out, "Object name: " );
+			out_hex( out, a_ctx->hash->len, tree.oid );
+			out_char( out, '\n' );
+		}
+		out_char( out, '\n' );
+//		printf( "\n%ld bytes remaining\n\n", endpos - a_ctx->file_pos );
+	}
+	if (a_ctx->file_pos > a_endpos) {
+		out_str( out, "We read too much\n" );
+	}
+}
+
+#if 0
+#pragma mark Time formatting
+#endif
+
+void time_cache_init( struct time_cache *a_cache )
+{
+	tzset(); // localtime_r may not do it
+	memset( a_cache, 0, sizeof( struct time_cache ) );
+}
+
+
+// UTC offset of local time at a_sec.
+// Zones change offsets on quarter-hour boundaries, so offsets found to be the same at both ends of
+// such a window are kept for the whole window.
+long tz_offset( struct time_cache *a_cache, int64_t a_sec )
+{
+	int64_t window = a_sec >= 0 ? a_sec / TZ_WINDOW : -((-a_sec + TZ_WINDOW - 1) / TZ_WINDOW);
+	struct tz_window *slot = &a_cache->windows[window & (TZ_CACHE_SIZE - 1)];
+	struct tm tm;
+	time_t time;
+
+	if (slot->used && slot->window == window) return slot->gmtoff;
+
+	time = window * TZ_WINDOW;
+	localtime_r( &time, &tm );
+	long start_gmtoff = tm.tm_gmtoff;
+	time += TZ_WINDOW - 1;
+	localtime_r( &time, &tm );
+	a_cache->localtime_calls += 2;
+
+	if (tm.tm_gmtoff == start_gmtoff) {
+		slot->window = window;
+		slot->gmtoff = start_gmtoff;
+		slot->used = true;
+		return start_gmtoff;
+	}
+
+	time = a_sec;
+	localtime_r( &time, &tm );
+	a_cache->localtime_calls++;
+
+	return tm.tm_gmtoff;
+}
+
+
+// Formats "yyyy-mm-dd hh:mm:ss" and "±hhmm" for a_sec in local time, the date being computed by hand
+// from the UTC offset (see http://howardhinnant.github.io/date_algorithms.html#civil_from_days).
+static void format_second( struct time_cache *a_cache, struct time_slot *a_slot, int64_t a_sec )
+{
+	long gmtoff = tz_offset( a_cache, a_sec );
+	int64_t local = a_sec + gmtoff;
+	int64_t days = local >= 0 ? local / 86400 : -((-local + 86399) / 86400);
+	int secs = local - days * 86400;
+
+	int64_t z = days + 719468;
+	int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+	unsigned doe = z - era * 146097;
+	unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	unsigned mp = (5 * doy + 2) / 153;
+	unsigned day = doy - (153 * mp + 2) / 5 + 1;
+	unsigned month = mp < 10 ? mp + 3 : mp - 9;
+	int64_t year = yoe + era * 400 + (month <= 2);
+
+	char *text = a_slot->text;
+	memcpy( text, g_dec_pairs[(year / 100) % 100], 2 );
+	memcpy( text + 2, g_dec_pairs[year % 100], 2 );
+	text[4] = '-';
+	memcpy( text + 5, g_dec_pairs[month], 2 );
+	text[7] = '-';
+	memcpy( text + 8, g_dec_pairs[day], 2 );
+	text[10] = ' ';
+	memcpy( text + 11, g_dec_pairs[secs / 3600], 2 );
+	text[13] = ':';
+	memcpy( text + 14, g_dec_pairs[(secs / 60) % 60], 2 );
+	text[16] = ':';
+	memcpy( text + 17, g_dec_pairs[secs % 60], 2 );
+
+	long offset_min = (gmtoff < 0 ? -gmtoff : gmtoff) / 60;
+	a_slot->zone[0] = gmtoff < 0 ? '-' : '+';
+	memcpy( a_slot->zone + 1, g_dec_pairs[(offset_min / 60) % 100], 2 );
+	memcpy( a_slot->zone + 3, g_dec_pairs[offset_min % 60], 2 );
+
+	a_slot->sec = a_sec;
+	a_slot->used = true;
+}
+
+
+// str must have enough space for 36/37 bytes:
+// yyyy-mm-ddThh:mm:ss,nnnnnnnnn±hh:mm
+// yyyy-mm-dd hh:mm:ss.nnnnnnnnn ±hh:mm
+// Entries mostly share a few seconds, whose formatting is cached.
+void time2str( struct time_cache *a_cache, char *a_str, int32_t a_sec, int32_t a_nsec )
+{
+	struct time_slot *slot = &a_cache->seconds[a_sec & (TIME_CACHE_SIZE - 1)];
+
+	if (!slot->used || slot->sec != a_sec) {
+		format_second( a_cache, slot, a_sec ); // Extends to 64-bit
+		a_cache->misses++;
+	} else {
+		a_cache->hits++;
+	}
+
+	memcpy( a_str, slot->text, 19 );
+	a_str[19] = '.';
+	if (a_nsec < 0 || a_nsec >= 1000000000) {
+		char nanostr[12]; // Only 10 will be used if constraints are followed
+		fprintf( stderr, "Invalid value nsec: %d\n", a_nsec );
+		snprintf( nanostr, sizeof( nanostr ), "%09d",  a_nsec );
+		memcpy( &a_str[20], nanostr, 9 );
+	} else {
+		uint32_t nsec = a_nsec;
+		a_str[28] = '0' + nsec % 10;
+		nsec /= 10;
+		for (int idx = 26; idx >= 20; idx -= 2) {
+			memcpy( &a_str[idx], g_dec_pairs[nsec % 100], 2 );
+			nsec /= 100;
+		}
+	}
+	a_str[29] = ' ';
+	memcpy( &a_str[30], slot->zone, 5 );
+	a_str[35] = 0;
+}
+
+void print_perm( struct out *a_out, char a_perm )
+{
+	char *dest = out_reserve( a_out, 3 );
+
+	dest[0] = a_perm & 4 ? 'r' : '-';
+	dest[1] = a_perm & 2 ? 'w' : '-';
+	dest[2] = a_perm & 1 ? 'x' : '-';
+	a_out->len += 3;
+}
+
+void print_flags( struct out *a_out, uint16_t a_flags )
+{
+	// Merge stages:
+	// https://git-scm.com/book/en/v2/Git-Tools-Advanced-Merging
+	// 0: not in a merge conflict '-'
+	// 1: common ancestor 'c' / base
+	// 2: ours 'o'
+	// 3: theirs 't'
+	char *dest = out_reserve( a_out, 3 );
+
+	dest[0] = a_flags & 0x8000 ? 'v' : '-';
+	dest[1] = a_flags & 0x4000 ? 'x' : '-';
+	dest[2] = "-cot"[(a_flags >> 12) & 3];
+	a_out->len += 3;
+}
+
+void print_flags_long( struct out *a_out, uint16_t a_flags )
+{
+	bool is_first = true;
+	int merge = (a_flags >> 12) & 3;
+
+	if (a_flags & 0x8000) {
+		out_str( a_out, "assume-valid" );
+		is_first = false;
+	}
+
+	if (a_flags & 0x4000) {
+		if (!is_first) out_str( a_out, ", " );
+		out_str( a_out, "extended" );
+		is_first = false;
+	}
+
+	if (merge) {
+		if (!is_first) out_str( a_out, ", " );
+		switch (merge) {
+		case 1: out_str( a_out, "merge_common_ancestor" ); break;
+		case 2: out_str( a_out, "merge_ours" ); break;
+		case 3: out_str( a_out, "merge_theirs" ); break;
+		}
+	}
+}
+
+void print_extended_flags( struct out *a_out, uint16_t a_flags )
+{
+	char *dest = out_reserve( a_out, 3 );
+
+	dest[0] = a_flags & 0x8000 ? 'r' : '-';
+	dest[1] = a_flags & 0x4000 ? 's' : '-';
+	dest[2] = a_flags & 0x2000 ? 'i' : '-';
+	a_out->len += 3;
+}
+
+
+void print_extended_flags_long( struct out *a_out, uint16_t a_flags )
+{
+	bool is_first = true;
+
+	if (a_flags & 0x8000) {
+		out_str( a_out, "reserved" );
+		is_first = false;
+	}
+
+	if (a_flags & 0x4000) {
+		if (!is_first) out_str( a_out, ", " );
+		out_str( a_out, "skip-worktree" );
+		is_first = false;
+	}
+
+	if (a_flags & 0x2000) {
+		if (!is_first) out_str( a_out, ", " );
+		out_str( a_out, "intent-to-add" );
+		is_first = false;
+	}
+}
+
+
+// Parses what follows the first 62 bytes of an entry of a stream, entry->flags being set.
+// entry->file_name is kept with c_keep, entry->pad_bytes follow it.
+int parse_entry_name( struct ctx * a_ctx, struct gi_entry *entry )
+{
+	int result;
+
+	if (a_ctx->version >=3 && (entry->flags & 0x4000)) {
+		c_fread( &entry->extended_flags, 2, a_ctx );
+		entry->extended_flags = ntohs( entry->extended_flags );
+	} else {
+		entry->extended_flags = 0;
+	}
+
+	if (a_ctx->version >= 4) {
+		entry->prefix = read_offset_delta( a_ctx );
+	}
+
+	ssize_t name_len = c_scan( '\0', a_ctx );
+
+	if (name_len >= 0) {
+		// The name, its NUL terminator and the padding are consumed (and kept) together.
+		long end_pos = a_ctx->file_pos + name_len + 1;
+		entry->file_name_len = name_len;
+		if (a_ctx->version < 4 && end_pos % 8 != 4) {
+			entry->pad_bytes_len = 8 - ((end_pos - 4) % 8);
+		} else {
+			entry->pad_bytes_len = 0; // It should be possible to do better…
+		}
+		size_t len = name_len + 1 + entry->pad_bytes_len;
+		const uint8_t *name = c_fetch( a_ctx, len );
+		if (!name) {
+			// Truncated padding
+			len = c_fill( a_ctx, len );
+			name = c_fetch( a_ctx, len );
+			entry->pad_bytes_len = len - name_len - 1;
+		}
+		entry->file_name = c_keep( a_ctx, name, len );
+		entry->pad_bytes = entry->file_name ? entry->file_name + name_len + 1 : NULL;
+	} else {
+		entry->file_name = NULL;
+	}
+
+	if (entry->file_name) {
+		result = 0;
+	} else {
+		fprintf( stderr, "Reading index entry file name failed\n" );
+		result = 1;
+	}
+
+	return result;
+}
+
+
+// The fixed-size part of an entry is 40 bytes of stat data, the object id and the flags.
+// a_hash_len is a constant in each instance below, so that every offset and copy length is known at compile time.
+static inline int parse_index_entry_width( struct ctx * a_ctx, struct gi_entry *entry, const size_t a_hash_len )
+{
+	const uint8_t *fixed = c_fetch( a_ctx, 40 + a_hash_len + 2 );
+
+	if (!fixed) {
+		fprintf( stderr, "Reading index entry: unexpected end of file\n" );
+		return 1;
+	}
+	gi_decode_stat( fixed, a_hash_len, entry );
+
+	return parse_entry_name( a_ctx, entry );
+}
+
+
+static int parse_index_entry_sha1( struct ctx * a_ctx, struct gi_entry *entry )
+{
+	return parse_index_entry_width( a_ctx, entry, SHA_DIGEST_LENGTH );
+}
+
+
+static int parse_index_entry_sha256( struct ctx * a_ctx, struct gi_entry *entry )
+{
+	return parse_index_entry_width( a_ctx, entry, SHA256_DIGEST_LENGTH );
+}
+
+
+// Decodes the entry at file_pos, which is moved past it. Mapped files are decoded by libgitindex, entry->file_name
+// pointing into the mapping; streams are parsed from the input window, entry->file_name being kept with c_keep.
+// entry->pad_bytes follow it.
+int parse_index_entry( struct ctx * a_ctx, struct gi_entry *entry )
+{
+	if (!a_ctx->mapped) return a_ctx->hash->parse_entry( a_ctx, entry );
+
+	struct gi_index index = index_view( a_ctx );
+	size_t next;
+	int status = gi_decode_entry( &index, a_ctx->file_pos, entry, &next );
+	if (status) {
+		fprintf( stderr, "Reading index entry: %s\n", gi_strerror( status ) );
+		return 1;
+	}
+	a_ctx->file_pos = next;
+
+	return 0;
+}
+
+
+#if 0
+#pragma mark Object formats
+#endif
+
+static void sha1_init( union hash_ctx *a_hash_ctx )
+{
+	SHA1_Init( &a_hash_ctx->sha1 );
+}
+
+static void sha1_update( union hash_ctx *a_hash_ctx, const void *a_ptr, size_t a_len )
+{
+	SHA1_Update( &a_hash_ctx->sha1, a_ptr, a_len );
+}
+
+static void sha1_final( unsigned char *a_md, union hash_ctx *a_hash_ctx )
+{
+	SHA1_Final( a_md, &a_hash_ctx->sha1 );
+}
+
+static void sha256_init( union hash_ctx *a_hash_ctx )
+{
+	SHA256_Init( &a_hash_ctx->sha256 );
+}
+
+static void sha256_update( union hash_ctx *a_hash_ctx, const void *a_ptr, size_t a_len )
+{
+	SHA256_Update( &a_hash_ctx->sha256, a_ptr, a_len );
+}
+
+static void sha256_final( unsigned char *a_md, union hash_ctx *a_hash_ctx )
+{
+	SHA256_Final( a_md, &a_hash_ctx->sha256 );
+}
+
+// Same names as extensions.objectFormat, SHA-1 first as the default
+static const struct hash_algo g_hash_algos[] = {
+	{ "sha1", SHA_DIGEST_LENGTH, sha1_init, sha1_update, sha1_final, parse_index_entry_sha1 },
+	{ "sha256", SHA256_DIGEST_LENGTH, sha256_init, sha256_update, sha256_final, parse_index_entry_sha256 },
+};
+
+#define HASH_ALGO_COUNT (sizeof( g_hash_algos ) / sizeof( g_hash_algos[0] ))
+
+
+const struct hash_algo *find_hash_algo( const char *a_name )
+{
+	for (size_t idx = 0; idx < HASH_ALGO_COUNT; idx++) {
+		if (!strcmp( g_hash_algos[idx].name, a_name )) return &g_hash_algos[idx];
+	}
+
+	return NULL;
+}
+
+
+// The index doesn't tell its object format, which is a setting of the repository.
+// It is guessed from the layout of the first entry, or without entries from the length of the trailing checksum.
+// SHA-1 wins when both fit. Must be called before anything is read.
+const struct hash_algo *detect_hash_algo( struct ctx *a_ctx )
+{
+	assert( a_ctx->file_pos == 0 );
+
+	const struct hash_algo *result = &g_hash_algos[0];
+	bool verify = a_ctx->verify;
+
+	// Nothing is consumed, so there is nothing to hash yet.
+	a_ctx->verify = false;
+	size_t len = a_ctx->mapped ? a_ctx->data_len : c_fill( a_ctx, 12 + 40 + GI_HASH_MAX_LEN + 4 + 16 + 4096 + 8 );
+	const uint8_t *data = c_peek( a_ctx, len );
+	a_ctx->verify = verify;
+
+	if (!data) return result;
+
+	size_t hash_len = gi_detect_hash_len( data, len, a_ctx->mapped );
+	for (size_t idx = 0; idx < HASH_ALGO_COUNT; idx++) {
+		if (g_hash_algos[idx].len == hash_len) return &g_hash_algos[idx];
+	}
+
+	return result;
+}
+
+
+#if 0
+#pragma mark Name cache
+#endif
+
+// getpwuid and getgrgid may go through the network (LDAP…), while indexes usually hold a handful of ids.
+
+const char *resolve_user( uint32_t a_uid )
+{
+	struct passwd *user = getpwuid( a_uid );
+
+	return user ? user->pw_name : NULL;
+}
+
+
+const char *resolve_group( uint32_t a_gid )
+{
+	struct group *group = getgrgid( a_gid );
+
+	return group ? group->gr_name : NULL;
+}
+
+
+void name_cache_init( struct name_cache *a_cache, const char *(*a_resolve)( uint32_t ) )
+{
+	a_cache->resolve = a_resolve;
+	a_cache->slots = NULL;
+	a_cache->size = 0;
+	a_cache->used = 0;
+	a_cache->hits = 0;
+	a_cache->misses = 0;
+	a_cache->lock = NULL;
+}
+
+
+void name_cache_free( struct name_cache *a_cache )
+{
+	for (size_t idx = 0; idx < a_cache->size; idx++) {
+		free( (void *) a_cache->slots[idx].name );
+	}
+	free( a_cache->slots );
+	a_cache->slots = NULL;
+	a_cache->size = 0;
+	a_cache->used = 0;
+}
+
+
+static struct name_slot *name_cache_slot( struct name_slot *a_slots, size_t a_size, uint32_t a_id )
+{
+	// Fibonacci hashing, then linear probing.
+	size_t idx = (a_id * 2654435769u) & (a_size - 1);
+
+	while (a_slots[idx].used && a_slots[idx].id != a_id) {
+		idx = (idx + 1) & (a_size - 1);
+	}
+
+	return &a_slots[idx];
+}
+
+
+static const char *name_cache_lookup( struct name_cache *a_cache, uint32_t a_id, int *a_width )
+{
+	assert( a_cache );
+
+	struct name_slot *slot = a_cache->size ? name_cache_slot( a_cache->slots, a_cache->size, a_id ) : NULL;
+
+	if (slot && slot->used) {
+		a_cache->hits++;
+	} else {
+		a_cache->misses++;
+
+		// Keep the load factor under 1/2.
+		if ((a_cache->used + 1) * 2 > a_cache->size) {
+			size_t new_size = a_cache->size ? a_cache->size * 2 : 16;
+			struct name_slot *new_slots = calloc( new_size, sizeof( struct name_slot ) );
+			if (!new_slots) {
+				perror( "calloc" );
+				const char *name = a_cache->resolve( a_id );
+				if (a_width) *a_width = name ? strlen( name ) : 0;
+				return name;
+			}
+			for (size_t idx = 0; idx < a_cache->size; idx++) {
+				if (a_cache->slots[idx].used) {
+					*name_cache_slot( new_slots, new_size, a_cache->slots[idx].id ) = a_cache->slots[idx];
+				}
+			}
+			free( a_cache->slots );
+			a_cache->slots = new_slots;
+			a_cache->size = new_size;
+			slot = name_cache_slot( a_cache->slots, a_cache->size, a_id );
+		}
+
+		// The resolver result lives in static storage, overwritten by the next call.
+		const char *name = a_cache->resolve( a_id );
+		slot->id = a_id;
+		slot->used = true;
+		slot->name = name ? strdup( name ) : NULL;
+		slot->width = slot->name ? strlen( slot->name ) : 0;
+		a_cache->used++;
+	}
+
+	if (a_width) *a_width = slot->width;
+
+	return slot->name;
+}
+
+
+// Returns the name of a_id, or NULL if it doesn't resolve, looking it up only the first time.
+// If a_width isn't NULL, it is set to the length of the name (0 if NULL).
+// Names stay valid until name_cache_free, even when the cache is shared and other threads add to it.
+const char *name_cache_get( struct name_cache *a_cache, uint32_t a_id, int *a_width )
+{
+	assert( a_cache );
+
+	if (!a_cache->lock) return name_cache_lookup( a_cache, a_id, a_width );
+
+	pthread_mutex_lock( a_cache->lock );
+	const char *name = name_cache_lookup( a_cache, a_id, a_width );
+	pthread_mutex_unlock( a_cache->lock );
+
+	return name;
+}
+
+
+#if 0
+#pragma mark Untracked cache
+#endif
+
+// See https://git-scm.com/docs/index-format#_untracked_cache
+
+// Stat data of the untracked cache: ctime, ctime_ns, mtime, mtime_ns, dev, ino, uid, gid and size
+#define UNTR_STAT_LEN 36
+
+// dir_flags, from git's dir.h
+static const char *const g_dir_flag_names[] = {
+	"show-ignored", "show-other-directories", "hide-empty-directories", "no-gitlinks", "collect-ignored",
+	"show-ignored-too", "collect-killed-only", "keep-untracked-contents", "show-ignored-too-mode-matching", "skip-nested-git",
+};
+
+// Bounds-checked cursor over the content of an extension. Once failed, it returns nothing but zeros and NULLs.
+struct cursor {
+	const uint8_t *pos;
+	const uint8_t *end;
+	bool failed;
+};
+
+// An EWAH bitmap expanded to plain words, bit n being bit n % 64 of words[n / 64]
+struct bitmap {
+	uint64_t *words;
+	size_t word_count;
+	uint32_t bit_count;
+};
+
+struct untracked_dir {
+	const char *name;
+	const char *entries; // entry_count NUL-terminated names
+	uint32_t entry_count;
+	uint32_t dir_count;
+};
+
+struct untracked_frame {
+	uint32_t remaining; // Directories left to print at this level
+	size_t prefix_len;
+};
+
+
+static const uint8_t *cursor_take( struct cursor *a_cursor, size_t a_len )
+{
+	if (a_cursor->failed || (size_t) (a_cursor->end - a_cursor->pos) < a_len) {
+		a_cursor->failed = true;
+		return NULL;
+	}
+
+	const uint8_t *result = a_cursor->pos;
+	a_cursor->pos += a_len;
+
+	return result;
+}
+
+
+static uint32_t cursor_be32( struct cursor *a_cursor )
+{
+	const uint8_t *ptr = cursor_take( a_cursor, 4 );
+	uint32_t u32 = 0;
+
+	if (ptr) memcpy( &u32, ptr, 4 );
+
+	return ntohl( u32 );
+}
+
+
+// Same encoding as the v4 path prefixes
+static size_t cursor_varint( struct cursor *a_cursor )
+{
+	size_t used;
+	ssize_t value = a_cursor->failed ? -1 : gi_decode_varint( a_cursor->pos, a_cursor->end - a_cursor->pos, &used );
+
+	if (value < 0) {
+		a_cursor->failed = true;
+		return 0;
+	}
+	a_cursor->pos += used;
+
+	return value;
+}
+
+
+// Returns a NUL-terminated string, its length being stored in *a_len unless it is NULL.
+static const char *cursor_string( struct cursor *a_cursor, size_t *a_len )
+{
+	const uint8_t *nul = a_cursor->failed ? NULL : memchr( a_cursor->pos, '\0', a_cursor->end - a_cursor->pos );
+
+	if (!nul) {
+		a_cursor->failed = true;
+		return NULL;
+	}
+
+	const char *result = (const char *) a_cursor->pos;
+	if (a_len) *a_len = nul - a_cursor->pos;
+	a_cursor->pos = nul + 1;
+
+	return result;
+}
+
+
+// Expands an EWAH bitmap, laid out as in git's ewah/ewah_io.c: its bit count, its number of 64-bit words, the words,
+// then the position of the last marker word, all big-endian.
+// A marker word tells how many words of its bit 0 follow, in bits 1-32, then how many literal words, in bits 33-63.
+// Both kinds of words are expanded whole, so bits are never visited one at a time.
+// Returns 0 on success, 1 if the bitmap is invalid. a_bitmap->words must be freed either way.
+static int read_ewah( struct cursor *a_cursor, struct bitmap *a_bitmap )
+{
+	a_bitmap->bit_count = cursor_be32( a_cursor );
+	uint32_t word_count = cursor_be32( a_cursor );
+	const uint8_t *words = cursor_take( a_cursor, (size_t) word_count * 8 );
+	cursor_be32( a_cursor );
+
+	a_bitmap->word_count = ((size_t) a_bitmap->bit_count + 63) / 64;
+	a_bitmap->words = NULL;
+	if (a_cursor->failed) return 1;
+
+	a_bitmap->words = calloc( a_bitmap->word_count + 1, 8 );
+	if (!a_bitmap->words) {
+		perror( "calloc" );
+		return 1;
+	}
+
+	uint64_t *dest = a_bitmap->words;
+	size_t left = a_bitmap->word_count;
+	uint64_t u64;
+
+	for (size_t idx = 0; idx < word_count;) {
+		memcpy( &u64, words + 8 * idx++, 8 );
+		u64 = be64toh( u64 );
+		size_t run = (u64 >> 1) & 0xFFFFFFFF;
+		size_t literals = u64 >> 33;
+		if (run > left || literals > left - run || literals > word_count - idx) return 1;
+
+		if (u64 & 1) memset( dest, 0xFF, run * 8 );
+		dest += run;
+		for (size_t lit = 0; lit < literals; lit++) {
+			memcpy( &u64, words + 8 * idx++, 8 );
+			*dest++ = be64toh( u64 );
+		}
+		left -= run + literals;
+	}
+
+	// A run of ones may go past the last bit.
+	if (a_bitmap->bit_count % 64) {
+		a_bitmap->words[a_bitmap->word_count - 1] &= (UINT64_C( 1 ) << (a_bitmap->bit_count % 64)) - 1;
+	}
+
+	return 0;
+}
+
+
+static size_t bitmap_count( const struct bitmap *a_bitmap )
+{
+	size_t result = 0;
+
+	for (size_t idx = 0; idx < a_bitmap->word_count; idx++) result += __builtin_popcountll( a_bitmap->words[idx] );
+
+	return result;
+}
+
+
+static inline bool bitmap_test( const struct bitmap *a_bitmap, size_t a_bit )
+{
+	return a_bit < a_bitmap->bit_count && (a_bitmap->words[a_bit / 64] >> (a_bit % 64)) & 1;
+}
+
+
+static void print_untracked_oid( struct ctx *a_ctx, const char *a_label, const uint8_t *a_oid )
+{
+	static const uint8_t null_oid[GI_HASH_MAX_LEN];
+	struct out *out = a_ctx->out;
+
+	out_str( out, a_label );
+	if (memcmp( a_oid, null_oid, a_ctx->hash->len )) {
+		out_hex( out, a_ctx->hash->len, a_oid );
+	} else {
+		OUT_LIT( out, "none" );
+	}
+	out_char( out, '\n' );
+}
+
+
+// Prints the directories depth-first, as they are stored, with the hash of their exclude file when it is valid.
+// a_stats holds the stat data of the valid directories, a_oids the hashes.
+static int print_untracked_tree( struct ctx *a_ctx, const struct untracked_dir *a_dirs, size_t a_dir_count,
+	const struct bitmap *a_valid, const struct bitmap *a_check_only, const struct bitmap *a_oid_valid,
+	const uint8_t *a_stats, const uint8_t *a_oids )
+{
+	struct out *out = a_ctx->out;
+	const size_t hash_len = a_ctx->hash->len;
+	struct path_buf prefix = { .buf = NULL, .len = 0, .size = 0, .stats = a_ctx->stats };
+	struct untracked_frame *frames = malloc( (a_dir_count + 1) * sizeof( struct untracked_frame ) );
+	size_t depth = 0;
+	uint32_t u32;
+
+	if (!frames) {
+		perror( "malloc" );
+		return 1;
+	}
+
+	frames[0].remaining = 1;
+	frames[0].prefix_len = 0;
+	path_buf_apply( &prefix, 0, "", 0 );
+
+	for (size_t idx = 0; idx < a_dir_count;) {
+		struct untracked_frame *frame = &frames[depth];
+		if (!frame->remaining) {
+			depth--;
+			continue;
+		}
+		frame->remaining--;
+
+		const struct untracked_dir *dir = &a_dirs[idx];
+		bool last = !frame->remaining;
+		path_buf_apply( &prefix, prefix.len - frame->prefix_len, "", 0 );
+
+		if (bitmap_test( a_oid_valid, idx )) {
+			out_hex( out, hash_len, a_oids );
+			a_oids += hash_len;
+		} else {
+			out_pad( out, 2 * hash_len );
+		}
+		OUT_LIT( out, "  " );
+		out_mem( out, prefix.buf, prefix.len );
+		if (depth > 0) {
+			if (last) {
+				out_str( out, "└─ " );
+				path_buf_apply( &prefix, 0, "   ", 3 );
+			} else {
+				out_str( out, "├─ " );
+				path_buf_apply( &prefix, 0, "│  ", strlen( "│  " ) );
+			}
+		}
+		out_char( out, '\'' );
+		out_str( out, dir->name );
+		out_char( out, '\'' );
+		if (bitmap_test( a_valid, idx )) {
+			char timestr[37];
+			memcpy( &u32, a_stats + 8, 4 );
+			int32_t mtime = ntohl( u32 );
+			memcpy( &u32, a_stats + 12, 4 );
+			time2str( a_ctx->times, timestr, mtime, ntohl( u32 ) );
+			OUT_LIT( out, ", valid, modified " );
+			out_str( out, timestr );
+			a_stats += UNTR_STAT_LEN;
+		}
+		if (bitmap_test( a_check_only, idx )) OUT_LIT( out, ", check only" );
+		out_char( out, '\n' );
+
+		const char *entry = dir->entries;
+		for (uint32_t entry_idx = 0; entry_idx < dir->entry_count; entry_idx++) {
+			size_t len = strlen( entry );
+			out_pad( out, 2 * hash_len + 2 );
+			out_mem( out, prefix.buf, prefix.len );
+			if (entry_idx == dir->entry_count - 1 && !dir->dir_count) {
+				out_str( out, "└─ ? '" );
+			} else {
+				out_str( out, "├─ ? '" );
+			}
+			out_mem( out, entry, len );
+			OUT_LIT( out, "'\n" );
+			entry += len + 1;
+		}
+
+		depth++;
+		frames[depth].remaining = dir->dir_count;
+		frames[depth].prefix_len = prefix.len;
+		idx++;
+	}
+
+	free( frames );
+	free( prefix.buf );
+
+	return 0;
+}
+
+
+// Reads the UNTR extension in one pass, then prints a summary, and the directories if a_print_tree.
+// Returns 0 on success, 1 if the extension is invalid.
+int read_untracked( struct ctx *a_ctx, uint32_t a_len, bool a_print_tree )
+{
+	assert( a_ctx );
+
+	struct out *out = a_ctx->out;
+	const size_t hash_len = a_ctx->hash->len;
+	const uint8_t *data = c_fetch( a_ctx, a_len );
+	struct cursor cursor = { .pos = data, .end = data + a_len, .failed = !data };
+	struct bitmap valid = { .words = NULL }, check_only = { .words = NULL }, oid_valid = { .words = NULL };
+	struct untracked_dir *dirs = NULL;
+	uint64_t entry_count = 0;
+	uint64_t child_count = 0;
+	int result = 1;
+
+	// Environments where the cache can be used, preceded by their total length
+	size_t ident_len = cursor_varint( &cursor );
+	const uint8_t *ident = cursor_take( &cursor, ident_len );
+	const uint8_t *exclude_stat = cursor_take( &cursor, UNTR_STAT_LEN );
+	const uint8_t *excludes_file_stat = cursor_take( &cursor, UNTR_STAT_LEN );
+	uint32_t dir_flags = cursor_be32( &cursor );
+	const uint8_t *exclude_oid = cursor_take( &cursor, hash_len );
+	const uint8_t *excludes_file_oid = cursor_take( &cursor, hash_len );
+	const char *exclude_per_dir = cursor_string( &cursor, NULL );
+	size_t dir_count = cursor_varint( &cursor );
+	(void) exclude_stat;
+	(void) excludes_file_stat;
+
+	// Each directory takes at least 4 bytes.
+	if (cursor.failed || dir_count > (size_t) (cursor.end - cursor.pos) / 4) goto ru_exit;
+
+	if (dir_count) {
+		dirs = malloc( dir_count * sizeof( struct untracked_dir ) );
+		if (!dirs) {
+			perror( "malloc" );
+			goto ru_exit;
+		}
+	}
+
+	for (size_t idx = 0; idx < dir_count && !cursor.failed; idx++) {
+		dirs[idx].entry_count = cursor_varint( &cursor );
+		dirs[idx].dir_count = cursor_varint( &cursor );
+		dirs[idx].name = cursor_string( &cursor, NULL );
+		dirs[idx].entries = (const char *) cursor.pos;
+		for (uint32_t entry = 0; entry < dirs[idx].entry_count && !cursor.failed; entry++) cursor_string( &cursor, NULL );
+		entry_count += dirs[idx].entry_count;
+		child_count += dirs[idx].dir_count;
+	}
+	if (cursor.failed || (dir_count && child_count != dir_count - 1)) goto ru_exit;
+
+	const uint8_t *stats = NULL;
+	const uint8_t *oids = NULL;
+	size_t valid_count = 0, check_only_count = 0, oid_count = 0;
+	if (dir_count) {
+		if (read_ewah( &cursor, &valid ) || read_ewah( &cursor, &check_only ) || read_ewah( &cursor, &oid_valid )) goto ru_exit;
+		valid_count = bitmap_count( &valid );
+		check_only_count = bitmap_count( &check_only );
+		oid_count = bitmap_count( &oid_valid );
+		stats = cursor_take( &cursor, valid_count * UNTR_STAT_LEN );
+		oids = cursor_take( &cursor, oid_count * hash_len );
+	}
+	// The extension ends with a NUL.
+	cursor_take( &cursor, 1 );
+	if (cursor.failed || cursor.pos != cursor.end) goto ru_exit;
+
+	OUT_LIT( out, "Untracked cache for '" );
+	out_mem( out, ident, ident_len && !ident[ident_len - 1] ? ident_len - 1 : ident_len );
+	OUT_LIT( out, "'\nDirectory flags: " );
+	bool is_first = true;
+	for (size_t bit = 0; bit < sizeof( g_dir_flag_names ) / sizeof( g_dir_flag_names[0] ); bit++) {
+		if (!(dir_flags & (1 << bit))) continue;
+		if (!is_first) OUT_LIT( out, ", " );
+		out_str( out, g_dir_flag_names[bit] );
+		is_first = false;
+	}
+	if (is_first) OUT_LIT( out, "none" );
+	OUT_LIT( out, "\nExclude file: '" );
+	out_str( out, exclude_per_dir );
+	out_str( out, "'\n" );
+	print_untracked_oid( a_ctx, "info/exclude: ", exclude_oid );
+	print_untracked_oid( a_ctx, "core.excludesFile: ", excludes_file_oid );
+	out_printf( out, "Directories: %zu, %zu valid, %zu check only, %zu with an exclude file hash\n", dir_count, valid_count, check_only_count, oid_count );
+	OUT_LIT( out, "Untracked entries: " );
+	out_uint( out, entry_count );
+	out_char( out, '\n' );
+	if (a_print_tree && dir_count) {
+		out_char( out, '\n' );
+		print_untracked_tree( a_ctx, dirs, dir_count, &valid, &check_only, &oid_valid, stats, oids );
+	}
+	out_char( out, '\n' );
+	result = 0;
+
+ru_exit:
+	if (result) fprintf( stderr, "Invalid untracked cache extension\n" );
+	free( valid.words );
+	free( check_only.words );
+	free( oid_valid.words );
+	free( dirs );
+
+	return result;
+}
+
+
+#if 0
+#pragma mark Parallel loading
+#endif
+
+// Locates the IEOT extension through the EOIE extension, which must be the last one of a mapped file.
+// See https://git-scm.com/docs/index-format#_end_of_index_entry
+// Returns the number of blocks, stored in *a_blocks which must be freed, or 0 if there is no usable table.
+// The offset of the first extension is then stored in *a_entries_end, unless it is NULL.
+size_t read_ieot( struct ctx *a_ctx, struct ieot_block **a_blocks, uint32_t *a_entries_end )
+{
+	assert( a_ctx );
+	assert( a_blocks );
+
+	const size_t hash_len = a_ctx->hash->len;
+	const size_t eoie_len = 8 + 4 + hash_len;
+	const uint8_t *eoie;
+	uint32_t u32;
+	uint32_t entries_end;
+
+	*a_blocks = NULL;
+
+	if (!a_ctx->mapped || a_ctx->data_len < 12 + eoie_len + hash_len) return 0;
+
+	eoie = a_ctx->data + a_ctx->data_len - hash_len - eoie_len;
+	memcpy( &u32, eoie + 4, 4 );
+	if (memcmp( eoie, "EOIE", 4 ) || ntohl( u32 ) != eoie_len - 8) return 0;
+	memcpy( &u32, eoie + 8, 4 );
+	entries_end = ntohl( u32 );
+	if (entries_end < 12 || entries_end >= eoie - a_ctx->data) return 0;
+
+	// The EOIE hash covers the header of every extension from entries_end on.
+	union hash_ctx hash_ctx;
+	unsigned char md[GI_HASH_MAX_LEN];
+	const uint8_t *ext = a_ctx->data + entries_end;
+	const uint8_t *ieot = NULL;
+	uint32_t ieot_len = 0;
+
+	a_ctx->hash->init( &hash_ctx );
+	while (ext + 8 <= eoie) {
+		memcpy( &u32, ext + 4, 4 );
+		u32 = ntohl( u32 );
+		if (!memcmp( ext, "IEOT", 4 ) && !ieot) {
+			ieot = ext + 8;
+			ieot_len = u32;
+		}
+		a_ctx->hash->update( &hash_ctx, ext, 8 );
+		if (u32 > eoie - ext - 8) break;
+		ext += 8 + u32;
+	}
+	a_ctx->hash->final( md, &hash_ctx );
+	if (ext != eoie || memcmp( md, eoie + 12, hash_len )) {
+		fprintf( stderr, "EOIE extension doesn't match the extensions, ignoring it\n" );
+		return 0;
+	}
+
+	// IEOT: a 32-bit version, then pairs of 32-bit offsets and entry counts.
+	if (!ieot || ieot_len < 4 || (ieot_len - 4) % 8) return 0;
+	memcpy( &u32, ieot, 4 );
+	if (ntohl( u32 ) != 1) return 0;
+
+	size_t block_count = (ieot_len - 4) / 8;
+	struct ieot_block *blocks = malloc( block_count * sizeof( struct ieot_block ) );
+	uint64_t total = 0;
+	if (!blocks) {
+		perror( "malloc" );
+		return 0;
+	}
+
+	for (size_t idx = 0; idx < block_count; idx++) {
+		memcpy( &u32, ieot + 4 + idx * 8, 4 );
+		blocks[idx].offset = ntohl( u32 );
+		memcpy( &u32, ieot + 8 + idx * 8, 4 );
+		blocks[idx].entry_count = ntohl( u32 );
+		total += blocks[idx].entry_count;
+		if (blocks[idx].offset < 12 || blocks[idx].offset >= entries_end || (idx > 0 && blocks[idx].offset <= blocks[idx-1].offset)) {
+			total = UINT64_MAX;
+			break;
+		}
+	}
+
+	if (total != a_ctx->entry_count) {
+		fprintf( stderr, "IEOT extension doesn't match the entries, ignoring it\n" );
+		free( blocks );
+		return 0;
+	}
+
+	*a_blocks = blocks;
+	if (a_entries_end) *a_entries_end = entries_end;
+
+	return block_count;
+}
+
+
+// Blocks of a mapped index decoded by one thread, from a view of the mapping rather than a copy of the struct ctx of
+// the index, whose checksum may be computed meanwhile.
+struct load_job {
+	struct gi_index index;
+	const struct ieot_block *blocks;
+	size_t block_count;
+	struct gi_entry *entries;
+	size_t end_pos; // Following the last entry of the blocks
+	int result;
+};
+
+
+static void *load_thread_main( void *a_job )
+{
+	struct load_job *job = a_job;
+	struct gi_entry *entry_p = job->entries;
+	size_t pos = 0;
+	int status = GI_OK;
+
+	for (size_t blk = 0; blk < job->block_count && !status; blk++) {
+		pos = job->blocks[blk].offset;
+		for (uint32_t idx = 0; idx < job->blocks[blk].entry_count && !status; idx++) {
+			status = gi_decode_entry( &job->index, pos, entry_p++, &pos );
+		}
+	}
+	// Reported by the sequential parse which then follows
+	job->end_pos = pos;
+	job->result = status != GI_OK;
+
+	return NULL;
+}
+
+
+// Decodes all the entries into a_ctx->entries, splitting the IEOT blocks across a_ctx->threads threads.
+// Blocks are independent, v4 prefix compression restarting at the beginning of each of them.
+// On success, file_pos is moved to the end of the entries and 0 is returned.
+// Otherwise a_ctx is left untouched so that entries can be parsed sequentially.
+int load_entries_threaded( struct ctx *a_ctx )
+{
+	assert( a_ctx );
+
+	struct ieot_block *blocks = NULL;
+	size_t block_count = a_ctx->threads > 1 ? read_ieot( a_ctx, &blocks, NULL ) : 0;
+	int result = 1;
+
+	if (block_count < 2) {
+		free( blocks );
+		return 1;
+	}
+
+	size_t job_count = a_ctx->threads < block_count ? a_ctx->threads : block_count;
+	struct load_job *jobs = calloc( job_count, sizeof( struct load_job ) );
+	struct gi_entry *entries = malloc( a_ctx->entry_count * sizeof( struct gi_entry ) );
+	size_t next_block = 0;
+	struct gi_entry *next_entry = entries;
+
+	if (!jobs || !entries) {
+		perror( "malloc" );
+		goto let_exit;
+	}
+
+	// Contiguous runs of blocks, spread as evenly as possible.
+	for (size_t idx = 0; idx < job_count; idx++) {
+		struct load_job *job = &jobs[idx];
+		job->index = index_view( a_ctx );
+		job->blocks = &blocks[next_block];
+		job->block_count = (block_count - next_block) / (job_count - idx);
+		job->entries = next_entry;
+		for (size_t blk = 0; blk < job->block_count; blk++) {
+			next_entry += job->blocks[blk].entry_count;
+		}
+		next_block += job->block_count;
+	}
+
+	pthread_t *thread_ids = malloc( job_count * sizeof( pthread_t ) );
+	size_t started = 0;
+	if (thread_ids) {
+		// The calling thread takes the first job itself.
+		for (started = 1; started < job_count; started++) {
+			if (pthread_create( &thread_ids[started], NULL, load_thread_main, &jobs[started] )) break;
+		}
+	}
+	for (size_t idx = started ? started : 1; idx < job_count; idx++) {
+		load_thread_main( &jobs[idx] );
+	}
+	load_thread_main( &jobs[0] );
+	for (size_t idx = 1; idx < started; idx++) {
+		pthread_join( thread_ids[idx], NULL );
+	}
+	free( thread_ids );
+
+	result = 0;
+	for (size_t idx = 0; idx < job_count; idx++) {
+		result |= jobs[idx].result;
+	}
+
+	if (!result) {
+		// Resume after the last entry, where the first extension starts.
+		a_ctx->file_pos = jobs[job_count - 1].end_pos;
+		a_ctx->entries = entries;
+		entries = NULL;
+	}
+
+let_exit:
+	free( entries );
+	free( jobs );
+	free( blocks );
+
+	return result;
+}
+
+
+// Decodes entry a_idx from the cache file of a_ctx, checked by load_cached_entries: its whole path points into the
+// cache.
+static void cached_entry( const struct ctx *a_ctx, uint32_t a_idx, struct gi_entry *a_entry )
+{
+	size_t hash_len = a_ctx->hash->len;
+	size_t record_size = sizeof( struct bin_stat ) + hash_len + sizeof( struct bin_tail );
+	const uint8_t *records = a_ctx->cache_data + sizeof( struct cache_key ) + sizeof( struct bin_header );
+	const uint8_t *record = records + a_idx * record_size;
+	const char *paths = (const char *) records + a_ctx->entry_count * record_size;
+	struct bin_stat stat;
+	struct bin_tail tail;
+
+	memcpy( &stat, record, sizeof( stat ) );
+	memcpy( &tail, record + sizeof( stat ) + hash_len, sizeof( tail ) );
+	a_entry->ctime = le32toh( stat.ctime );
+	a_entry->ctime_ns = le32toh( stat.ctime_ns );
+	a_entry->mtime = le32toh( stat.mtime );
+	a_entry->mtime_ns = le32toh( stat.mtime_ns );
+	a_entry->dev = le32toh( stat.dev );
+	a_entry->ino = le32toh( stat.ino );
+	a_entry->mode = le32toh( stat.mode );
+	a_entry->uid = le32toh( stat.uid );
+	a_entry->gid = le32toh( stat.gid );
+	a_entry->file_size = le32toh( stat.file_size );
+	memcpy( a_entry->oid, record + sizeof( stat ), hash_len );
+	a_entry->flags = le16toh( tail.flags );
+	a_entry->extended_flags = le16toh( tail.extended_flags );
+	a_entry->file_name = paths + le32toh( tail.path_offset );
+	a_entry->file_name_len = le32toh( tail.path_len );
+	a_entry->pad_bytes = a_entry->file_name + a_entry->file_name_len + 1;
+	a_entry->pad_bytes_len = 0;
+	// Each v4 path replaces the whole previous one.
+	a_entry->prefix = 0;
+	if (a_ctx->version >= 4 && a_idx) {
+		memcpy( &tail, record - sizeof( tail ), sizeof( tail ) );
+		a_entry->prefix = le32toh( tail.path_len );
+	}
+}
+
+
+// Provides entry a_idx, either decoded ahead by load_entries_threaded, taken from a cache file, or parsed from the
+// input.
+int next_entry( struct ctx * a_ctx, uint32_t a_idx, struct gi_entry *entry )
+{
+	if (a_ctx->entries) {
+		*entry = a_ctx->entries[a_idx];
+		return 0;
+	}
+	if (a_ctx->cache_data) {
+		cached_entry( a_ctx, a_idx, entry );
+		return 0;
+	}
+	if (!a_ctx->stats) return parse_index_entry( a_ctx, entry );
+
+	struct timespec since;
+	stats_start( a_ctx->stats, &since );
+	int result = parse_index_entry( a_ctx, entry );
+	a_ctx->stats->decode += stats_elapsed( &since );
+
+	return result;
+}
+
+
+#if 0
+#pragma mark Path lookup
+#endif
+
+// A pathspec matches the entries of its path, one per stage, and the entries below it when it is a directory.
+// These two ranges aren't contiguous ("a.c" sorts between "a" and "a/b"), so a pathspec is looked up as two keys:
+// the path itself, matched exactly, and the path with a trailing '/', matched as a prefix.
+struct path_key {
+	const char *str;
+	size_t len;
+	bool exact;
+};
+
+struct selected_entry {
+	uint32_t idx;
+	struct gi_entry entry;
+};
+
+struct selection {
+	struct selected_entry *items;
+	size_t count;
+	size_t size;
+};
+
+// Decodes entries one after the other from some position, rebuilding their path.
+struct lookup {
+	struct ctx *ctx;
+	uint32_t idx; // Index of the next entry
+	bool restart; // Set at the beginning of an IEOT block, where a v4 path doesn't depend on the previous one
+	struct gi_entry entry;
+	struct path_buf path;
+};
+
+
+// Same order as the index: bytes compared as unsigned, shorter first.
+static int path_cmp( const char *a_path, size_t a_len, const char *a_other, size_t a_other_len )
+{
+	int result = memcmp( a_path, a_other, a_len < a_other_len ? a_len : a_other_len );
+
+	if (!result) result = (a_len > a_other_len) - (a_len < a_other_len);
+
+	return result;
+}
+
+
+static bool path_key_matches( const struct path_key *a_key, const char *a_path, size_t a_len )
+{
+	if (a_key->exact) return a_len == a_key->len && !memcmp( a_path, a_key->str, a_len );
+
+	return a_len >= a_key->len && !memcmp( a_path, a_key->str, a_key->len );
+}
+
+
+static void lookup_seek( struct lookup *a_lookup, long a_offset, uint32_t a_idx )
+{
+	a_lookup->ctx->file_pos = a_offset;
+	a_lookup->idx = a_idx;
+	a_lookup->restart = true;
+}
+
+
+static int lookup_next( struct lookup *a_lookup )
+{
+	struct gi_entry *entry = &a_lookup->entry;
+
+	if (parse_index_entry( a_lookup->ctx, entry )) return 1;
+
+	size_t strip = a_lookup->path.len;
+	if (a_lookup->ctx->version >= 4 && !a_lookup->restart) strip = entry->prefix;
+	if (path_buf_apply( &a_lookup->path, strip, entry->file_name, entry->file_name_len )) {
+		fprintf( stderr, "Entry %u: prefix length %zu is invalid\n", a_lookup->idx+1, entry->prefix );
+		return 1;
+	}
+
+	a_lookup->idx++;
+	a_lookup->restart = false;
+
+	return 0;
+}
+
+
+// Keeps the current entry of a_lookup. The arena allocations made while decoding it must not be released.
+static int select_entry( struct ctx *a_ctx, struct selection *a_selection, const struct lookup *a_lookup )
+{
+	if (a_selection->count == a_selection->size) {
+		size_t new_size = a_selection->size ? 2 * a_selection->size : 16;
+		struct selected_entry *items = realloc( a_selection->items, new_size * sizeof( struct selected_entry ) );
+		if (a_ctx->stats) a_ctx->stats->reallocs++;
+		if (!items) {
+			perror( "realloc" );
+			return 1;
+		}
+		a_selection->items = items;
+		a_selection->size = new_size;
+	}
+
+	struct selected_entry *item = &a_selection->items[a_selection->count++];
+	item->idx = a_lookup->idx - 1;
+	item->entry = a_lookup->entry;
+	if (a_ctx->version >= 4) {
+		// The whole path, its prefix being set once the selection is sorted
+		char *path = arena_alloc( &a_ctx->arena, a_lookup->path.len + 1 );
+		if (!path) return 1;
+		memcpy( path, a_lookup->path.buf, a_lookup->path.len + 1 );
+		item->entry.file_name = path;
+		item->entry.file_name_len = a_lookup->path.len;
+		item->entry.pad_bytes = path + a_lookup->path.len + 1;
+		item->entry.pad_bytes_len = 0;
+	}
+
+	return 0;
+}
+
+
+static int selected_entry_cmp( const void *a_left, const void *a_right )
+{
+	const struct selected_entry *left = a_left;
+	const struct selected_entry *right = a_right;
+
+	return (left->idx > right->idx) - (left->idx < right->idx);
+}
+
+
+// Entry offsets of a mapped v2 or v3 index, found with gi_skip_entry: every entry is then a block of its own.
+// Returns the number of entries, or 0 on error. The offset of the first extension is stored in *a_entries_end.
+static size_t scan_entry_offsets( struct ctx *a_ctx, struct ieot_block **a_blocks, uint32_t *a_entries_end )
+{
+	assert( a_ctx->mapped && a_ctx->version < 4 );
+
+	struct ieot_block *blocks = malloc( a_ctx->entry_count * sizeof( struct ieot_block ) );
+	struct gi_index index = index_view( a_ctx );
+	size_t offset = a_ctx->file_pos;
+
+	if (!blocks) {
+		perror( "malloc" );
+		return 0;
+	}
+
+	for (uint32_t idx = 0; idx < a_ctx->entry_count; idx++) {
+		blocks[idx].offset = offset;
+		blocks[idx].entry_count = 1;
+		offset = gi_skip_entry( &index, offset );
+		if (!offset) {
+			free( blocks );
+			return 0;
+		}
+	}
+
+	*a_blocks = blocks;
+	*a_entries_end = offset;
+
+	return a_ctx->entry_count;
+}
+
+
+// Replaces the entries by those matching one of the pathspecs, in index order, a_ctx->entry_count being updated.
+// Without a mapped file, every entry is decoded. Otherwise, entries are reached by a binary search over the IEOT
+// blocks, or over the entry offsets of a v2 or v3 index, and only those from the block of the first match on are
+// decoded. A v4 index without IEOT extension can only be decoded sequentially.
+// file_pos is moved to the end of the entries.
+int select_entries( struct ctx *a_ctx, char **a_specs, size_t a_spec_count )
+{
+	assert( a_ctx );
+
+	int result = 0;
+	struct path_key *keys = malloc( 2 * a_spec_count * sizeof( struct path_key ) );
+	size_t key_count = 0;
+	struct selection selection = { .items = NULL, .count = 0, .size = 0 };
+	struct ieot_block *blocks = NULL;
+	size_t block_count = 0;
+	uint32_t *firsts = NULL;
+	uint32_t entries_end = 0;
+	// Not a copy of a_ctx, whose checksum may be computed meanwhile
+	struct ctx cursor = { .data = a_ctx->data, .data_off = 0, .data_len = a_ctx->data_len, .mapped = true, .verify = false, .version = a_ctx->version, .hash = a_ctx->hash };
+	struct lookup lookup = { .ctx = a_ctx, .idx = 0, .restart = true, .entry = { .extended_flags = 0 }, .path = { .buf = NULL, .len = 0, .size = 0, .stats = a_ctx->stats } };
+
+	if (!keys) {
+		perror( "malloc" );
+		return 1;
+	}
+
+	for (size_t idx = 0; idx < a_spec_count; idx++) {
+		size_t len = strlen( a_specs[idx] );
+		while (len > 0 && a_specs[idx][len - 1] == '/') len--;
+		if (len == strlen( a_specs[idx] )) {
+			keys[key_count++] = (struct path_key) { .str = a_specs[idx], .len = len, .exact = true };
+		}
+		// "dir/" is its own key, and "/" (the whole index) the empty prefix.
+		char *dir = arena_alloc( &a_ctx->arena, len + 1 );
+		if (!dir) {
+			result = 1;
+			goto let_exit;
+		}
+		memcpy( dir, a_specs[idx], len );
+		dir[len] = '/';
+		keys[key_count++] = (struct path_key) { .str = dir, .len = len ? len + 1 : 0, .exact = false };
+	}
+
+	if (a_ctx->entries) {
+		// Merged with a shared index by load_shared_index, with whole paths
+	} else if (a_ctx->mapped) {
+		block_count = read_ieot( a_ctx, &blocks, &entries_end );
+		if (!block_count && a_ctx->version < 4) block_count = scan_entry_offsets( a_ctx, &blocks, &entries_end );
+	}
+
+	if (block_count) {
+		// Decoding from a private cursor over the mapping, which allocates nothing.
+		lookup.ctx = &cursor;
+		firsts = malloc( block_count * sizeof( uint32_t ) );
+		if (!firsts) {
+			perror( "malloc" );
+			result = 1;
+			goto let_exit;
+		}
+		uint32_t first = 0;
+		for (size_t blk = 0; blk < block_count; blk++) {
+			firsts[blk] = first;
+			first += blocks[blk].entry_count;
+		}
+
+		for (size_t key = 0; key < key_count && !result; key++) {
+			const struct path_key *key_p = &keys[key];
+
+			// Last block starting before the key, where its first match may be.
+			size_t low = 0;
+			size_t high = block_count;
+			while (high - low > 1 && !result) {
+				size_t mid = low + (high - low) / 2;
+				lookup_seek( &lookup, blocks[mid].offset, firsts[mid] );
+				result = lookup_next( &lookup );
+				if (path_cmp( lookup.path.buf, lookup.path.len, key_p->str, key_p->len ) < 0) {
+					low = mid;
+				} else {
+					high = mid;
+				}
+			}
+
+			lookup_seek( &lookup, blocks[low].offset, firsts[low] );
+			while (!result && lookup.idx < a_ctx->entry_count) {
+				result = lookup_next( &lookup );
+				if (result) break;
+				if (path_key_matches( key_p, lookup.path.buf, lookup.path.len )) {
+					result = select_entry( a_ctx, &selection, &lookup );
+				} else if (path_cmp( lookup.path.buf, lookup.path.len, key_p->str, key_p->len ) > 0) {
+					break;
+				}
+			}
+		}
+
+		a_ctx->file_pos = entries_end;
+	} else if (a_ctx->entries) {
+		for (uint32_t idx = 0; idx < a_ctx->entry_count && !result; idx++) {
+			const struct gi_entry *entry = &a_ctx->entries[idx];
+			bool matches = false;
+
+			for (size_t key = 0; key < key_count && !matches; key++) {
+				matches = path_key_matches( &keys[key], entry->file_name, entry->file_name_len );
+			}
+			if (matches) {
+				lookup.idx = idx + 1;
+				lookup.entry = *entry;
+				lookup.path.len = 0;
+				result = path_buf_apply( &lookup.path, 0, entry->file_name, entry->file_name_len ) || select_entry( a_ctx, &selection, &lookup );
+			}
+		}
+	} else {
+		while (!result && lookup.idx < a_ctx->entry_count) {
+			struct arena_mark mark = arena_get_mark( &a_ctx->arena );
+			bool matches = false;
+
+			result = lookup_next( &lookup );
+			if (result) break;
+			for (size_t key = 0; key < key_count && !matches; key++) {
+				matches = path_key_matches( &keys[key], lookup.path.buf, lookup.path.len );
+			}
+			if (matches) {
+				result = select_entry( a_ctx, &selection, &lookup );
+			} else {
+				arena_reset( &a_ctx->arena, mark );
+			}
+		}
+	}
+
+	if (result) goto let_exit;
+
+	// In index order, without the entries matched by several keys
+	if (selection.count) qsort( selection.items, selection.count, sizeof( struct selected_entry ), selected_entry_cmp );
+
+	struct gi_entry *entries = malloc( (selection.count ? selection.count : 1) * sizeof( struct gi_entry ) );
+	uint32_t *indexes = malloc( (selection.count ? selection.count : 1) * sizeof( uint32_t ) );
+	size_t count = 0;
+	if (!entries || !indexes) {
+		perror( "malloc" );
+		free( entries );
+		free( indexes );
+		result = 1;
+		goto let_exit;
+	}
+
+	for (size_t idx = 0; idx < selection.count; idx++) {
+		if (count && indexes[count - 1] == selection.items[idx].idx) continue;
+		entries[count] = selection.items[idx].entry;
+		if (a_ctx->version >= 4) {
+			// Each path replaces the whole previous one.
+			entries[count].prefix = count ? entries[count - 1].file_name_len : 0;
+		}
+		indexes[count++] = selection.items[idx].idx;
+	}
+
+	free( a_ctx->entries );
+	a_ctx->entries = entries;
+	a_ctx->entry_indexes = indexes;
+	a_ctx->entry_count = count;
+
+let_exit:
+	free( lookup.path.buf );
+	free( firsts );
+	free( blocks );
+	free( selection.items );
+	free( keys );
+
+	return result;
+}
+
+
+int parse_index_stat( struct ctx * a_ctx )
+{
+	int result = 0;
+	struct out *out = a_ctx->out;
+	struct gi_entry entry = { .extended_flags = 0 };
+	struct path_buf path = { .buf = NULL, .len = 0, .size = 0, .stats = a_ctx->stats };
+
+	for (uint32_t idx = 0; idx < a_ctx->entry_count; idx++) {
+		// Nothing allocated for an entry outlives it.
+		struct arena_mark mark = arena_get_mark( &a_ctx->arena );
+		result = next_entry( a_ctx, idx, &entry );
+		if (result) break;
+
+		char ctimestr[37];
+		char mtimestr[37];
+		time2str( a_ctx->times, ctimestr, entry.ctime, entry.ctime_ns );
+		time2str( a_ctx->times, mtimestr, entry.mtime, entry.mtime_ns );
+
+		const char *obj_type = "unknown";
+		char objtype_c = '?';
+		switch ((entry.mode >> 12) & 0x0F) {
+		case 0x4: objtype_c = 'd'; obj_type = "sparse directory"; break;
+		case 0x8: objtype_c = '-'; obj_type = "regular file"; break;
+		case 0xA: objtype_c = 'l'; obj_type = "symbolic link"; break;
+		case 0xE: objtype_c = 'g'; obj_type = "gitlink"; break;
+		}
+
+		int user_len;
+		const char *user = name_cache_get( a_ctx->users, entry.uid, &user_len );
+		const char *group = name_cache_get( a_ctx->groups, entry.gid, NULL );
+
+		int col_width[] = {17, 0};
+		char dev_str[23];
+		char ino_str[11];
+		char *user_str = arena_alloc( &a_ctx->arena, user_len + 14 );
+		size_t dev_len;
+		size_t ino_len;
+		size_t user_str_len;
+		int obj_type_len = strlen( obj_type );
+
+		dev_len = fmt_hex32( dev_str, entry.dev, 1 );
+		memcpy( dev_str + dev_len, "h/", 2 );
+		dev_len += 2;
+		dev_len += fmt_uint( dev_str + dev_len, entry.dev );
+		dev_str[dev_len++] = 'd';
+		ino_len = fmt_uint( ino_str, entry.ino );
+		user_str[0] = '(';
+		user_str_len = 1 + fmt_uint( user_str + 1, entry.uid );
+		user_str[user_str_len++] = '/';
+		memcpy( user_str + user_str_len, user ? user : "", user_len );
+		user_str_len += user_len;
+		user_str[user_str_len++] = ')';
+
+		if ((int) dev_len > col_width[0]) col_width[0] = dev_len;
+		if (obj_type_len - 7 > col_width[1]) col_width[1] = obj_type_len - 7;
+		if ((int) ino_len > col_width[1]) col_width[1] = ino_len;
+		if ((int) user_str_len > col_width[1]) col_width[1] = user_str_len;
+
+		OUT_LIT( out, "Entry " );
+		out_uint( out, (a_ctx->entry_indexes ? a_ctx->entry_indexes[idx] : idx) + 1 );
+		OUT_LIT( out, ":\n\t  File: " );
+		if (a_ctx->version >= 4) {
+			if (path_buf_apply( &path, entry.prefix, entry.file_name, entry.file_name_len )) {
+				fprintf( stderr, "Entry %u: prefix length %zu is invalid\n", idx+1, entry.prefix );
+			}
+			out_mem( out, path.buf, path.len );
+		} else {
+			out_mem( out, entry.file_name, entry.file_name_len );
+		}
+		OUT_LIT( out, "\n\t    ID: " );
+		out_hex( out, a_ctx->hash->len, entry.oid );
+		OUT_LIT( out, "\n\t  Size: " );
+		out_uint_w( out, entry.file_size, -col_width[0] );
+		out_char( out, ' ' );
+		out_str_w( out, obj_type, obj_type_len, -(col_width[1] + 7) );
+		out_char( out, ' ' );
+		print_flags_long( out, entry.flags );
+		OUT_LIT( out, "\n\tDevice: " );
+		out_str_w( out, dev_str, dev_len, -col_width[0] );
+		OUT_LIT( out, " Inode: " );
+		out_str_w( out, ino_str, ino_len, -col_width[1] );
+		out_char( out, ' ' );
+		print_extended_flags_long( out, entry.extended_flags );
+		OUT_LIT( out, "\n\tAccess: (" );
+		char *dest = out_reserve( out, 6 );
+		for (int digit = 0; digit < 4; digit++) {
+			dest[digit] = '0' + ((entry.mode >> (9 - 3 * digit)) & 7);
+		}
+		dest[4] = '/';
+		dest[5] = objtype_c;
+		out->len += 6;
+		print_perm( out, (entry.mode >> 6) & 7 );
+		print_perm( out, (entry.mode >> 3) & 7 );
+		print_perm( out, entry.mode & 7 );
+		OUT_LIT( out, ")   Uid: " );
+		out_str_w( out, user_str, user_str_len, -col_width[1] );
+		OUT_LIT( out, " Gid: (" );
+		out_uint( out, entry.gid );
+		out_char( out, '/' );
+		out_str( out, group ? group : "" );
+		OUT_LIT( out, ")\n\tModify: " );
+		out_str( out, mtimestr );
+		OUT_LIT( out, "\n\tChange: " );
+		out_str( out, ctimestr );
+		out_char( out, '\n' );
+
+		if (entry.mode & 0xFFFF0000) {
+			out_printf( out, "\tMode: 0x%08X\n", entry.mode );
+		}
+		if (a_ctx->version <= 3 && entry.file_name_len != (entry.flags & 0x0FFF)) {
+			out_printf( out, "\tFilename length declared (%d) is different from the one computed (%zu)\n", entry.flags & 0x0FFF, entry.file_name_len );
+		} else if (a_ctx->version >= 4 && path.len != (entry.flags & 0x0FFF)) {
+			out_printf( out, "\tFilename length declared (%d) is different from the one computed (%zu)\n", entry.flags & 0x0FFF, path.len );
+		}
+		out_char( out, '\n' );
+
+		arena_reset( &a_ctx->arena, mark );
+	}
+
+	free( path.buf );
+
+	return result;
+}
+
+// Number of characters of the decimal representation of a_value
+int decimal_width( uint32_t a_value )
+{
+	int width = 1;
+
+	while (a_value >= 10) {
+		a_value /= 10;
+		width++;
+	}
+
+	return width;
+}
+
+
+void ls_widths_update( struct ctx * a_ctx, struct ls_widths *a_widths, const struct gi_entry *a_entry )
+{
+	int width;
+
+	width = decimal_width( a_entry->dev );
+	if (width > a_widths->dev) a_widths->dev = width;
+
+	width = decimal_width( a_entry->ino );
+	if (width > a_widths->inode) a_widths->inode = width;
+
+	if (!name_cache_get( a_ctx->users, a_entry->uid, &width )) {
+		width = decimal_width( a_entry->uid );
+	}
+	if (width > a_widths->user) a_widths->user = width;
+
+	if (!name_cache_get( a_ctx->groups, a_entry->gid, &width )) {
+		width = decimal_width( a_entry->gid );
+	}
+	if (width > a_widths->group) a_widths->group = width;
+
+	width = decimal_width( a_entry->file_size );
+	if (width > a_widths->size) a_widths->size = width;
+}
+
+
+// Computes the column widths with a first pass over the entries of a mapped file, which isn't consumed.
+int scan_ls_widths( struct ctx * a_ctx, struct ls_widths *a_widths )
+{
+	assert( a_ctx->mapped ); // Nothing is allocated, and the file can be read again.
+
+	int result = 0;
+	long file_pos = a_ctx->file_pos;
+	struct gi_entry entry = { .extended_flags = 0 };
+	struct timespec since;
+
+	stats_start( a_ctx->stats, &since );
+	for (uint32_t idx = 0; idx < a_ctx->entry_count && !result; idx++) {
+		result = parse_index_entry( a_ctx, &entry );
+		if (!result) ls_widths_update( a_ctx, a_widths, &entry );
+	}
+
+	a_ctx->file_pos = file_pos;
+	if (a_ctx->stats) a_ctx->stats->decode += stats_elapsed( &since );
+
+	return result;
+}
+
+
+// a_idx is the index of the entry in the file.
+void print_ls_entry( struct ctx * a_ctx, const struct ls_widths *a_widths, const struct gi_entry *entry_p, uint32_t a_idx, const char *a_path, size_t a_path_len )
+{
+	char user_buffer[11];
+	char group_buffer[11];
+	const char *user_str;
+	const char *group_str;
+
+	char ctimestr[37];
+	char mtimestr[37];
+	time2str( a_ctx->times, ctimestr, entry_p->ctime, entry_p->ctime_ns );
+	time2str( a_ctx->times, mtimestr, entry_p->mtime, entry_p->mtime_ns );
+
+	char objtype_c = '?';
+	switch ((entry_p->mode >> 12) & 0x0F) {
+	case 0x8: objtype_c = '-'; break;
+	case 0xA: objtype_c = 'l'; break;
+	case 0xE: objtype_c = 'g'; break;
+	}
+
+	user_str = name_cache_get( a_ctx->users, entry_p->uid, NULL );
+	group_str = name_cache_get( a_ctx->groups, entry_p->gid, NULL );
+	if (!user_str) {
+		sprintf( user_buffer, "%u", entry_p->uid );
+		user_str = user_buffer;
+	}
+	if (!group_str) {
+		sprintf( group_buffer, "%u", entry_p->gid );
+		group_str = group_buffer;
+	}
+
+	struct out *out = a_ctx->out;
+
+	out_uint_w( out, entry_p->dev, a_widths->dev );
+	out_char( out, '/' );
+	out_uint_w( out, entry_p->ino, a_widths->inode );
+	out_char( out, ' ' );
+	out_char( out, objtype_c );
+	print_perm( out, (entry_p->mode >> 6) & 7 );
+	print_perm( out, (entry_p->mode >> 3) & 7 );
+	print_perm( out, entry_p->mode & 7 );
+	out_char( out, ' ' );
+	print_flags( out, entry_p->flags );
+	if (a_ctx->version >= 3) {
+		out_char( out, ' ' );
+		print_extended_flags( out, entry_p->extended_flags );
+	}
+	if (a_ctx->fsmonitor_dirty) {
+		out_char( out, ' ' );
+		out_char( out, bitmap_test( a_ctx->fsmonitor_dirty, a_idx ) ? 'd' : '-' );
+	}
+	out_char( out, ' ' );
+	out_str_w( out, user_str, strlen( user_str ), a_widths->user );
+	out_char( out, ' ' );
+	out_str_w( out, group_str, strlen( group_str ), -a_widths->group );
+	out_char( out, ' ' );
+	out_uint_w( out, entry_p->file_size, a_widths->size );
+	out_char( out, ' ' );
+	out_str( out, ctimestr );
+	out_char( out, ' ' );
+	out_str( out, mtimestr );
+	out_char( out, ' ' );
+	out_hex( out, a_ctx->hash->len, entry_p->oid );
+	out_char( out, ' ' );
+	out_mem( out, a_path, a_path_len );
+	out_char( out, '\n' );
+}
+
+
+// Rows are printed as entries are parsed, the column widths being either fixed (a_ctx->ls_widths),
+// or computed beforehand from entries decoded ahead or from a first pass over the mapped file.
+// Only streams without fixed widths need to keep all their entries until the widths are known.
+int parse_index_ls( struct ctx * a_ctx )
+{
+	int result = 0;
+	uint32_t idx;
+	struct gi_entry * entries = a_ctx->entries;
+	struct gi_entry entry = { .extended_flags = 0 };
+	struct ls_widths widths = { 0, 0, 0, 0, 0 };
+	struct path_buf path = { .buf = NULL, .len = 0, .size = 0, .stats = a_ctx->stats };
+
+	if (a_ctx->ls_widths) {
+		widths = *a_ctx->ls_widths;
+	} else if (entries) {
+		for (idx = 0; idx < a_ctx->entry_count; idx++) {
+			ls_widths_update( a_ctx, &widths, &entries[idx] );
+		}
+	} else if (a_ctx->cache_data) {
+		for (idx = 0; idx < a_ctx->entry_count; idx++) {
+			cached_entry( a_ctx, idx, &entry );
+			ls_widths_update( a_ctx, &widths, &entry );
+		}
+	} else if (a_ctx->mapped) {
+		result = scan_ls_widths( a_ctx, &widths );
+	} else {
+		entries = malloc( a_ctx->entry_count * sizeof( struct gi_entry ) );
+		if (!entries) {
+			perror( "malloc" );
+			return 1;
+		}
+		for (idx = 0; idx < a_ctx->entry_count && !result; idx++) {
+			entries[idx].extended_flags = 0;
+			result = next_entry( a_ctx, idx, &entries[idx] );
+			if (!result) ls_widths_update( a_ctx, &widths, &entries[idx] );
+		}
+	}
+
+	for (idx = 0; idx < a_ctx->entry_count && !result; idx++) {
+		struct arena_mark mark = arena_get_mark( &a_ctx->arena );
+
+		if (entries) {
+			entry = entries[idx];
+		} else {
+			result = next_entry( a_ctx, idx, &entry );
+			if (result) break;
+		}
+
+		uint32_t file_idx = a_ctx->entry_indexes ? a_ctx->entry_indexes[idx] : idx;
+		if (a_ctx->version >= 4) {
+			if (path_buf_apply( &path, entry.prefix, entry.file_name, entry.file_name_len )) {
+				fprintf( stderr, "Entry %u: prefix length %zu is invalid\n", idx+1, entry.prefix );
+			}
+			print_ls_entry( a_ctx, &widths, &entry, file_idx, path.buf, path.len );
+		} else {
+			print_ls_entry( a_ctx, &widths, &entry, file_idx, entry.file_name, entry.file_name_len );
+		}
+
+		arena_reset( &a_ctx->arena, mark );
+	}
+	
+	out_char( a_ctx->out, '\n' );
+
+	if (entries != a_ctx->entries) free( entries );
+	free( path.buf );
+
+	return result;
+}
+
+
+#if 0
+#pragma mark Fields view
+#endif
+
+// Printers get the same arguments, whether they use them or not.
+#define UNUSED __attribute__(( unused ))
+
+typedef void (*field_printer)( struct ctx *a_ctx, const struct gi_entry *a_entry, const char *a_path, size_t a_path_len );
+
+struct field {
+	const char *name;
+	field_printer print;
+};
+
+
+static void field_path( struct ctx *a_ctx, const struct gi_entry *a_entry UNUSED, const char *a_path, size_t a_path_len )
+{
+	out_mem( a_ctx->out, a_path, a_path_len );
+}
+
+static void field_oid( struct ctx *a_ctx, const struct gi_entry *a_entry, const char *a_path UNUSED, size_t a_path_len UNUSED )
+{
+	out_hex( a_ctx->out, a_ctx->hash->len, a_entry->oid );
+}
+
+static void field_mode( struct ctx *a_ctx, const struct gi_entry *a_entry, const char *a_path UNUSED, size_t a_path_len UNUSED )
+{
+	// Octal, as git ls-files --stage does.
+	char *dest = out_reserve( a_ctx->out, 6 );
+
+	for (int digit = 0; digit < 6; digit++) {
+		dest[digit] = '0' + ((a_entry->mode >> (15 - 3 * digit)) & 7);
+	}
+	a_ctx->out->len += 6;
+}
+
+static void field_stage( struct ctx *a_ctx, const struct gi_entry *a_entry, const char *a_path UNUSED, size_t a_path_len UNUSED )
+{
+	out_char( a_ctx->out, '0' + ((a_entry->flags >> 12) & 3) );
+}
+
+static void field_flags( struct ctx *a_ctx, const struct gi_entry *a_entry, const char *a_path UNUSED, size_t a_path_len UNUSED )
+{
+	print_flags( a_ctx->out, a_entry->flags );
+	print_extended_flags( a_ctx->out, a_entry->extended_flags );
+}
+
+static void field_size( struct ctx *a_ctx, const struct gi_entry *a_entry, const char *a_path UNUSED, size_t a_path_len UNUSED )
+{
+	out_uint( a_ctx->out, a_entry->file_size );
+}
+
+static void field_ctime( struct ctx *a_ctx, const struct gi_entry *a_entry, const char *a_path UNUSED, size_t a_path_len UNUSED )
+{
+	char timestr[37];
+
+	time2str( a_ctx->times, timestr, a_entry->ctime, a_entry->ctime_ns );
+	out_str( a_ctx->out, timestr );
+}
+
+static void field_mtime( struct ctx *a_ctx, const struct gi_entry *a_entry, const char *a_path UNUSED, size_t a_path_len UNUSED )
+{
+	char timestr[37];
+
+	time2str( a_ctx->times, timestr, a_entry->mtime, a_entry->mtime_ns );
+	out_str( a_ctx->out, timestr );
+}
+
+static void field_dev( struct ctx *a_ctx, const struct gi_entry *a_entry, const char *a_path UNUSED, size_t a_path_len UNUSED )
+{
+	out_uint( a_ctx->out, a_entry->dev );
+}
+
+static void field_ino( struct ctx *a_ctx, const struct gi_entry *a_entry, const char *a_path UNUSED, size_t a_path_len UNUSED )
+{
+	out_uint( a_ctx->out, a_entry->ino );
+}
+
+static void field_uid( struct ctx *a_ctx, const struct gi_entry *a_entry, const char *a_path UNUSED, size_t a_path_len UNUSED )
+{
+	out_uint( a_ctx->out, a_entry->uid );
+}
+
+static void field_gid( struct ctx *a_ctx, const struct gi_entry *a_entry, const char *a_path UNUSED, size_t a_path_len UNUSED )
+{
+	out_uint( a_ctx->out, a_entry->gid );
+}
+
+static void field_user( struct ctx *a_ctx, const struct gi_entry *a_entry, const char *a_path UNUSED, size_t a_path_len UNUSED )
+{
+	int width;
+	const char *name = name_cache_get( a_ctx->users, a_entry->uid, &width );
+
+	if (name) {
+		out_mem( a_ctx->out, name, width );
+	} else {
+		out_uint( a_ctx->out, a_entry->uid );
+	}
+}
+
+static void field_group( struct ctx *a_ctx, const struct gi_entry *a_entry, const char *a_path UNUSED, size_t a_path_len UNUSED )
+{
+	int width;
+	const char *name = name_cache_get( a_ctx->groups, a_entry->gid, &width );
+
+	if (name) {
+		out_mem( a_ctx->out, name, width );
+	} else {
+		out_uint( a_ctx->out, a_entry->gid );
+	}
+}
+
+static const struct field g_fields[] = {
+	{ "path", field_path },
+	{ "oid", field_oid },
+	{ "sha1", field_oid }, // Whatever the object format
+	{ "mode", field_mode },
+	{ "stage", field_stage },
+	{ "flags", field_flags },
+	{ "size", field_size },
+	{ "ctime", field_ctime },
+	{ "mtime", field_mtime },
+	{ "dev", field_dev },
+	{ "ino", field_ino },
+	{ "uid", field_uid },
+	{ "gid", field_gid },
+	{ "user", field_user },
+	{ "group", field_group },
+};
+
+
+// Parses a comma-separated list of field names.
+// Returns the number of fields, stored in *a_fields which must be freed, or 0 on error.
+size_t parse_field_list( const char *a_list, const struct field ***a_fields )
+{
+	size_t count = 1;
+	const char *ptr;
+
+	for (ptr = a_list; *ptr; ptr++) {
+		if (*ptr == ',') count++;
+	}
+
+	const struct field **fields = malloc( count * sizeof( struct field * ) );
+	if (!fields) {
+		perror( "malloc" );
+		return 0;
+	}
+
+	ptr = a_list;
+	for (size_t idx = 0; idx < count; idx++) {
+		size_t len = strcspn( ptr, "," );
+		fields[idx] = NULL;
+		for (size_t fld = 0; fld < sizeof( g_fields ) / sizeof( g_fields[0] ); fld++) {
+			if (strlen( g_fields[fld].name ) == len && !memcmp( g_fields[fld].name, ptr, len )) {
+				fields[idx] = &g_fields[fld];
+			}
+		}
+		if (!fields[idx]) {
+			fprintf( stderr, "Unknown field '%.*s'\n", (int) len, ptr );
+			free( fields );
+			return 0;
+		}
+		ptr += len + 1;
+	}
+
+	*a_fields = fields;
+
+	return count;
+}
+
+
+// Paths only, the most frequent projection, without decoding the fixed-size fields of streams.
+int parse_index_paths( struct ctx * a_ctx )
+{
+	int result = 0;
+	struct out *out = a_ctx->out;
+	struct gi_entry entry = { .extended_flags = 0 };
+	struct path_buf path = { .buf = NULL, .len = 0, .size = 0, .stats = a_ctx->stats };
+
+	for (uint32_t idx = 0; idx < a_ctx->entry_count && !result; idx++) {
+		struct arena_mark mark = arena_get_mark( &a_ctx->arena );
+
+		if (a_ctx->entries || a_ctx->cache_data || a_ctx->mapped) {
+			result = next_entry( a_ctx, idx, &entry );
+			if (result) break;
+		} else {
+			struct timespec since;
+			stats_start( a_ctx->stats, &since );
+			size_t flags_pos = 40 + a_ctx->hash->len;
+			const uint8_t *fixed = c_fetch( a_ctx, flags_pos + 2 );
+			if (!fixed) {
+				fprintf( stderr, "Reading index entry: unexpected end of file\n" );
+				result = 1;
+				break;
+			}
+			entry.flags = (fixed[flags_pos] << 8) | fixed[flags_pos + 1];
+			result = parse_entry_name( a_ctx, &entry );
+			if (a_ctx->stats) a_ctx->stats->decode += stats_elapsed( &since );
+			if (result) break;
+		}
+
+		if (a_ctx->version >= 4) {
+			if (path_buf_apply( &path, entry.prefix, entry.file_name, entry.file_name_len )) {
+				fprintf( stderr, "Entry %u: prefix length %zu is invalid\n", idx+1, entry.prefix );
+			}
+			out_mem( out, path.buf, path.len );
+		} else {
+			out_mem( out, entry.file_name, entry.file_name_len );
+		}
+		out_char( out, '\n' );
+
+		arena_reset( &a_ctx->arena, mark );
+	}
+
+	free( path.buf );
+
+	return result;
+}
+
+
+// Only the work needed by the selected fields is done: each of them is printed by its own function,
+// called in turn from a table, so that nothing is tested per field.
+int parse_index_fields( struct ctx * a_ctx )
+{
+	if (a_ctx->field_count == 1 && a_ctx->fields[0]->print == field_path) return parse_index_paths( a_ctx );
+
+	int result = 0;
+	struct out *out = a_ctx->out;
+	const struct field **fields = a_ctx->fields;
+	size_t field_count = a_ctx->field_count;
+	struct gi_entry entry = { .extended_flags = 0 };
+	struct path_buf path = { .buf = NULL, .len = 0, .size = 0, .stats = a_ctx->stats };
+
+	for (uint32_t idx = 0; idx < a_ctx->entry_count && !result; idx++) {
+		struct arena_mark mark = arena_get_mark( &a_ctx->arena );
+		const char *path_str;
+		size_t path_len;
+
+		result = next_entry( a_ctx, idx, &entry );
+		if (result) break;
+
+		if (a_ctx->version >= 4) {
+			if (path_buf_apply( &path, entry.prefix, entry.file_name, entry.file_name_len )) {
+				fprintf( stderr, "Entry %u: prefix length %zu is invalid\n", idx+1, entry.prefix );
+			}
+			path_str = path.buf;
+			path_len = path.len;
+		} else {
+			path_str = entry.file_name;
+			path_len = entry.file_name_len;
+		}
+
+		fields[0]->print( a_ctx, &entry, path_str, path_len );
+		for (size_t fld = 1; fld < field_count; fld++) {
+			out_char( out, '\t' );
+			fields[fld]->print( a_ctx, &entry, path_str, path_len );
+		}
+		out_char( out, '\n' );
+
+		arena_reset( &a_ctx->arena, mark );
+	}
+
+	free( path.buf );
+
+	return result;
+}
+
+
+#if 0
+#pragma mark Machine-readable views
+#endif
+
+// Makes the content of a JSON string out of a_len bytes, which aren't checked to be UTF-8.
+void out_json_string( struct out *a_out, const char *a_str, size_t a_len )
+{
+	const uint8_t *ptr = (const uint8_t *) a_str;
+
+	while (a_len) {
+		size_t chunk = a_len < 4096 ? a_len : 4096;
+		char *dest = out_reserve( a_out, chunk * 6 );
+		char *start = dest;
+		for (size_t idx = 0; idx < chunk; idx++) {
+			uint8_t c = *ptr++;
+			char escape = g_json_escapes[c];
+			if (!escape) {
+				*dest++ = c;
+			} else if (escape != 'u') {
+				*dest++ = '\\';
+				*dest++ = escape;
+			} else {
+				memcpy( dest, "\\u00", 4 );
+				memcpy( dest + 4, g_hex_lower_pairs[c], 2 );
+				dest += 6;
+			}
+		}
+		a_out->len += dest - start;
+		a_len -= chunk;
+	}
+}
+
+
+// Longest line of print_ndjson_entry without the path: the keys, 12 numbers and the object id
+#define NDJSON_MAX_LEN 512
+
+// Appends a string literal at dest
+#define PUT_LIT( a_literal ) (memcpy( dest, a_literal, sizeof( a_literal ) - 1 ), dest += sizeof( a_literal ) - 1)
+
+// Formats the whole line straight into the output buffer.
+// a_tag, unless NULL, holds the members to print first, with their trailing comma.
+void print_ndjson_entry( struct out *a_out, const struct hash_algo *a_hash, const char *a_tag, const struct gi_entry *a_entry, const char *a_path, size_t a_path_len )
+{
+	char *dest;
+
+	if (a_tag) {
+		out_char( a_out, '{' );
+		out_str( a_out, a_tag );
+		dest = out_reserve( a_out, NDJSON_MAX_LEN );
+		PUT_LIT( "\"path\":\"" );
+	} else {
+		dest = out_reserve( a_out, NDJSON_MAX_LEN );
+		PUT_LIT( "{\"path\":\"" );
+	}
+	a_out->len = dest - a_out->buf;
+	out_json_string( a_out, a_path, a_path_len );
+
+	dest = out_reserve( a_out, NDJSON_MAX_LEN );
+	// The key is the object format.
+	PUT_LIT( "\",\"" );
+	size_t name_len = strlen( a_hash->name );
+	memcpy( dest, a_hash->name, name_len );
+	dest += name_len;
+	PUT_LIT( "\":\"" );
+	const uint8_t *oid = (const uint8_t *) a_entry->oid;
+	for (size_t idx = 0; idx < a_hash->len; idx++) {
+		memcpy( dest, g_hex_lower_pairs[oid[idx]], 2 );
+		dest += 2;
+	}
+	PUT_LIT( "\",\"mode\":" );
+	dest += fmt_uint( dest, a_entry->mode );
+	PUT_LIT( ",\"stage\":" );
+	*dest++ = '0' + ((a_entry->flags >> 12) & 3);
+	PUT_LIT( ",\"flags\":" );
+	dest += fmt_uint( dest, a_entry->flags );
+	PUT_LIT( ",\"extended_flags\":" );
+	dest += fmt_uint( dest, a_entry->extended_flags );
+	PUT_LIT( ",\"size\":" );
+	dest += fmt_uint( dest, a_entry->file_size );
+	PUT_LIT( ",\"ctime\":" );
+	dest += fmt_int( dest, a_entry->ctime );
+	PUT_LIT( ",\"ctime_ns\":" );
+	dest += fmt_uint( dest, a_entry->ctime_ns );
+	PUT_LIT( ",\"mtime\":" );
+	dest += fmt_int( dest, a_entry->mtime );
+	PUT_LIT( ",\"mtime_ns\":" );
+	dest += fmt_uint( dest, a_entry->mtime_ns );
+	PUT_LIT( ",\"dev\":" );
+	dest += fmt_uint( dest, a_entry->dev );
+	PUT_LIT( ",\"ino\":" );
+	dest += fmt_uint( dest, a_entry->ino );
+	PUT_LIT( ",\"uid\":" );
+	dest += fmt_uint( dest, a_entry->uid );
+	PUT_LIT( ",\"gid\":" );
+	dest += fmt_uint( dest, a_entry->gid );
+	PUT_LIT( "}\n" );
+	a_out->len = dest - a_out->buf;
+
+	if (a_out->line_buffered) out_flush( a_out );
+}
+
+#undef PUT_LIT
+
+
+int parse_index_ndjson( struct ctx * a_ctx )
+{
+	int result = 0;
+	struct gi_entry entry = { .extended_flags = 0 };
+	struct path_buf path = { .buf = NULL, .len = 0, .size = 0, .stats = a_ctx->stats };
+
+	for (uint32_t idx = 0; idx < a_ctx->entry_count && !result; idx++) {
+		struct arena_mark mark = arena_get_mark( &a_ctx->arena );
+
+		result = next_entry( a_ctx, idx, &entry );
+		if (result) break;
+
+		if (a_ctx->version >= 4) {
+			if (path_buf_apply( &path, entry.prefix, entry.file_name, entry.file_name_len )) {
+				fprintf( stderr, "Entry %u: prefix length %zu is invalid\n", idx+1, entry.prefix );
+			}
+			print_ndjson_entry( a_ctx->out, a_ctx->hash, a_ctx->ndjson_tag, &entry, path.buf, path.len );
+		} else {
+			print_ndjson_entry( a_ctx->out, a_ctx->hash, a_ctx->ndjson_tag, &entry, entry.file_name, entry.file_name_len );
+		}
+
+		arena_reset( &a_ctx->arena, mark );
+	}
+
+	free( path.buf );
+
+	return result;
+}
+
+
+// The records are written as the entries are parsed, the paths are kept until the end.
+int parse_index_binary( struct ctx * a_ctx )
+{
+	int result = 0;
+	struct gi_entry entry = { .extended_flags = 0 };
+	struct path_buf path = { .buf = NULL, .len = 0, .size = 0, .stats = a_ctx->stats };
+	struct path_buf paths = { .buf = NULL, .len = 0, .size = 0, .stats = a_ctx->stats };
+	struct bin_header header = {
+		.magic = "GPIB",
+		.version = htole32( BIN_VERSION ),
+		.entry_count = htole32( a_ctx->entry_count ),
+		.record_size = htole32( sizeof( struct bin_stat ) + a_ctx->hash->len + sizeof( struct bin_tail ) ),
+	};
+
+	out_mem( a_ctx->out, &header, sizeof( header ) );
+
+	for (uint32_t idx = 0; idx < a_ctx->entry_count && !result; idx++) {
+		struct arena_mark mark = arena_get_mark( &a_ctx->arena );
+		struct bin_stat record;
+		struct bin_tail tail;
+		const char *path_str;
+		size_t path_len;
+
+		result = next_entry( a_ctx, idx, &entry );
+		if (result) break;
+
+		if (a_ctx->version >= 4) {
+			if (path_buf_apply( &path, entry.prefix, entry.file_name, entry.file_name_len )) {
+				fprintf( stderr, "Entry %u: prefix length %zu is invalid\n", idx+1, entry.prefix );
+			}
+			path_str = path.buf;
+			path_len = path.len;
+		} else {
+			path_str = entry.file_name;
+			path_len = entry.file_name_len;
+		}
+
+		record.ctime = htole32( entry.ctime );
+		record.ctime_ns = htole32( entry.ctime_ns );
+		record.mtime = htole32( entry.mtime );
+		record.mtime_ns = htole32( entry.mtime_ns );
+		record.dev = htole32( entry.dev );
+		record.ino = htole32( entry.ino );
+		record.mode = htole32( entry.mode );
+		record.uid = htole32( entry.uid );
+		record.gid = htole32( entry.gid );
+		record.file_size = htole32( entry.file_size );
+		tail.flags = htole16( entry.flags );
+		tail.extended_flags = htole16( entry.extended_flags );
+		tail.path_offset = htole32( paths.len );
+		tail.path_len = htole32( path_len );
+		out_mem( a_ctx->out, &record, sizeof( record ) );
+		out_mem( a_ctx->out, entry.oid, a_ctx->hash->len );
+		out_mem( a_ctx->out, &tail, sizeof( tail ) );
+
+		// With the NUL terminator
+		result = path_buf_apply( &paths, 0, path_str, path_len ) || path_buf_apply( &paths, 0, "", 1 );
+
+		arena_reset( &a_ctx->arena, mark );
+	}
+
+	if (!result && paths.len) out_mem( a_ctx->out, paths.buf, paths.len );
+
+	free( path.buf );
+	free( paths.buf );
+
+	return result;
+}
+
+
+#if 0
+#pragma mark Summary view
+#endif
+
+#define NSEC_PER_SEC 1000000000LL
+// Alignment of each column, for aligned vector loads
+#define COLUMN_ALIGN 64
+
+static size_t column_size( size_t a_len )
+{
+	return (a_len + COLUMN_ALIGN - 1) & ~(size_t) (COLUMN_ALIGN - 1);
+}
+
+
+void columns_free( struct columns *a_columns )
+{
+	free( a_columns->block );
+	free( a_columns->names.buf );
+	a_columns->block = NULL;
+	a_columns->names.buf = NULL;
+}
+
+
+// Decodes the remaining entries of a_ctx into a_columns: all the columns are carved out of a single block, and the
+// paths are appended to a single buffer. a_columns must be freed with columns_free, even on failure.
+// Returns 0 on success, 1 if an entry can't be parsed.
+int load_columns( struct ctx *a_ctx, struct columns *a_columns )
+{
+	const size_t count = a_ctx->entry_count;
+	struct gi_entry entry = { .extended_flags = 0 };
+	struct path_buf path = { .buf = NULL, .len = 0, .size = 0, .stats = a_ctx->stats };
+	int result = 0;
+
+	a_columns->count = 0;
+	a_columns->names = (struct path_buf) { .buf = NULL, .len = 0, .size = 0, .stats = a_ctx->stats };
+
+	size_t size = 2 * column_size( count * sizeof( int64_t ) ) + 3 * column_size( count * sizeof( uint32_t ) ) +
+		2 * column_size( count * sizeof( uint16_t ) ) + column_size( (count + 1) * sizeof( size_t ) );
+	if (posix_memalign( &a_columns->block, COLUMN_ALIGN, size ? size : COLUMN_ALIGN )) {
+		a_columns->block = NULL;
+		perror( "posix_memalign" );
+		return 1;
+	}
+	char *ptr = a_columns->block;
+	a_columns->mtime = (int64_t *) ptr; ptr += column_size( count * sizeof( int64_t ) );
+	a_columns->ctime = (int64_t *) ptr; ptr += column_size( count * sizeof( int64_t ) );
+	a_columns->mode = (uint32_t *) ptr; ptr += column_size( count * sizeof( uint32_t ) );
+	a_columns->file_size = (uint32_t *) ptr; ptr += column_size( count * sizeof( uint32_t ) );
+	a_columns->uid = (uint32_t *) ptr; ptr += column_size( count * sizeof( uint32_t ) );
+	a_columns->flags = (uint16_t *) ptr; ptr += column_size( count * sizeof( uint16_t ) );
+	a_columns->extended_flags = (uint16_t *) ptr; ptr += column_size( count * sizeof( uint16_t ) );
+	a_columns->name_offsets = (size_t *) ptr;
+	a_columns->name_offsets[0] = 0;
+
+	for (uint32_t idx = 0; idx < count && !result; idx++) {
+		struct arena_mark mark = arena_get_mark( &a_ctx->arena );
+		const char *path_str;
+		size_t path_len;
+
+		result = next_entry( a_ctx, idx, &entry );
+		if (result) break;
+
+		if (a_ctx->version >= 4) {
+			if (path_buf_apply( &path, entry.prefix, entry.file_name, entry.file_name_len )) {
+				fprintf( stderr, "Entry %u: prefix length %zu is invalid\n", idx+1, entry.prefix );
+			}
+			path_str = path.buf;
+			path_len = path.len;
+		} else {
+			path_str = entry.file_name;
+			path_len = entry.file_name_len;
+		}
+
+		a_columns->mtime[idx] = entry.mtime * NSEC_PER_SEC + entry.mtime_ns;
+		a_columns->ctime[idx] = entry.ctime * NSEC_PER_SEC + entry.ctime_ns;
+		a_columns->mode[idx] = entry.mode;
+		a_columns->file_size[idx] = entry.file_size;
+		a_columns->uid[idx] = entry.uid;
+		a_columns->flags[idx] = entry.flags;
+		a_columns->extended_flags[idx] = entry.extended_flags;
+		result = path_buf_apply( &a_columns->names, 0, path_str, path_len );
+		a_columns->name_offsets[idx + 1] = a_columns->names.len;
+		a_columns->count = idx + 1;
+
+		arena_reset( &a_ctx->arena, mark );
+	}
+
+	free( path.buf );
+
+	return result;
+}
+
+
+// Aggregates of the summary view
+struct summary {
+	uint64_t total_size;
+	uint32_t regular;
+	uint32_t executable;
+	uint32_t symlinks;
+	uint32_t gitlinks;
+	uint32_t stages[4];
+	uint32_t assume_valid;
+	uint32_t skip_worktree;
+	uint32_t intent_to_add;
+	uint32_t oldest; // Entry of the oldest mtime, the first one on ties
+	uint32_t newest;
+	size_t longest; // Length of the longest path
+};
+
+// GCC only vectorizes loops this cheap from -O3 on.
+#if defined( __GNUC__ ) && !defined( __clang__ )
+#define VECTORIZE __attribute__(( optimize( "tree-vectorize" ) ))
+#else
+#define VECTORIZE
+#endif
+
+// Each aggregate is a loop over a single column without branches or early exits, so that compilers vectorize it;
+// there are as many passes as aggregates, but each reads only what it needs.
+VECTORIZE static void summarize( const struct columns *a_columns, struct summary *a_summary )
+{
+	const size_t count = a_columns->count;
+	const uint32_t *restrict mode = a_columns->mode;
+	const uint32_t *restrict file_size = a_columns->file_size;
+	const uint16_t *restrict flags = a_columns->flags;
+	const uint16_t *restrict extended_flags = a_columns->extended_flags;
+	const int64_t *restrict mtime = a_columns->mtime;
+	const size_t *restrict name_offsets = a_columns->name_offsets;
+
+	uint64_t total_size = 0;
+	for (size_t idx = 0; idx < count; idx++) total_size += file_size[idx];
+	a_summary->total_size = total_size;
+
+	uint32_t regular = 0, executable = 0, symlinks = 0, gitlinks = 0;
+	for (size_t idx = 0; idx < count; idx++) {
+		regular += mode[idx] == 0100644;
+		executable += mode[idx] == 0100755;
+		symlinks += mode[idx] == 0120000;
+		gitlinks += mode[idx] == 0160000;
+	}
+	a_summary->regular = regular;
+	a_summary->executable = executable;
+	a_summary->symlinks = symlinks;
+	a_summary->gitlinks = gitlinks;
+
+	uint32_t stage1 = 0, stage2 = 0, stage3 = 0, assume_valid = 0;
+	for (size_t idx = 0; idx < count; idx++) {
+		uint32_t stage = (flags[idx] >> 12) & 3;
+		stage1 += stage == 1;
+		stage2 += stage == 2;
+		stage3 += stage == 3;
+		assume_valid += flags[idx] >> 15;
+	}
+	a_summary->stages[0] = count - stage1 - stage2 - stage3;
+	a_summary->stages[1] = stage1;
+	a_summary->stages[2] = stage2;
+	a_summary->stages[3] = stage3;
+	a_summary->assume_valid = assume_valid;
+
+	uint32_t skip_worktree = 0, intent_to_add = 0;
+	for (size_t idx = 0; idx < count; idx++) {
+		skip_worktree += (extended_flags[idx] >> 14) & 1;
+		intent_to_add += (extended_flags[idx] >> 13) & 1;
+	}
+	a_summary->skip_worktree = skip_worktree;
+	a_summary->intent_to_add = intent_to_add;
+
+	// The extremes first, then the first entry having each.
+	int64_t oldest = INT64_MAX, newest = INT64_MIN;
+	for (size_t idx = 0; idx < count; idx++) {
+		oldest = mtime[idx] < oldest ? mtime[idx] : oldest;
+		newest = mtime[idx] > newest ? mtime[idx] : newest;
+	}
+	a_summary->oldest = 0;
+	while (a_summary->oldest < count && mtime[a_summary->oldest] != oldest) a_summary->oldest++;
+	a_summary->newest = 0;
+	while (a_summary->newest < count && mtime[a_summary->newest] != newest) a_summary->newest++;
+
+	size_t longest = 0;
+	for (size_t idx = 0; idx < count; idx++) {
+		size_t len = name_offsets[idx + 1] - name_offsets[idx];
+		longest = len > longest ? len : longest;
+	}
+	a_summary->longest = longest;
+}
+
+
+static void print_summary_mtime( struct ctx *a_ctx, const char *a_label, const struct columns *a_columns, uint32_t a_idx )
+{
+	struct out *out = a_ctx->out;
+	int64_t sec = a_columns->mtime[a_idx] / NSEC_PER_SEC;
+	int64_t nsec = a_columns->mtime[a_idx] % NSEC_PER_SEC;
+	char timestr[37];
+
+	if (nsec < 0) {
+		nsec += NSEC_PER_SEC;
+		sec--;
+	}
+	time2str( a_ctx->times, timestr, sec, nsec );
+	out_str( out, a_label );
+	out_str( out, timestr );
+	out_char( out, '\t' );
+	out_mem( out, a_columns->names.buf + a_columns->name_offsets[a_idx], a_columns->name_offsets[a_idx + 1] - a_columns->name_offsets[a_idx] );
+	out_char( out, '\n' );
+}
+
+
+// Prints aggregates of the entries, computed over their columns, see load_columns.
+int parse_index_summary( struct ctx * a_ctx )
+{
+	struct out *out = a_ctx->out;
+	struct columns columns;
+	struct summary summary;
+
+	int result = load_columns( a_ctx, &columns );
+	if (!result) {
+		summarize( &columns, &summary );
+
+		out_printf( out, "Entries: %zu\n", columns.count );
+		OUT_LIT( out, "Total size: " );
+		out_uint( out, summary.total_size );
+		OUT_LIT( out, " bytes\n" );
+		out_printf( out, "Regular files: %u, executables: %u, symbolic links: %u, gitlinks: %u, others: %zu\n",
+			summary.regular, summary.executable, summary.symlinks, summary.gitlinks,
+			columns.count - summary.regular - summary.executable - summary.symlinks - summary.gitlinks );
+		out_printf( out, "Stages: 0: %u, 1: %u, 2: %u, 3: %u\n", summary.stages[0], summary.stages[1], summary.stages[2], summary.stages[3] );
+		out_printf( out, "Assume valid: %u, skip-worktree: %u, intent-to-add: %u\n", summary.assume_valid, summary.skip_worktree, summary.intent_to_add );
+		if (columns.count) {
+			print_summary_mtime( a_ctx, "Oldest mtime: ", &columns, summary.oldest );
+			print_summary_mtime( a_ctx, "Newest mtime: ", &columns, summary.newest );
+		}
+		out_printf( out, "Paths: %zu bytes, longest %zu\n", columns.names.len, summary.longest );
+	}
+	columns_free( &columns );
+
+	return result;
+}
+
+
+int parse_header( struct ctx * a_ctx )
+{
+	struct gi_header header;
+	size_t len = c_fill( a_ctx, 12 );
+
+	if (gi_parse_header( c_fetch( a_ctx, len ), len, &header )) {
+		fprintf( stderr, "Not a git index file.\n" );
+		return 1;
+	}
+	a_ctx->version = header.version;
+	a_ctx->entry_count = header.entry_count;
+
+	return 0;
+}
+
+
+#if 0
+#pragma mark Split index
+#endif
+
+// See https://git-scm.com/docs/index-format#_split_index
+// The link extension names the shared index holding most of the entries. Its delete and replace bitmaps, both over
+// the entries of the shared index, tell which of them are dropped, and which are replaced in order by the first
+// entries of the split index, whose paths are left empty. The other entries of the split index are added.
+struct split_link {
+	const uint8_t *oid;
+	struct bitmap deleted;
+	struct bitmap replaced;
+};
+
+
+// Parses the content of a link extension. Returns 0 on success, 1 if it is invalid.
+// The bitmaps of a_link must be freed either way.
+static int parse_link( const struct ctx *a_ctx, const uint8_t *a_data, size_t a_len, struct split_link *a_link )
+{
+	struct cursor cursor = { .pos = a_data, .end = a_data + a_len, .failed = !a_data };
+
+	a_link->deleted = (struct bitmap) { .words = NULL, .word_count = 0, .bit_count = 0 };
+	a_link->replaced = a_link->deleted;
+	a_link->oid = cursor_take( &cursor, a_ctx->hash->len );
+	// Both bitmaps are left out when there is nothing to delete or replace.
+	if (!cursor.failed && cursor.pos != cursor.end) {
+		if (read_ewah( &cursor, &a_link->deleted ) || read_ewah( &cursor, &a_link->replaced )) return 1;
+	}
+
+	return cursor.failed || cursor.pos != cursor.end;
+}
+
+
+static bool is_null_oid( const struct ctx *a_ctx, const uint8_t *a_oid )
+{
+	static const uint8_t null_oid[GI_HASH_MAX_LEN];
+
+	return !memcmp( a_oid, null_oid, a_ctx->hash->len );
+}
+
+
+// Decodes all the entries of a mapped index with a libgitindex iterator, each with its whole path.
+// Paths of v4 indexes are copied to the arena of a_ctx, those of older versions point into the mapping.
+// Returns the entries, which must be freed, or NULL on error, which is reported if a_report. The offset of the first
+// extension is stored in *a_entries_end.
+static struct gi_entry *decode_all_entries( struct ctx *a_ctx, const struct gi_index *a_index, uint32_t *a_entries_end, bool a_report )
+{
+	struct gi_entry *entries = malloc( (a_index->entry_count ? a_index->entry_count : 1) * sizeof( struct gi_entry ) );
+	struct gi_iter iter;
+	size_t buf_size = a_index->version >= 4 ? 4096 : 0;
+	char *buf = buf_size ? malloc( buf_size ) : NULL;
+	int status = GI_OK;
+
+	if (!entries || (buf_size && !buf)) {
+		perror( "malloc" );
+		free( entries );
+		free( buf );
+		return NULL;
+	}
+
+	gi_iter_init( &iter, a_index, buf, buf_size );
+	while (iter.next < a_index->entry_count) {
+		struct gi_entry *entry = &entries[iter.next];
+		status = gi_iter_next( &iter, entry );
+		if (status == GI_PATH_TOO_LONG) {
+			// The previous path is still in the buffer, keep it in a larger one.
+			char *new_buf = realloc( buf, buf_size * 2 );
+			if (!new_buf) break;
+			if (a_ctx->stats) a_ctx->stats->reallocs++;
+			buf = new_buf;
+			buf_size *= 2;
+			gi_iter_set_buf( &iter, buf, buf_size );
+			continue;
+		}
+		if (status) break;
+		if (a_index->version >= 4) {
+			char *path = arena_alloc( &a_ctx->arena, iter.path_len + 1 );
+			if (!path) break;
+			memcpy( path, iter.path, iter.path_len + 1 );
+			entry->file_name = path;
+			entry->file_name_len = iter.path_len;
+			entry->pad_bytes = path + iter.path_len + 1;
+			entry->pad_bytes_len = 0;
+		}
+	}
+	free( buf );
+
+	if (iter.next < a_index->entry_count) {
+		if (status && a_report) fprintf( stderr, "Entry %u: %s\n", iter.next, gi_strerror( status ) );
+		free( entries );
+		return NULL;
+	}
+	*a_entries_end = iter.pos;
+
+	return entries;
+}
+
+
+// Same order as the index: paths, then stages.
+static int entry_cmp( const struct gi_entry *a_left, const struct gi_entry *a_right )
+{
+	int result = path_cmp( a_left->file_name, a_left->file_name_len, a_right->file_name, a_right->file_name_len );
+
+	if (!result) result = (int) ((a_left->flags >> 12) & 3) - (int) ((a_right->flags >> 12) & 3);
+
+	return result;
+}
+
+
+// Offset of the first extension of a mapped index, see gi_extensions_pos. It is kept in a_ctx->extensions_pos.
+// Returns 0 if the extensions can't be found.
+static size_t extensions_start( struct ctx *a_ctx )
+{
+	if (!a_ctx->mapped || a_ctx->extensions_pos) return a_ctx->extensions_pos;
+
+	struct gi_index index = index_view( a_ctx );
+	a_ctx->extensions_pos = gi_extensions_pos( &index );
+
+	return a_ctx->extensions_pos;
+}
+
+
+void shared_cache_init( struct shared_cache *a_cache )
+{
+	a_cache->slots = NULL;
+	a_cache->lock = NULL;
+}
+
+
+static void shared_slot_free( struct shared_slot *a_slot )
+{
+	if (a_slot->data) munmap( (void *) a_slot->data, a_slot->data_len );
+	free( a_slot->entries );
+	arena_free( &a_slot->arena );
+	free( a_slot );
+}
+
+
+void shared_cache_free( struct shared_cache *a_cache )
+{
+	while (a_cache->slots) {
+		struct shared_slot *next = a_cache->slots->next;
+		shared_slot_free( a_cache->slots );
+		a_cache->slots = next;
+	}
+}
+
+
+// Returns the shared index of checksum a_oid if a split index already had it decoded, NULL otherwise.
+// Slots are never modified once added, so they can be read without the lock.
+static const struct shared_slot *shared_cache_find( struct shared_cache *a_cache, const uint8_t *a_oid, size_t a_hash_len )
+{
+	const struct shared_slot *slot;
+
+	if (a_cache->lock) pthread_mutex_lock( a_cache->lock );
+	for (slot = a_cache->slots; slot && memcmp( slot->oid, a_oid, a_hash_len ); slot = slot->next);
+	if (a_cache->lock) pthread_mutex_unlock( a_cache->lock );
+
+	return slot;
+}
+
+
+// Adds a_slot to a_cache, unless another thread added the same shared index meanwhile: a_slot is freed then.
+// Returns the slot of a_cache.
+static const struct shared_slot *shared_cache_add( struct shared_cache *a_cache, struct shared_slot *a_slot, size_t a_hash_len )
+{
+	struct shared_slot *slot;
+
+	if (a_cache->lock) pthread_mutex_lock( a_cache->lock );
+	for (slot = a_cache->slots; slot && memcmp( slot->oid, a_slot->oid, a_hash_len ); slot = slot->next);
+	if (!slot) {
+		a_slot->next = a_cache->slots;
+		a_cache->slots = a_slot;
+		slot = a_slot;
+	}
+	if (a_cache->lock) pthread_mutex_unlock( a_cache->lock );
+	if (slot != a_slot) shared_slot_free( a_slot );
+
+	return slot;
+}
+
+
+// Frees the shared index merged with the entries of a_ctx, unless it is kept in a_ctx->shared_cache.
+void release_shared_index( struct ctx *a_ctx )
+{
+	if (a_ctx->shared_slot && !a_ctx->shared_cache) shared_slot_free( (struct shared_slot *) a_ctx->shared_slot );
+	a_ctx->shared_slot = NULL;
+}
+
+
+// Maps the shared index a_path opened as a_file, whose name tells its checksum a_oid, and decodes its entries.
+// Returns it, to be freed with shared_slot_free, or NULL on error, which is reported.
+static struct shared_slot *read_shared_index( struct ctx *a_ctx, FILE *a_file, const char *a_path, const uint8_t *a_oid )
+{
+	const size_t hash_len = a_ctx->hash->len;
+	struct ctx shared = { .file = a_file, .data = NULL, .stats = a_ctx->stats };
+	struct shared_slot *slot = calloc( 1, sizeof( struct shared_slot ) );
+	struct gi_index index;
+	uint32_t entries_end;
+
+	if (!slot) {
+		perror( "calloc" );
+		return NULL;
+	}
+	if (open_input( &shared )) {
+		free( slot );
+		return NULL;
+	}
+	shared.arena.stats = a_ctx->arena.stats;
+
+	// Its name is its checksum, which isn't computed again.
+	if (!shared.mapped || shared.data_len < 12 + hash_len || memcmp( shared.data + shared.data_len - hash_len, a_oid, hash_len )) {
+		fprintf( stderr, "%s doesn't match the link extension\n", a_path );
+		goto rsi_fail;
+	}
+	int status = gi_index_init( &index, shared.data, shared.data_len, hash_len );
+	if (status) {
+		fprintf( stderr, "%s: %s\n", a_path, gi_strerror( status ) );
+		goto rsi_fail;
+	}
+	// Paths of v4 indexes are copied to the arena of the slot.
+	slot->entries = decode_all_entries( &shared, &index, &entries_end, true );
+	if (!slot->entries) {
+		fprintf( stderr, "Invalid entries in %s\n", a_path );
+		goto rsi_fail;
+	}
+	memcpy( slot->oid, a_oid, hash_len );
+	slot->data = shared.data;
+	slot->data_len = shared.data_len;
+	slot->entry_count = index.entry_count;
+	slot->arena = shared.arena;
+
+	return slot;
+
+rsi_fail:
+	arena_free( &shared.arena );
+	close_input( &shared );
+	free( slot );
+	return NULL;
+}
+
+
+// If a_ctx is a mapped split index, merges its entries with those of its shared index, sharedindex.<hash> in the
+// directory of a_path: a_ctx->entries then holds them all, with their whole path, and file_pos is moved to the end
+// of the entries. The shared index is mapped rather than read, and the merge is a single pass over both lists.
+// With a_ctx->shared_cache, a shared index is only decoded for the first split index naming it.
+// Returns 1 on error, 0 otherwise, including when the shared index can't be found, only the entries of a_ctx being
+// printed then, unless a_required: the entries of a split index alone can't be compared with anything.
+int load_shared_index( struct ctx *a_ctx, const char *a_path, bool a_required )
+{
+	assert( a_ctx );
+
+	if (!a_ctx->mapped) return 0;
+
+	const size_t hash_len = a_ctx->hash->len;
+	struct split_link link = { .oid = NULL };
+	const struct shared_slot *shared = NULL;
+	struct shared_slot *owned = NULL; // shared, unless it is in the cache
+	struct gi_entry *split_entries = NULL;
+	struct gi_entry *entries = NULL;
+	uint32_t entries_end = 0;
+	int result = 0;
+
+	const uint8_t *ext;
+	uint32_t ext_len;
+	size_t ext_pos = extensions_start( a_ctx );
+	struct gi_index index = index_view( a_ctx );
+	if (!ext_pos || !gi_find_extension( &index, ext_pos, "link", &ext, &ext_len ) || !ext) return 0;
+
+	if (parse_link( a_ctx, ext, ext_len, &link )) {
+		fprintf( stderr, "Invalid link extension\n" );
+		goto lsi_exit;
+	}
+	if (is_null_oid( a_ctx, link.oid )) goto lsi_exit;
+
+	// sharedindex.<hash> next to the split index
+	const char *slash = a_path ? strrchr( a_path, '/' ) : NULL;
+	size_t dir_len = slash ? slash - a_path + 1 : 0;
+	char *shared_path = arena_alloc( &a_ctx->arena, dir_len + sizeof( "sharedindex." ) + 2 * hash_len );
+	if (!shared_path) goto lsi_exit;
+	if (dir_len) memcpy( shared_path, a_path, dir_len );
+	char *dest = shared_path + dir_len;
+	memcpy( dest, "sharedindex.", sizeof( "sharedindex." ) - 1 );
+	dest += sizeof( "sharedindex." ) - 1;
+	for (size_t idx = 0; idx < hash_len; idx++) {
+		memcpy( dest, g_hex_lower_pairs[link.oid[idx]], 2 );
+		dest += 2;
+	}
+	*dest = '\0';
+
+	const char *fallback = a_required ? "" : ", printing the split index alone";
+	if (!a_path) {
+		fprintf( stderr, "%s can't be located from the standard input%s\n", shared_path + dir_len, fallback );
+		result = a_required;
+		goto lsi_exit;
+	}
+	if (a_ctx->shared_cache) shared = shared_cache_find( a_ctx->shared_cache, link.oid, hash_len );
+	if (!shared) {
+		FILE *file = fopen( shared_path, "r" );
+		if (!file) {
+			fprintf( stderr, "Opening %s: %s%s\n", shared_path, strerror( errno ), fallback );
+			result = a_required;
+			goto lsi_exit;
+		}
+		owned = read_shared_index( a_ctx, file, shared_path, link.oid );
+		fclose( file );
+		shared = owned;
+		if (owned && a_ctx->shared_cache) {
+			shared = shared_cache_add( a_ctx->shared_cache, owned, hash_len );
+			owned = NULL;
+		}
+	}
+
+	result = 1;
+	if (!shared) goto lsi_exit;
+	split_entries = decode_all_entries( a_ctx, &index, &entries_end, true );
+	if (!split_entries) {
+		fprintf( stderr, "Invalid entries in the split index\n" );
+		goto lsi_exit;
+	}
+	const struct gi_entry *shared_entries = shared->entries;
+
+	uint32_t replaced_count = bitmap_count( &link.replaced );
+	if (replaced_count > a_ctx->entry_count || link.deleted.bit_count > shared->entry_count || link.replaced.bit_count > shared->entry_count) {
+		fprintf( stderr, "The link extension doesn't match the shared index\n" );
+		goto lsi_exit;
+	}
+
+	entries = malloc( ((size_t) shared->entry_count + a_ctx->entry_count + 1) * sizeof( struct gi_entry ) );
+	if (!entries) {
+		perror( "malloc" );
+		goto lsi_exit;
+	}
+
+	// Both the shared entries and the added ones are sorted, replacements being in the order of the shared ones.
+	size_t count = 0;
+	uint32_t replacement = 0;
+	uint32_t added = replaced_count;
+	for (uint32_t idx = 0; idx < shared->entry_count; idx++) {
+		struct gi_entry entry = shared_entries[idx];
+
+		if (bitmap_test( &link.replaced, idx )) {
+			const struct gi_entry *replacing = &split_entries[replacement++];
+			entry = *replacing;
+			entry.flags = (replacing->flags & ~0xFFF) | (shared_entries[idx].flags & 0xFFF);
+			entry.file_name = shared_entries[idx].file_name;
+			entry.file_name_len = shared_entries[idx].file_name_len;
+			entry.pad_bytes = shared_entries[idx].pad_bytes;
+			entry.pad_bytes_len = shared_entries[idx].pad_bytes_len;
+		}
+		if (bitmap_test( &link.deleted, idx )) continue;
+
+		while (added < a_ctx->entry_count && entry_cmp( &split_entries[added], &entry ) < 0) {
+			entries[count++] = split_entries[added++];
+		}
+		// An added entry takes the place of the same path and stage.
+		if (added < a_ctx->entry_count && !entry_cmp( &split_entries[added], &entry )) {
+			entries[count++] = split_entries[added++];
+		} else {
+			entries[count++] = entry;
+		}
+	}
+	while (added < a_ctx->entry_count) {
+		entries[count++] = split_entries[added++];
+	}
+
+	if (a_ctx->version >= 4) {
+		// Each path replaces the whole previous one.
+		for (size_t idx = 0; idx < count; idx++) {
+			entries[idx].prefix = idx ? entries[idx - 1].file_name_len : 0;
+		}
+	}
+
+	a_ctx->entries = entries;
+	a_ctx->entry_count = count;
+	a_ctx->file_pos = entries_end;
+	a_ctx->shared_slot = shared;
+	a_ctx->shared_entry_count = shared->entry_count;
+	a_ctx->merged = true;
+	owned = NULL;
+	entries = NULL;
+	result = 0;
+
+lsi_exit:
+	if (owned) shared_slot_free( owned );
+	free( entries );
+	free( split_entries );
+	free( link.deleted.words );
+	free( link.replaced.words );
+
+	return result;
+}
+
+
+void print_link( struct ctx *a_ctx, uint32_t a_len )
+{
+	struct out *out = a_ctx->out;
+	struct split_link link;
+
+	if (parse_link( a_ctx, c_fetch( a_ctx, a_len ), a_len, &link )) {
+		fprintf( stderr, "Invalid link extension\n" );
+	} else if (is_null_oid( a_ctx, link.oid )) {
+		OUT_LIT( out, "No shared index\n\n" );
+	} else {
+		OUT_LIT( out, "Shared index: sharedindex." );
+		for (size_t idx = 0; idx < a_ctx->hash->len; idx++) out_mem( out, g_hex_lower_pairs[link.oid[idx]], 2 );
+		out_printf( out, "\nDeleted entries: %zu, replaced entries: %zu\n", bitmap_count( &link.deleted ), bitmap_count( &link.replaced ) );
+		if (a_ctx->merged) {
+			out_printf( out, "Merged with the %u entries of the shared index\n", a_ctx->shared_entry_count );
+		}
+		out_char( out, '\n' );
+	}
+	free( link.deleted.words );
+	free( link.replaced.words );
+}
+
+
+#if 0
+#pragma mark Entry cache
+#endif
+
+
+
+// Path of the cache of the index a_path, allocated from the arena of a_ctx, NULL if it can't be.
+static char *cache_path( struct ctx *a_ctx, const char *a_path )
+{
+	size_t len = strlen( a_path );
+	char *path = arena_alloc( &a_ctx->arena, len + sizeof( CACHE_SUFFIX ) );
+
+	if (path) {
+		memcpy( path, a_path, len );
+		memcpy( path + len, CACHE_SUFFIX, sizeof( CACHE_SUFFIX ) );
+	}
+
+	return path;
+}
+
+
+// What identifies the index of a_ctx: its size, its mtime and its trailing checksum.
+// Returns 1 if it can't be cached, not being a mapped file.
+static int cache_key_init( const struct ctx *a_ctx, struct cache_key *a_key )
+{
+	size_t hash_len = a_ctx->hash->len;
+	struct stat st;
+
+	if (!a_ctx->mapped || a_ctx->data_len < 12 + hash_len || fstat( fileno( a_ctx->file ), &st ) || (size_t) st.st_size != a_ctx->data_len) return 1;
+
+	memset( a_key, 0, sizeof( *a_key ) );
+	memcpy( a_key->magic, "GPIC", 4 );
+	a_key->version = CACHE_VERSION;
+	a_key->index_size = st.st_size;
+	a_key->index_mtime = st.st_mtim.tv_sec;
+	a_key->index_mtime_ns = st.st_mtim.tv_nsec;
+	a_key->hash_len = hash_len;
+	memcpy( a_key->checksum, a_ctx->data + a_ctx->data_len - hash_len, hash_len );
+
+	return 0;
+}
+
+
+// Maps the cache file a_path if it is that of the index of a_ctx, into a_ctx->cache_data until close_input.
+// Its entries are only decoded by load_cached_entries, once the header of the index is read.
+// Returns whether it matches.
+static bool open_cache( struct ctx *a_ctx, const char *a_path )
+{
+	struct cache_key key;
+	struct stat st;
+	int fd = open( a_path, O_RDONLY );
+	bool matches = false;
+
+	if (fd == -1 || cache_key_init( a_ctx, &key )) goto oc_exit;
+	if (fstat( fd, &st ) || (size_t) st.st_size < sizeof( key ) + sizeof( struct bin_header )) goto oc_exit;
+
+	void *map = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	if (map == MAP_FAILED) goto oc_exit;
+
+	const struct cache_key *cached = map;
+	struct bin_header bin;
+	memcpy( &bin, (const uint8_t *) map + sizeof( key ), sizeof( bin ) );
+	size_t records = (size_t) le32toh( bin.entry_count ) * (sizeof( struct bin_stat ) + key.hash_len + sizeof( struct bin_tail ));
+	key.extensions_pos = cached->extensions_pos;
+	key.merged = cached->merged;
+	key.shared_entry_count = cached->shared_entry_count;
+	matches = !memcmp( cached, &key, sizeof( key ) )
+		&& key.extensions_pos >= 12 && key.extensions_pos <= a_ctx->data_len - key.hash_len
+		&& !memcmp( bin.magic, "GPIB", 4 ) && le32toh( bin.version ) == BIN_VERSION
+		&& le32toh( bin.record_size ) == sizeof( struct bin_stat ) + key.hash_len + sizeof( struct bin_tail )
+		&& records <= st.st_size - sizeof( key ) - sizeof( bin );
+	if (matches) {
+		a_ctx->cache_data = map;
+		a_ctx->cache_data_len = st.st_size;
+	} else {
+		munmap( map, st.st_size );
+	}
+
+oc_exit:
+	if (fd != -1) close( fd );
+
+	return matches;
+}
+
+
+// Checks the paths of the entries of the cache mapped by open_cache, which next_entry then decodes as needed, and
+// moves file_pos to the end of the entries, past which the index is read as usual.
+// Returns 0 on success, 1 if the cache is invalid, which is then unmapped.
+static int load_cached_entries( struct ctx *a_ctx )
+{
+	const struct cache_key *key = (const struct cache_key *) a_ctx->cache_data;
+	struct bin_header bin;
+	memcpy( &bin, a_ctx->cache_data + sizeof( *key ), sizeof( bin ) );
+	uint32_t count = le32toh( bin.entry_count );
+	size_t hash_len = key->hash_len;
+	size_t record_size = sizeof( struct bin_stat ) + hash_len + sizeof( struct bin_tail );
+	const uint8_t *records = a_ctx->cache_data + sizeof( *key ) + sizeof( bin );
+	const char *paths = (const char *) records + count * record_size;
+	size_t paths_len = a_ctx->cache_data + a_ctx->cache_data_len - (const uint8_t *) paths;
+
+	for (uint32_t idx = 0; idx < count; idx++) {
+		struct bin_tail tail;
+		memcpy( &tail, records + idx * record_size + sizeof( struct bin_stat ) + hash_len, sizeof( tail ) );
+		size_t offset = le32toh( tail.path_offset );
+		size_t len = le32toh( tail.path_len );
+		if (offset >= paths_len || len >= paths_len - offset || paths[offset + len]) {
+			fprintf( stderr, "Entry %u of the cache: invalid path, reading the index\n", idx + 1 );
+			munmap( (void *) a_ctx->cache_data, a_ctx->cache_data_len );
+			a_ctx->cache_data = NULL;
+			return 1;
+		}
+	}
+
+	a_ctx->entry_count = count;
+	a_ctx->file_pos = key->extensions_pos;
+	a_ctx->extensions_pos = key->extensions_pos;
+	a_ctx->merged = key->merged;
+	a_ctx->shared_entry_count = key->shared_entry_count;
+
+	return 0;
+}
+
+
+// Decodes the entries of a mapped index which weren't loaded ahead into a_ctx->entries, for write_cache, and moves
+// file_pos to the end of the entries.
+// Returns 0 on success.
+static int load_entries( struct ctx *a_ctx )
+{
+	struct gi_index index = index_view( a_ctx );
+	uint32_t entries_end;
+	// Errors are left to the view, which parses the entries itself then.
+	struct gi_entry *entries = a_ctx->mapped ? decode_all_entries( a_ctx, &index, &entries_end, false ) : NULL;
+
+	if (!entries) return 1;
+	if (a_ctx->version >= 4) {
+		for (uint32_t idx = 0; idx < a_ctx->entry_count; idx++) {
+			entries[idx].prefix = idx ? entries[idx - 1].file_name_len : 0;
+		}
+	}
+	a_ctx->entries = entries;
+	a_ctx->file_pos = entries_end;
+	a_ctx->extensions_pos = entries_end;
+
+	return 0;
+}
+
+
+// Writes the entries of a_ctx, which must all be decoded, to the cache file a_path, a_extensions_pos being where they
+// end in the index. The file is written under a temporary name, then renamed, so that concurrent readers see either
+// the previous cache or the new one.
+// Returns 0 on success.
+static int write_cache( struct ctx *a_ctx, const char *a_path, size_t a_extensions_pos )
+{
+	struct cache_key key;
+	struct out out;
+	struct out *ctx_out = a_ctx->out;
+	size_t len = strlen( a_path );
+	char *tmp_path = arena_alloc( &a_ctx->arena, len + sizeof( ".XXXXXX" ) );
+	int result = 1;
+
+	if (!tmp_path || cache_key_init( a_ctx, &key )) return 1;
+	// A split index whose shared index couldn't be merged isn't cached, as it may be found next time.
+	struct gi_index index = index_view( a_ctx );
+	const uint8_t *link;
+	uint32_t link_len;
+	if (!a_ctx->merged && gi_find_extension( &index, a_extensions_pos, "link", &link, &link_len ) && link) return 1;
+	key.extensions_pos = a_extensions_pos;
+	key.merged = a_ctx->merged;
+	key.shared_entry_count = a_ctx->shared_entry_count;
+	memcpy( tmp_path, a_path, len );
+	memcpy( tmp_path + len, ".XXXXXX", sizeof( ".XXXXXX" ) );
+
+	int fd = mkstemp( tmp_path );
+	if (fd == -1 || out_init( &out, fd )) {
+		fprintf( stderr, "Writing %s: %s\n", a_path, strerror( errno ) );
+		if (fd != -1) close( fd );
+		return 1;
+	}
+
+	out_mem( &out, &key, sizeof( key ) );
+	a_ctx->out = &out;
+	result = parse_index_binary( a_ctx );
+	a_ctx->out = ctx_out;
+	result = out_free( &out ) || result;
+	result = close( fd ) || result;
+	if (!result && rename( tmp_path, a_path )) {
+		fprintf( stderr, "Renaming %s: %s\n", tmp_path, strerror( errno ) );
+		result = 1;
+	}
+	if (result) unlink( tmp_path );
+
+	return result;
+}
+
+
+#if 0
+#pragma mark File system monitor
+#endif
+
+// See https://git-scm.com/docs/index-format#_file_system_monitor_cache
+struct fsmonitor {
+	uint32_t version;
+	uint64_t last_update; // Version 1, in nanoseconds since the epoch
+	const char *token; // Version 2
+	size_t token_len;
+	struct bitmap dirty; // Bit n set when entry n isn't valid
+};
+
+
+// Parses the content of a FSMN extension. Returns 0 on success, 1 if it is invalid.
+// a_fsmonitor->dirty.words must be freed either way.
+static int parse_fsmonitor( const uint8_t *a_data, size_t a_len, struct fsmonitor *a_fsmonitor )
+{
+	struct cursor cursor = { .pos = a_data, .end = a_data + a_len, .failed = !a_data };
+
+	a_fsmonitor->dirty = (struct bitmap) { .words = NULL, .word_count = 0, .bit_count = 0 };
+	a_fsmonitor->last_update = 0;
+	a_fsmonitor->token = NULL;
+	a_fsmonitor->token_len = 0;
+
+	a_fsmonitor->version = cursor_be32( &cursor );
+	if (a_fsmonitor->version == 1) {
+		uint64_t high = cursor_be32( &cursor );
+		a_fsmonitor->last_update = (high << 32) | cursor_be32( &cursor );
+	} else if (a_fsmonitor->version == 2) {
+		a_fsmonitor->token = cursor_string( &cursor, &a_fsmonitor->token_len );
+	} else {
+		return 1;
+	}
+
+	uint32_t bitmap_len = cursor_be32( &cursor );
+	const uint8_t *bitmap = cursor_take( &cursor, bitmap_len );
+	if (cursor.failed || cursor.pos != cursor.end) return 1;
+
+	struct cursor bitmap_cursor = { .pos = bitmap, .end = bitmap + bitmap_len, .failed = false };
+
+	return read_ewah( &bitmap_cursor, &a_fsmonitor->dirty ) || bitmap_cursor.pos != bitmap_cursor.end;
+}
+
+
+// Reads the dirty bitmap of the FSMN extension of a mapped index into *a_dirty ahead of the entries, a_ctx->fsmonitor_dirty
+// then pointing to it. Nothing is read if there is no such extension, or if it is invalid, which is reported with the
+// other extensions. a_dirty->words must be freed.
+void load_fsmonitor( struct ctx *a_ctx, struct bitmap *a_dirty )
+{
+	size_t ext_pos = extensions_start( a_ctx );
+	struct gi_index index = index_view( a_ctx );
+	const uint8_t *ext;
+	uint32_t ext_len;
+	struct fsmonitor fsmonitor;
+
+	if (!ext_pos || !gi_find_extension( &index, ext_pos, "FSMN", &ext, &ext_len ) || !ext) return;
+
+	if (parse_fsmonitor( ext, ext_len, &fsmonitor )) {
+		free( fsmonitor.dirty.words );
+		return;
+	}
+	*a_dirty = fsmonitor.dirty;
+	a_ctx->fsmonitor_dirty = a_dirty;
+}
+
+
+void print_fsmonitor( struct ctx *a_ctx, uint32_t a_len )
+{
+	struct out *out = a_ctx->out;
+	struct fsmonitor fsmonitor;
+
+	if (parse_fsmonitor( c_fetch( a_ctx, a_len ), a_len, &fsmonitor )) {
+		fprintf( stderr, "Invalid FSMN extension\n" );
+	} else {
+		if (fsmonitor.version == 1) {
+			char timestr[37];
+			time2str( a_ctx->times, timestr, fsmonitor.last_update / 1000000000, fsmonitor.last_update % 1000000000 );
+			OUT_LIT( out, "Last update: " );
+			out_str( out, timestr );
+		} else {
+			OUT_LIT( out, "Token: '" );
+			out_mem( out, fsmonitor.token, fsmonitor.token_len );
+			out_char( out, '\'' );
+		}
+		OUT_LIT( out, "\nDirty entries: " );
+		out_uint( out, bitmap_count( &fsmonitor.dirty ) );
+		OUT_LIT( out, " of " );
+		out_uint( out, a_ctx->entry_count );
+		OUT_LIT( out, "\n\n" );
+	}
+	free( fsmonitor.dirty.words );
+}
+
+
+#if 0
+#pragma mark Resolve undo
+#endif
+
+// See https://git-scm.com/docs/index-format#_resolve_undo
+// Prints the stages recorded before conflicts were resolved like git ls-files --resolve-undo does: the mode, object
+// id and stage of each of them, then the path. Returns 0 on success, 1 if the extension is invalid.
+int read_resolve_undo( struct ctx *a_ctx, uint32_t a_len )
+{
+	struct out *out = a_ctx->out;
+	const size_t hash_len = a_ctx->hash->len;
+	const uint8_t *data = c_fetch( a_ctx, a_len );
+	struct cursor cursor = { .pos = data, .end = data + a_len, .failed = !data };
+
+	while (!cursor.failed && cursor.pos < cursor.end) {
+		size_t path_len = 0;
+		const char *path = cursor_string( &cursor, &path_len );
+		const char *modes[3];
+		size_t mode_lens[3];
+		const uint8_t *oids[3];
+
+		// Octal modes, 0 for a stage that didn't exist and has no object id
+		for (int stage = 0; stage < 3; stage++) {
+			modes[stage] = cursor_string( &cursor, &mode_lens[stage] );
+		}
+		for (int stage = 0; stage < 3 && !cursor.failed; stage++) {
+			char *end;
+			unsigned long mode = strtoul( modes[stage], &end, 8 );
+			if (!mode_lens[stage] || *end || mode > UINT32_MAX) cursor.failed = true;
+			oids[stage] = mode ? cursor_take( &cursor, hash_len ) : NULL;
+		}
+		if (cursor.failed) break;
+
+		for (int stage = 0; stage < 3; stage++) {
+			if (!oids[stage]) continue;
+			out_mem( out, modes[stage], mode_lens[stage] );
+			out_char( out, ' ' );
+			out_hex( out, hash_len, oids[stage] );
+			out_char( out, ' ' );
+			out_char( out, '1' + stage );
+			out_char( out, '\t' );
+			out_mem( out, path, path_len );
+			out_char( out, '\n' );
+		}
+	}
+	out_char( out, '\n' );
+
+	if (cursor.failed) {
+		fprintf( stderr, "Invalid resolve undo extension\n" );
+		return 1;
+	}
+
+	return 0;
+}
+
+
+#if 0
+#pragma mark Cache tree queries
+#endif
+
+// Moves file_pos past the entries: straight to the extensions of a mapped index, parsing the entries otherwise.
+// Returns 0 on success, 1 if an entry can't be parsed.
+int skip_entries( struct ctx *a_ctx )
+{
+	if (a_ctx->entries) return 0; // Loaded ahead, file_pos is already past them
+
+	size_t offset = extensions_start( a_ctx );
+	if (offset) {
+		a_ctx->file_pos = offset;
+		return 0;
+	}
+
+	for (uint32_t idx = 0; idx < a_ctx->entry_count; idx++) {
+		struct gi_entry entry;
+		struct arena_mark mark = arena_get_mark( &a_ctx->arena );
+		int result = parse_index_entry( a_ctx, &entry );
+		arena_reset( &a_ctx->arena, mark );
+		if (result) return 1;
+	}
+
+	return 0;
+}
+
+
+// Prints whether the cache tree of a_dir is valid, as looked up in a_index; "", "." and "/" are the root.
+void print_tree_query( struct ctx *a_ctx, const struct tree_index *a_index, const char *a_dir )
+{
+	struct out *out = a_ctx->out;
+	size_t len = strlen( a_dir );
+
+	while (len && a_dir[len - 1] == '/') len--;
+	if (len == 1 && a_dir[0] == '.') len = 0;
+
+	const struct tree_node *node = tree_index_get( a_index, a_dir, len );
+
+	if (node && node->entry_count >= 0) {
+		out_hex( out, a_ctx->hash->len, node->oid );
+	} else {
+		out_pad( out, 2 * a_ctx->hash->len );
+	}
+	OUT_LIT( out, "  '" );
+	out_mem( out, a_dir, len );
+	OUT_LIT( out, "', " );
+	if (!node) {
+		OUT_LIT( out, "not in the cache tree\n" );
+		return;
+	}
+	if (node->entry_count >= 0) {
+		out_int( out, node->entry_count );
+		OUT_LIT( out, " entries, " );
+	} else {
+		OUT_LIT( out, "invalid, " );
+	}
+	out_uint( out, node->subtrees );
+	OUT_LIT( out, " subtrees\n" );
+}
+
+
+#if 0
+#pragma mark Directory usage
+#endif
+
+// What the TREE extension records for a directory of the du view
+enum du_tree {
+	DU_TREE_UNKNOWN, // No TREE extension read ahead
+	DU_TREE_MISSING, // Not in the cache tree
+	DU_TREE_INVALID,
+	DU_TREE_VALID,
+};
+
+static const char *const g_du_tree_names[] = { "-", "missing", "invalid", "valid" };
+
+// Directory of the du view, from the root down to the one of the last entry. Its path is the start of that of the
+// deepest one.
+struct du_frame {
+	size_t path_len;
+	uint32_t entries;
+	uint64_t size;
+	enum du_tree tree;
+	// Its subtrees in the TREE extension, see du_find_subtree
+	const char *subtrees;
+	unsigned subtree_count;
+	const char *cursor;
+	unsigned cursor_idx;
+};
+
+// The TREE extension of a mapped index, read in place.
+struct du_trees {
+	const char *end;
+	size_t hash_len;
+	bool failed;
+};
+
+// Position following the tree at a_pos and all its subtrees, NULL if they are malformed.
+static const char *du_skip_tree( const struct du_trees *a_trees, const char *a_pos )
+{
+	unsigned long remaining = 1;
+
+	while (remaining) {
+		struct gi_tree tree;
+		if (gi_parse_tree_entry( a_pos, a_trees->end, a_trees->hash_len, &tree, &a_pos )) return NULL;
+		remaining = remaining - 1 + tree.subtrees;
+	}
+
+	return a_pos;
+}
+
+// Sets the tree of a_frame from a_tree, whose subtrees start at a_subtrees.
+static void du_set_tree( struct du_frame *a_frame, const struct gi_tree *a_tree, const char *a_subtrees )
+{
+	a_frame->tree = a_tree->entry_count >= 0 ? DU_TREE_VALID : DU_TREE_INVALID;
+	a_frame->subtrees = a_subtrees;
+	a_frame->subtree_count = a_tree->subtrees;
+	a_frame->cursor = a_subtrees;
+	a_frame->cursor_idx = 0;
+}
+
+// Looks up the tree of a_child, named a_name, among the subtrees of a_parent.
+// Subtrees are sorted by name length first, and entries by name: each lookup goes on from the subtree the previous one
+// found, wrapping around, so that siblings of the same length are found in one pass over the subtrees.
+static void du_find_subtree( struct du_trees *a_trees, struct du_frame *a_parent, struct du_frame *a_child, const char *a_name, size_t a_name_len )
+{
+	a_child->tree = a_parent->tree == DU_TREE_UNKNOWN || a_trees->failed ? DU_TREE_UNKNOWN : DU_TREE_MISSING;
+	a_child->subtree_count = 0;
+	if (a_trees->failed) return;
+
+	for (unsigned idx = 0; idx < a_parent->subtree_count && !a_trees->failed; idx++) {
+		struct gi_tree tree;
+		const char *next;
+
+		if (gi_parse_tree_entry( a_parent->cursor, a_trees->end, a_trees->hash_len, &tree, &next )) {
+			a_trees->failed = true;
+		} else if (tree.path_len == a_name_len && !memcmp( tree.path, a_name, a_name_len )) {
+			du_set_tree( a_child, &tree, next );
+			return;
+		} else {
+			if (tree.subtrees) next = du_skip_tree( a_trees, a_parent->cursor );
+			a_trees->failed = !next;
+			a_parent->cursor = next;
+			if (++a_parent->cursor_idx == a_parent->subtree_count) {
+				a_parent->cursor = a_parent->subtrees;
+				a_parent->cursor_idx = 0;
+			}
+		}
+	}
+	if (a_trees->failed) {
+		fprintf( stderr, "Invalid TREE extension\n" );
+		a_child->tree = DU_TREE_UNKNOWN;
+	}
+}
+
+// Prints the row of a_frame, whose path is the start of a_path, and adds its totals to a_parent unless it is NULL.
+static void du_close( struct ctx *a_ctx, const struct du_frame *a_frame, struct du_frame *a_parent, const char *a_path )
+{
+	struct out *out = a_ctx->out;
+
+	out_uint( out, a_frame->entries );
+	out_char( out, '\t' );
+	out_uint( out, a_frame->size );
+	out_char( out, '\t' );
+	out_str( out, g_du_tree_names[a_frame->tree] );
+	out_char( out, '\t' );
+	if (a_parent) {
+		out_mem( out, a_path, a_frame->path_len );
+	} else {
+		out_char( out, '.' );
+	}
+	out_char( out, '\n' );
+
+	if (a_parent) {
+		a_parent->entries += a_frame->entries;
+		a_parent->size += a_frame->size;
+	}
+}
+
+// Prints the number of entries and the total size of each directory down to a_ctx->du_depth levels below the root,
+// like du(1) does, the deeper entries being counted in their ancestors, with the state of its tree in the TREE
+// extension of a mapped index.
+// The entries are read in a single pass, which only keeps the directories of the last one; the TREE extension is
+// read in place.
+int parse_index_du( struct ctx * a_ctx )
+{
+	int result = 0;
+	struct gi_entry entry = { .extended_flags = 0 };
+	struct path_buf path = { .buf = NULL, .len = 0, .size = 0, .stats = a_ctx->stats };
+	struct path_buf dir = { .buf = NULL, .len = 0, .size = 0, .stats = a_ctx->stats };
+	struct du_trees trees = { .end = NULL, .hash_len = a_ctx->hash->len, .failed = false };
+	size_t frame_size = 16;
+	struct du_frame *frames = malloc( frame_size * sizeof( struct du_frame ) );
+	size_t depth = 1;
+
+	if (!frames) {
+		perror( "malloc" );
+		return 1;
+	}
+	frames[0] = (struct du_frame) { .path_len = 0, .entries = 0, .size = 0, .tree = DU_TREE_UNKNOWN, .subtree_count = 0 };
+	path_buf_apply( &dir, 0, "", 0 );
+
+	size_t ext_pos = extensions_start( a_ctx );
+	struct gi_index index = index_view( a_ctx );
+	const uint8_t *ext;
+	uint32_t ext_len;
+	if (ext_pos && gi_find_extension( &index, ext_pos, "TREE", &ext, &ext_len )) {
+		struct gi_tree root;
+		const char *next;
+		if (ext) trees.end = (const char *) ext + ext_len;
+		if (!ext) {
+			frames[0].tree = DU_TREE_MISSING;
+		} else if (gi_parse_tree_entry( (const char *) ext, trees.end, trees.hash_len, &root, &next )) {
+			fprintf( stderr, "Invalid TREE extension\n" );
+			frames[0].tree = DU_TREE_UNKNOWN;
+		} else {
+			du_set_tree( &frames[0], &root, next );
+		}
+	}
+
+	for (uint32_t idx = 0; idx < a_ctx->entry_count; idx++) {
+		struct arena_mark mark = arena_get_mark( &a_ctx->arena );
+		const char *path_str;
+		size_t path_len;
+
+		result = next_entry( a_ctx, idx, &entry );
+		if (result) break;
 
-		printf( "Entry %u:\n", idx+1 );
-		printf( "\t  File: " );
 		if (a_ctx->version >= 4) {
-			if (!path_name) {
-				assert( entry.prefix == 0 ); // Should be an error check, not an assert.
-				path_name = strdup( entry.file_name );
-			} else {
-				old_len = strlen( path_name );
-				assert( entry.prefix <= old_len ); // Should be an error check, not an assert.
-				path_name = realloc( path_name, old_len - entry.prefix + strlen( entry.file_name ) + 1 );
-				path_name[old_len - entry.prefix] = 0;
-				strcat( path_name, entry.file_name );
+			if (path_buf_apply( &path, entry.prefix, entry.file_name, entry.file_name_len )) {
+				fprintf( stderr, "Entry %u: prefix length %zu is invalid\n", idx+1, entry.prefix );
+			}
+			path_str = path.buf;
+			path_len = path.len;
+		} else {
+			path_str = entry.file_name;
+			path_len = entry.file_name_len;
+		}
+
+		// Closes the directories the entry isn't in, then opens those it is in down to the depth.
+		while (depth > 1) {
+			size_t len = frames[depth - 1].path_len;
+			if (path_len > len && path_str[len] == '/' && !memcmp( path_str, dir.buf, len )) break;
+			du_close( a_ctx, &frames[depth - 1], &frames[depth - 2], dir.buf );
+			depth--;
+		}
+		size_t start = depth > 1 ? frames[depth - 1].path_len + 1 : 0;
+		while (depth <= a_ctx->du_depth) {
+			const char *slash = memchr( path_str + start, '/', path_len - start );
+			if (!slash) break;
+			if (depth == frame_size) {
+				size_t new_size = frame_size * 2;
+				struct du_frame *new_frames = realloc( frames, new_size * sizeof( struct du_frame ) );
+				if (a_ctx->stats) a_ctx->stats->reallocs++;
+				if (!new_frames) {
+					perror( "realloc" );
+					result = 1;
+					break;
+				}
+				frames = new_frames;
+				frame_size = new_size;
+			}
+			struct du_frame *frame = &frames[depth];
+			frame->path_len = slash - path_str;
+			frame->entries = 0;
+			frame->size = 0;
+			du_find_subtree( &trees, &frames[depth - 1], frame, path_str + start, frame->path_len - start );
+			path_buf_apply( &dir, dir.len, path_str, frame->path_len );
+			start = frame->path_len + 1;
+			depth++;
+		}
+		if (result) break;
+		frames[depth - 1].entries++;
+		frames[depth - 1].size += entry.file_size;
+
+		arena_reset( &a_ctx->arena, mark );
+	}
+
+	if (!result) {
+		for (; depth > 1; depth--) {
+			du_close( a_ctx, &frames[depth - 1], &frames[depth - 2], dir.buf );
+		}
+		du_close( a_ctx, &frames[0], NULL, dir.buf );
+	}
+
+	free( frames );
+	free( path.buf );
+	free( dir.buf );
+
+	return result;
+}
+
+
+#if 0
+#pragma mark Index diff
+#endif
+
+// Opens a_path as another index to compare with a_ctx, with the same options, and reads its header.
+// Its object format is a_hash, or guessed if NULL, and must be that of a_ctx if it is known.
+// A split index is merged with its shared index, which must be found, see load_shared_index.
+// Returns 0 on success.
+int open_other_index( struct ctx *a_other, const struct ctx *a_ctx, const char *a_path, const struct hash_algo *a_hash )
+{
+	*a_other = (struct ctx) { .file = NULL, .file_pos = 0, .verify = a_ctx->verify, .hash = a_hash, .threads = 1, .out = a_ctx->out };
+
+	a_other->file = fopen( a_path, "r" );
+	if (!a_other->file) {
+		perror( a_path );
+		return 1;
+	}
+	if (open_input( a_other )) return 1;
+	if (!a_other->hash) a_other->hash = detect_hash_algo( a_other );
+	if (a_ctx->hash && a_other->hash != a_ctx->hash) {
+		fprintf( stderr, "Can't compare %s and %s indexes\n", a_other->hash->name, a_ctx->hash->name );
+		return 1;
+	}
+	start_checksum( a_other );
+	if (parse_header( a_other )) return 1;
+
+	return load_shared_index( a_other, a_path, true );
+}
+
+
+// Frees what open_other_index set up in a_other, even if it failed halfway, once its checksum is finished.
+static void release_index( struct ctx *a_other )
+{
+	if (a_other->sha_threaded) {
+		unsigned char md[GI_HASH_MAX_LEN];
+		finish_checksum( a_other, md );
+	}
+	free( a_other->entries );
+	a_other->entries = NULL;
+	release_shared_index( a_other );
+	arena_free( &a_other->arena );
+	if (a_other->file) {
+		close_input( a_other );
+		fclose( a_other->file );
+		a_other->file = NULL;
+	}
+}
+
+
+// Closes an index opened with open_other_index. If a_check, its entries having been read, its extensions are
+// skipped and its checksum is checked.
+// Returns 1 if its checksum doesn't match, 0 otherwise.
+int close_other_index( struct ctx *a_other, const char *a_path, bool a_check )
+{
+	struct extension ext;
+	unsigned char md[GI_HASH_MAX_LEN];
+	bool failed = false;
+
+	if (a_check) {
+		while (c_peek( a_other, 8 + a_other->hash->len )) {
+			c_fread( &ext, 8, a_other );
+			seek( a_other, ntohl( ext.len ) );
+		}
+	}
+	finish_checksum( a_other, md );
+
+	if (a_check) {
+		size_t hash_len = c_fill( a_other, a_other->hash->len );
+		const uint8_t *hash = c_peek( a_other, hash_len );
+		failed = hash_len != a_other->hash->len || (a_other->verify && memcmp( hash, md, hash_len ));
+		if (failed) fprintf( stderr, "%s: hash checksum mismatch\n", a_path );
+	}
+
+	release_index( a_other );
+
+	return failed;
+}
+
+
+// One of the indexes being compared by diff_indexes, at its current entry.
+struct diff_side {
+	struct ctx *ctx;
+	uint32_t idx; // Index of the next entry
+	bool done;
+	struct gi_entry entry;
+	const char *path; // Whole path of entry, valid until the next call to diff_next
+	size_t path_len;
+	struct path_buf path_buf; // v4 paths
+	struct arena_mark mark;
+	// IEOT blocks of a mapped index read from the file, or 0 for none
+	struct ieot_block *blocks;
+	size_t block_count;
+	size_t block; // First block not before the current entry
+	uint32_t block_first; // Index of the first entry of that block
+	uint32_t entries_end;
+	bool restart; // The next entry starts a block which follows skipped ones: its v4 prefix strips the whole path
+};
+
+
+// Moves a_side to its next entry, or sets done after the last one.
+// Returns 0 on success, 1 if the entry can't be read.
+static int diff_next( struct diff_side *a_side )
+{
+	struct ctx *ctx = a_side->ctx;
+
+	arena_reset( &ctx->arena, a_side->mark );
+	if (a_side->idx >= ctx->entry_count) {
+		a_side->done = true;
+		return 0;
+	}
+	a_side->mark = arena_get_mark( &ctx->arena );
+	if (next_entry( ctx, a_side->idx, &a_side->entry )) return 1;
+	a_side->idx++;
+
+	if (ctx->version >= 4) {
+		size_t strip = a_side->restart ? a_side->path_buf.len : a_side->entry.prefix;
+		if (path_buf_apply( &a_side->path_buf, strip, a_side->entry.file_name, a_side->entry.file_name_len )) {
+			fprintf( stderr, "Entry %u: prefix length %zu is invalid\n", a_side->idx, a_side->entry.prefix );
+		}
+		a_side->restart = false;
+		a_side->path = a_side->path_buf.buf;
+		a_side->path_len = a_side->path_buf.len;
+	} else {
+		a_side->path = a_side->entry.file_name;
+		a_side->path_len = a_side->entry.file_name_len;
+	}
+
+	return 0;
+}
+
+
+// Whether the current entry of a_side is the first of an IEOT block, a_side->block being that block then.
+static bool diff_at_block( struct diff_side *a_side )
+{
+	uint32_t current = a_side->idx - 1;
+
+	while (a_side->block < a_side->block_count && a_side->block_first < current) {
+		a_side->block_first += a_side->blocks[a_side->block++].entry_count;
+	}
+
+	return !a_side->done && a_side->block < a_side->block_count && a_side->block_first == current;
+}
+
+
+// Bytes of the current block of a_side, see diff_at_block, stored in *a_data.
+static size_t diff_block( const struct diff_side *a_side, const uint8_t **a_data )
+{
+	size_t end = a_side->block + 1 < a_side->block_count ? a_side->blocks[a_side->block + 1].offset : a_side->entries_end;
+
+	*a_data = a_side->ctx->data + a_side->blocks[a_side->block].offset;
+
+	return end - a_side->blocks[a_side->block].offset;
+}
+
+
+// Moves a_side past its current block, see diff_at_block, to the entry following it.
+// Returns the result of diff_next.
+static int diff_skip_block( struct diff_side *a_side )
+{
+	const uint8_t *data;
+	size_t len = diff_block( a_side, &data );
+
+	a_side->ctx->file_pos = data + len - a_side->ctx->data;
+	a_side->idx = a_side->block_first + a_side->blocks[a_side->block].entry_count;
+	a_side->block_first = a_side->idx;
+	a_side->block++;
+	a_side->restart = true;
+
+	return diff_next( a_side );
+}
+
+
+static void print_diff_status( struct out *a_out, char a_status, const struct diff_side *a_side )
+{
+	out_char( a_out, a_status );
+	out_char( a_out, ' ' );
+	out_char( a_out, '0' + ((a_side->entry.flags >> 12) & 3) );
+}
+
+
+// Prints what differs between the entries of the same path and stage of two indexes.
+static void print_diff_changes( struct ctx *a_ctx, const struct diff_side *a_old, const struct diff_side *a_new )
+{
+	static const char *const names[] = { "oid", "mode", "flags", "ctime", "mtime", "dev", "ino", "uid", "gid", "size" };
+	const struct gi_entry *old = &a_old->entry;
+	const struct gi_entry *new = &a_new->entry;
+	// The extended bit and the name length of flags only depend on the version.
+	const bool changed[] = {
+		memcmp( old->oid, new->oid, a_ctx->hash->len ) != 0,
+		old->mode != new->mode,
+		(old->flags & 0x8000) != (new->flags & 0x8000) || old->extended_flags != new->extended_flags,
+		old->ctime != new->ctime || old->ctime_ns != new->ctime_ns,
+		old->mtime != new->mtime || old->mtime_ns != new->mtime_ns,
+		old->dev != new->dev,
+		old->ino != new->ino,
+		old->uid != new->uid,
+		old->gid != new->gid,
+		old->file_size != new->file_size,
+	};
+	struct out *out = a_ctx->out;
+	bool any = false;
+
+	for (size_t idx = 0; idx < sizeof( changed ) / sizeof( changed[0] ); idx++) {
+		if (!changed[idx]) continue;
+		if (!any) print_diff_status( out, 'M', a_new );
+		out_char( out, any ? ',' : ' ' );
+		out_str( out, names[idx] );
+		any = true;
+	}
+	if (any) {
+		out_char( out, '\t' );
+		out_mem( out, a_new->path, a_new->path_len );
+		out_char( out, '\n' );
+	}
+}
+
+
+// Prints the entries added to a_new since a_old (A), removed from it (D), or modified (M, followed by the
+// changed fields), one per line with their stage: "M 0 oid,mtime\tpath".
+// Both indexes are read once, side by side, as both are sorted by path then stage, so that only their current
+// entries are kept in memory; their versions don't matter. a_new must have its header read, and its entries
+// are consumed.
+// When both are mapped and have IEOT extensions, blocks starting at the same entry with the same bytes are skipped
+// without being decoded, so that comparing two versions of an index which was rewritten by git mostly costs what
+// changed.
+// Returns 0 on success, 1 if an index can't be read.
+int diff_indexes( struct ctx *a_old, struct ctx *a_new )
+{
+	assert( a_old );
+	assert( a_new );
+
+	struct out *out = a_new->out;
+	struct diff_side sides[2];
+	int result = 0;
+
+	for (int idx = 0; idx < 2; idx++) {
+		struct diff_side *side = &sides[idx];
+		side->ctx = idx ? a_new : a_old;
+		side->idx = 0;
+		side->done = false;
+		side->entry = (struct gi_entry) { .extended_flags = 0 };
+		side->path_buf = (struct path_buf) { .buf = NULL, .len = 0, .size = 0, .stats = side->ctx->stats };
+		side->mark = arena_get_mark( &side->ctx->arena );
+		side->blocks = NULL;
+		side->block_count = 0;
+		side->block = 0;
+		side->block_first = 0;
+		side->restart = false;
+		bool from_file = !side->ctx->entries && !side->ctx->cache_data && side->ctx->file_pos == 12;
+		if (from_file) side->block_count = read_ieot( side->ctx, &side->blocks, &side->entries_end );
+		if (!result) result = diff_next( side );
+	}
+	struct diff_side *old = &sides[0];
+	struct diff_side *new = &sides[1];
+	bool skip_blocks = old->block_count && new->block_count;
+
+	while (!result && !(old->done && new->done)) {
+		if (skip_blocks && diff_at_block( old ) && diff_at_block( new )) {
+			const uint8_t *old_data;
+			const uint8_t *new_data;
+			size_t len = diff_block( old, &old_data );
+			if (old->blocks[old->block].entry_count == new->blocks[new->block].entry_count && diff_block( new, &new_data ) == len && !memcmp( old_data, new_data, len )) {
+				result = diff_skip_block( old ) || diff_skip_block( new );
+				continue;
+			}
+		}
+
+		int cmp;
+		if (old->done) {
+			cmp = 1;
+		} else if (new->done) {
+			cmp = -1;
+		} else {
+			cmp = path_cmp( old->path, old->path_len, new->path, new->path_len );
+			if (!cmp) cmp = ((old->entry.flags >> 12) & 3) - ((new->entry.flags >> 12) & 3);
+		}
+
+		if (cmp) {
+			struct diff_side *side = cmp < 0 ? old : new;
+			print_diff_status( out, cmp < 0 ? 'D' : 'A', side );
+			out_char( out, '\t' );
+			out_mem( out, side->path, side->path_len );
+			out_char( out, '\n' );
+			result = diff_next( side );
+		} else {
+			print_diff_changes( a_new, old, new );
+			result = diff_next( old ) || diff_next( new );
+		}
+	}
+
+	for (int idx = 0; idx < 2; idx++) {
+		free( sides[idx].path_buf.buf );
+		free( sides[idx].blocks );
+		arena_reset( &sides[idx].ctx->arena, sides[idx].mark );
+	}
+
+	return result;
+}
+
+
+#if 0
+#pragma mark Watch mode
+#endif
+
+// Opens a_path with open_other_index for watch_index, and checks its checksum unless --no-verify, so that a
+// corrupt version is never compared.
+// Returns 0 on success, a_index being released otherwise.
+static int open_watched( struct ctx *a_index, const struct ctx *a_ctx, const char *a_path, const struct hash_algo *a_hash )
+{
+	unsigned char md[GI_HASH_MAX_LEN];
+
+	if (open_other_index( a_index, a_ctx, a_path, a_hash )) goto ow_fail;
+	if (!a_index->mapped) {
+		fprintf( stderr, "%s: --watch needs a regular file\n", a_path );
+		goto ow_fail;
+	}
+	finish_checksum( a_index, md );
+	size_t hash_len = a_index->hash->len;
+	if (a_index->verify && memcmp( md, a_index->data + a_index->data_len - hash_len, hash_len )) {
+		fprintf( stderr, "%s: hash checksum mismatch\n", a_path );
+		goto ow_fail;
+	}
+	a_index->file_pos = 12;
+	return 0;
+
+ow_fail:
+	release_index( a_index );
+	return 1;
+}
+
+
+// Prints the entries which change each time the index a_path is replaced by renaming a file over it, as git does,
+// in the format of diff_indexes. The previous version stays mapped, so that comparing it with the new one costs
+// what changed when both have IEOT extensions. Indexes rewritten in place aren't followed, as the previous version
+// would change under the comparison.
+// Runs until the index is deleted or its directory is moved.
+// Returns 1 if the index can't be read at first or watched, 0 otherwise.
+int watch_index( const struct ctx *a_ctx, const char *a_path )
+{
+	const char *slash = strrchr( a_path, '/' );
+	const char *name = slash ? slash + 1 : a_path;
+	char *dir = slash ? strndup( a_path, slash - a_path + 1 ) : NULL;
+	int fd = inotify_init1( IN_CLOEXEC );
+	struct ctx old;
+	struct ctx new;
+	int result = 1;
+
+	if (slash && !dir) {
+		perror( "strndup" );
+		goto wi_exit;
+	}
+	if (fd == -1) {
+		perror( "inotify_init1" );
+		goto wi_exit;
+	}
+	// Watched before the first version is read, so that no replacement is missed.
+	if (inotify_add_watch( fd, dir ? dir : ".", IN_MOVED_TO | IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF ) == -1) {
+		perror( dir ? dir : "." );
+		goto wi_exit;
+	}
+	if (open_watched( &old, a_ctx, a_path, a_ctx->hash )) goto wi_exit;
+	result = 0;
+
+	char events[4096] __attribute__(( aligned( __alignof__( struct inotify_event ) ) ));
+	bool gone = false;
+	while (!gone) {
+		ssize_t len = read( fd, events, sizeof( events ) );
+		if (len == -1) {
+			if (errno == EINTR) continue;
+			perror( "inotify" );
+			result = 1;
+			break;
+		}
+
+		bool replaced = false;
+		const struct inotify_event *event;
+		for (const char *ptr = events; ptr < events + len; ptr += sizeof( struct inotify_event ) + event->len) {
+			event = (const struct inotify_event *)ptr;
+			if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) gone = true;
+			else if (event->len && !strcmp( event->name, name )) {
+				if (event->mask & IN_DELETE) gone = true;
+				else replaced = true;
+			}
+		}
+		// A version which can't be read is reported and skipped, the next one being compared with the last good one.
+		if (!replaced || open_watched( &new, &old, a_path, old.hash )) continue;
+
+		old.file_pos = 12;
+		if (diff_indexes( &old, &new )) fprintf( stderr, "%s: can't compare with the previous version\n", a_path );
+		if (out_flush( a_ctx->out )) {
+			result = 1;
+			gone = true;
+		}
+		release_index( &old );
+		old = new;
+	}
+	release_index( &old );
+
+wi_exit:
+	if (fd != -1) close( fd );
+	free( dir );
+	return result;
+}
+
+
+#if 0
+#pragma mark Validation
+#endif
+
+// Prints a problem found by validate_index as a line of tab-separated fields: its code, its offset, the number of
+// its entry or "-", the signature of its extension or "-", and its message.
+static int print_problem( void *a_out, const struct gi_problem *a_problem )
+{
+	struct out *out = a_out;
+
+	out_str( out, gi_status_name( a_problem->status ) );
+	out_char( out, '\t' );
+	out_uint( out, a_problem->offset );
+	out_char( out, '\t' );
+	if (a_problem->entry != GI_NO_ENTRY) {
+		out_uint( out, a_problem->entry + 1 );
+	} else {
+		out_char( out, '-' );
+	}
+	out_char( out, '\t' );
+	out_str( out, a_problem->extension[0] ? a_problem->extension : "-" );
+	out_char( out, '\t' );
+	out_str( out, gi_strerror( a_problem->status ) );
+	out_char( out, '\n' );
+
+	return 0;
+}
+
+
+// Checks the structure of the index of a_ctx with gi_validate, and its checksum unless --no-verify, printing
+// nothing but the problems found. The checksum is computed on its own thread while the structure is walked.
+// Streams are read whole first.
+// Returns 0 if the index is valid, 1 otherwise.
+int validate_index( struct ctx *a_ctx )
+{
+	const size_t hash_len = a_ctx->hash->len;
+	struct gi_index index;
+	unsigned char md[GI_HASH_MAX_LEN];
+
+	if (!a_ctx->mapped) {
+		size_t len = a_ctx->buffer_size;
+		while (c_fill( a_ctx, len ) == len) len *= 2;
+	}
+	int status = gi_index_init( &index, a_ctx->data, a_ctx->data_len, hash_len );
+	if (status) {
+		struct gi_problem problem = { .status = status, .offset = 0, .entry = GI_NO_ENTRY, .extension = "" };
+		print_problem( a_ctx->out, &problem );
+		return 1;
+	}
+
+	start_checksum( a_ctx );
+	status = gi_validate( &index, print_problem, a_ctx->out );
+	a_ctx->file_pos = a_ctx->data_len - hash_len;
+	finish_checksum( a_ctx, md );
+	if (a_ctx->verify && memcmp( md, a_ctx->data + a_ctx->file_pos, hash_len )) {
+		struct gi_problem problem = { .status = GI_BAD_CHECKSUM, .offset = a_ctx->file_pos, .entry = GI_NO_ENTRY, .extension = "" };
+		print_problem( a_ctx->out, &problem );
+		status = GI_BAD_CHECKSUM;
+	}
+
+	return status != GI_OK;
+}
+
+
+#if 0
+#pragma mark Working tree check
+#endif
+
+// Entries checked by check_worktree at once, and handed to a thread at once
+#define WT_BATCH 65536
+#define WT_CHUNK 256
+
+// Stat data compared by check_worktree, bit n of wt_item.changed standing for g_wt_fields[n]. As with git's default
+// core.checkStat, the device isn't compared: it changes when the file system is mounted again.
+static const char *const g_wt_fields[] = { "mode", "ctime", "mtime", "ino", "uid", "gid", "size" };
+
+// Entry of a wt_batch
+struct wt_item {
+	struct gi_entry entry; // Its names aren't valid, see path
+	size_t path; // Offset of the path in wt_batch.paths
+	// 0 for a clean entry, otherwise the letter printed: M for changed stat data, D for a missing file, E for
+	// another lstat error, R for a racily clean entry, V and S for entries not checked because of their
+	// assume-valid and skip-worktree flags, and U for unmerged ones.
+	char status;
+	uint16_t changed;
+	int error; // errno of lstat
+};
+
+// Entries being checked against the working tree by the threads of check_worktree
+struct wt_batch {
+	int root_fd;
+	struct timespec index_mtime; // tv_sec is 0 when unknown
+	struct wt_item *items;
+	size_t count;
+	char *paths; // NUL-terminated
+	size_t paths_len;
+	size_t paths_size;
+	pthread_mutex_t lock; // Guards next
+	size_t next; // First item not handed to a thread yet
+};
+
+
+// Finds the working tree of the index file a_index: the parent of the .git directory holding it, or, for a linked
+// working tree (.git/worktrees/<name>/index), the directory of the .git file named by the gitdir file next to it.
+// Returns a path to free, or NULL if there is no working tree.
+char *find_worktree( const char *a_index )
+{
+	char *dir = realpath( a_index, NULL );
+	char *result = NULL;
+
+	if (!dir) {
+		perror( a_index );
+		return NULL;
+	}
+	char *slash = strrchr( dir, '/' );
+	*slash = 0;
+	slash = strrchr( dir, '/' );
+
+	if (slash && !strcmp( slash + 1, ".git" )) {
+		*slash = 0;
+		result = strdup( slash == dir ? "/" : dir );
+	} else {
+		size_t dir_len = strlen( dir );
+		char *gitdir_path = malloc( dir_len + sizeof( "/gitdir" ) );
+		FILE *gitdir = NULL;
+		char line[PATH_MAX];
+		if (gitdir_path) {
+			memcpy( gitdir_path, dir, dir_len );
+			strcpy( gitdir_path + dir_len, "/gitdir" );
+			gitdir = fopen( gitdir_path, "r" );
+		}
+		if (gitdir && fgets( line, sizeof( line ), gitdir )) {
+			// Path of the .git file of the working tree, relative to dir unless absolute
+			line[strcspn( line, "\n" )] = 0;
+			char *end = strrchr( line, '/' );
+			if (end) *end = 0;
+			if (!end) {
+				result = strdup( dir );
+			} else if (line[0] == '/') {
+				result = strdup( end == line ? "/" : line );
+			} else if ((result = malloc( dir_len + 1 + strlen( line ) + 1 ))) {
+				sprintf( result, "%s/%s", dir, line );
+			}
+		}
+		if (gitdir) fclose( gitdir );
+		free( gitdir_path );
+	}
+	if (!result) fprintf( stderr, "No working tree found for %s, see --worktree\n", a_index );
+
+	free( dir );
+
+	return result;
+}
+
+
+// The mode git would record for a file of mode a_mode, 0 if it can't be tracked.
+static uint32_t wt_mode( mode_t a_mode )
+{
+	if (S_ISLNK( a_mode )) return 0120000;
+	if (S_ISDIR( a_mode )) return 0160000;
+	if (S_ISREG( a_mode )) return a_mode & 0100 ? 0100755 : 0100644;
+
+	return 0;
+}
+
+
+static void wt_check_item( const struct wt_batch *a_batch, struct wt_item *a_item )
+{
+	const struct gi_entry *entry = &a_item->entry;
+	struct stat st;
+
+	if (a_item->status) return;
+
+	if (fstatat( a_batch->root_fd, a_batch->paths + a_item->path, &st, AT_SYMLINK_NOFOLLOW )) {
+		a_item->error = errno;
+		a_item->status = errno == ENOENT || errno == ENOTDIR ? 'D' : 'E';
+		return;
+	}
+
+	// Submodules are only expected to be directories, which replace any other file as far as git is concerned.
+	uint32_t mode = wt_mode( st.st_mode );
+	bool gitlink = (entry->mode & 0170000) == 0160000;
+	if (mode == 0160000 && !gitlink) {
+		a_item->status = 'D';
+		return;
+	}
+	const bool changed[] = {
+		mode != entry->mode,
+		!gitlink && ((uint32_t) entry->ctime != (uint32_t) st.st_ctim.tv_sec || (uint32_t) entry->ctime_ns != (uint32_t) st.st_ctim.tv_nsec),
+		!gitlink && ((uint32_t) entry->mtime != (uint32_t) st.st_mtim.tv_sec || (uint32_t) entry->mtime_ns != (uint32_t) st.st_mtim.tv_nsec),
+		!gitlink && entry->ino != (uint32_t) st.st_ino,
+		!gitlink && entry->uid != (uint32_t) st.st_uid,
+		!gitlink && entry->gid != (uint32_t) st.st_gid,
+		!gitlink && entry->file_size != (uint32_t) st.st_size,
+	};
+
+	a_item->changed = 0;
+	for (size_t idx = 0; idx < sizeof( changed ) / sizeof( changed[0] ); idx++) {
+		if (changed[idx]) a_item->changed |= 1 << idx;
+	}
+
+	if (a_item->changed) {
+		a_item->status = 'M';
+	} else if (!gitlink && a_batch->index_mtime.tv_sec) {
+		// As in git's is_racy_timestamp: the file may have changed within the same timestamp, after the index was
+		// written, so git has to compare its content.
+		uint32_t sec = a_batch->index_mtime.tv_sec;
+		uint32_t nsec = a_batch->index_mtime.tv_nsec;
+		if (sec < (uint32_t) entry->mtime || (sec == (uint32_t) entry->mtime && nsec <= (uint32_t) entry->mtime_ns)) {
+			a_item->status = 'R';
+		}
+	}
+}
+
+
+static void *wt_thread_main( void *a_batch )
+{
+	struct wt_batch *batch = a_batch;
+
+	for (;;) {
+		pthread_mutex_lock( &batch->lock );
+		size_t start = batch->next;
+		batch->next = batch->count - start > WT_CHUNK ? start + WT_CHUNK : batch->count;
+		size_t end = batch->next;
+		pthread_mutex_unlock( &batch->lock );
+
+		if (start == end) break;
+		for (size_t idx = start; idx < end; idx++) {
+			wt_check_item( batch, &batch->items[idx] );
+		}
+	}
+
+	return NULL;
+}
+
+
+// lstats the files of the entries of a_batch on up to a_threads threads, then prints those which aren't clean.
+static void wt_run_batch( struct ctx *a_ctx, struct wt_batch *a_batch, unsigned a_threads )
+{
+	struct out *out = a_ctx->out;
+	size_t job_count = (a_batch->count + WT_CHUNK - 1) / WT_CHUNK;
+	if (job_count > a_threads) job_count = a_threads;
+	pthread_t *thread_ids = job_count > 1 ? malloc( job_count * sizeof( pthread_t ) ) : NULL;
+	size_t started = 1;
+
+	a_batch->next = 0;
+	if (thread_ids) {
+		// The calling thread takes its share itself.
+		for (; started < job_count; started++) {
+			if (pthread_create( &thread_ids[started], NULL, wt_thread_main, a_batch )) break;
+		}
+	}
+	wt_thread_main( a_batch );
+	for (size_t idx = 1; idx < started; idx++) {
+		pthread_join( thread_ids[idx], NULL );
+	}
+	free( thread_ids );
+
+	for (size_t idx = 0; idx < a_batch->count; idx++) {
+		const struct wt_item *item = &a_batch->items[idx];
+		if (!item->status) continue;
+
+		out_char( out, item->status );
+		if (item->status == 'M') {
+			const char *sep = " ";
+			for (size_t field = 0; field < sizeof( g_wt_fields ) / sizeof( g_wt_fields[0] ); field++) {
+				if (!(item->changed & (1 << field))) continue;
+				out_str( out, sep );
+				out_str( out, g_wt_fields[field] );
+				sep = ",";
+			}
+		} else if (item->status == 'E') {
+			out_char( out, ' ' );
+			out_str( out, strerror( item->error ) );
+		} else if (item->status == 'U') {
+			out_char( out, ' ' );
+			out_char( out, '0' + ((item->entry.flags >> 12) & 3) );
+		}
+		out_char( out, '\t' );
+		out_str( out, a_batch->paths + item->path );
+		out_char( out, '\n' );
+	}
+}
+
+
+// Compares the stat data of the entries with the files of the working tree a_root, as git status does, and prints
+// the entries which don't match, one per line: "M mtime,size\tpath" (see wt_item.status for the other letters).
+// Entries are read a batch at a time, and their files are lstat-ed in parallel by a_ctx->threads threads, which
+// is what makes the difference on network file systems.
+// a_index_mtime is the modification time of the index, which tells racily clean entries, NULL if unknown.
+// Returns 0 on success, 1 if the index can't be read or the working tree opened.
+int check_worktree( struct ctx *a_ctx, const char *a_root, const struct timespec *a_index_mtime )
+{
+	assert( a_ctx );
+	assert( a_root );
+
+	struct wt_batch batch = { .root_fd = open( a_root, O_RDONLY | O_DIRECTORY ), .count = 0, .paths = NULL, .paths_len = 0, .paths_size = 0 };
+	struct path_buf path = { .buf = NULL, .len = 0, .size = 0, .stats = a_ctx->stats };
+	size_t batch_size = a_ctx->entry_count < WT_BATCH ? a_ctx->entry_count : WT_BATCH;
+	int result = 0;
+
+	if (batch.root_fd == -1) {
+		perror( a_root );
+		return 1;
+	}
+	batch.index_mtime.tv_sec = a_index_mtime ? a_index_mtime->tv_sec : 0;
+	batch.index_mtime.tv_nsec = a_index_mtime ? a_index_mtime->tv_nsec : 0;
+	batch.items = malloc( (batch_size ? batch_size : 1) * sizeof( struct wt_item ) );
+	if (!batch.items) {
+		perror( "malloc" );
+		close( batch.root_fd );
+		return 1;
+	}
+	pthread_mutex_init( &batch.lock, NULL );
+
+	for (uint32_t idx = 0; idx < a_ctx->entry_count && !result; idx++) {
+		struct wt_item *item = &batch.items[batch.count];
+		struct arena_mark mark = arena_get_mark( &a_ctx->arena );
+		const char *name;
+		size_t name_len;
+
+		item->entry.extended_flags = 0;
+		result = next_entry( a_ctx, idx, &item->entry );
+		if (result) break;
+		if (a_ctx->version >= 4) {
+			if (path_buf_apply( &path, item->entry.prefix, item->entry.file_name, item->entry.file_name_len )) {
+				fprintf( stderr, "Entry %u: prefix length %zu is invalid\n", idx+1, item->entry.prefix );
 			}
-			printf( "%s\n\t    ID: ", path_name );
+			name = path.buf;
+			name_len = path.len;
 		} else {
-			printf( "%s\n\t    ID: ", entry.file_name );
-		}
-		print_hex_string( 20, entry.sha1 );
-		printf( "\n\t  Size: %-*u %-*s ", col_width[0], entry.file_size, col_width[1] + 7, obj_type );
-		print_flags_long( entry.flags );
-		printf( "\n\tDevice: %-*s Inode: %-*s ", col_width[0], dev_str, col_width[1], ino_str );
-		print_extended_flags_long( entry.extended_flags );
-		printf( "\n\tAccess: (%04o/%c", entry.mode & 0x0FFF, objtype_c );
-		print_perm( (entry.mode >> 6) & 7 );
-		print_perm( (entry.mode >> 3) & 7 );
-		print_perm( entry.mode & 7 );
-		printf( ")   Uid: %-*s Gid: (%u/%s)\n", col_width[1], user_str, entry.gid, group ? group->gr_name : "" );
-		printf( "\tModify: %s\n", mtimestr );
-		printf( "\tChange: %s\n", ctimestr );
+			name = item->entry.file_name;
+			name_len = item->entry.file_name_len;
+		}
 
-		if (entry.mode & 0xFFFF0000) {
-			printf( "\tMode: 0x%08X\n", entry.mode );
+		if (batch.paths_len + name_len + 1 > batch.paths_size) {
+			size_t new_size = batch.paths_size ? batch.paths_size : 65536;
+			while (new_size < batch.paths_len + name_len + 1) new_size *= 2;
+			char *new_paths = realloc( batch.paths, new_size );
+			if (a_ctx->stats) a_ctx->stats->reallocs++;
+			if (!new_paths) {
+				perror( "realloc" );
+				result = 1;
+				break;
+			}
+			batch.paths = new_paths;
+			batch.paths_size = new_size;
 		}
-		if (a_ctx->version <= 3 && entry.file_name_len != (entry.flags & 0x0FFF)) {
-			printf("\tFilename length declared (%u) is different from the one computed (%zu)\n", entry.flags & 0x0FFF, entry.file_name_len );
-		} else if (a_ctx->version >= 4 && old_len - entry.prefix + entry.file_name_len != (entry.flags & 0x0FFF)) {
-			printf("\tFilename length declared (%u) is different from the one computed (%zu)\n", entry.flags & 0x0FFF, old_len - entry.prefix + entry.file_name_len );
+		memcpy( batch.paths + batch.paths_len, name, name_len );
+		batch.paths[batch.paths_len + name_len] = 0;
+		item->path = batch.paths_len;
+		batch.paths_len += name_len + 1;
+		arena_reset( &a_ctx->arena, mark );
+
+		// git doesn't look at these files.
+		if ((item->entry.flags >> 12) & 3) {
+			item->status = 'U';
+		} else if (item->entry.flags & 0x8000) {
+			item->status = 'V';
+		} else if (item->entry.extended_flags & 0x4000) {
+			item->status = 'S';
+		} else {
+			item->status = 0;
 		}
-		printf( "\n" );
 
-		free( entry.file_name );
-		free( user_str );
+		if (++batch.count == batch_size || idx + 1 == a_ctx->entry_count) {
+			wt_run_batch( a_ctx, &batch, a_ctx->threads );
+			batch.count = 0;
+			batch.paths_len = 0;
+		}
 	}
 
-	if (path_name) free( path_name );
+	pthread_mutex_destroy( &batch.lock );
+	close( batch.root_fd );
+	free( batch.items );
+	free( batch.paths );
+	free( path.buf );
 
 	return result;
 }
 
-int parse_index_ls( struct ctx * a_ctx )
+
+void init_constants()
 {
-	int result;
-	int idx;
-	struct entry * entries = malloc( a_ctx->entry_count * sizeof( struct entry ) );
-	struct entry * entry_p;
+	for (int idx = 0; idx < 256; idx++) {
+		g_hex_pairs[idx][0] = "0123456789ABCDEF"[idx >> 4];
+		g_hex_pairs[idx][1] = "0123456789ABCDEF"[idx & 15];
+		g_hex_lower_pairs[idx][0] = "0123456789abcdef"[idx >> 4];
+		g_hex_lower_pairs[idx][1] = "0123456789abcdef"[idx & 15];
+		g_json_escapes[idx] = idx < 0x20 ? 'u' : 0;
+	}
+	g_json_escapes['"'] = '"';
+	g_json_escapes['\\'] = '\\';
+	g_json_escapes['\b'] = 'b';
+	g_json_escapes['\f'] = 'f';
+	g_json_escapes['\n'] = 'n';
+	g_json_escapes['\r'] = 'r';
+	g_json_escapes['\t'] = 't';
+	for (int idx = 0; idx < 100; idx++) {
+		g_dec_pairs[idx][0] = '0' + idx / 10;
+		g_dec_pairs[idx][1] = '0' + idx % 10;
+	}
+}
 
-	struct passwd *user;
-	struct group *group;
-	char user_buffer[11];
-	char group_buffer[11];
-	const char *user_str;
-	const char *group_str;
 
-	int dev_width = 0;
-	int inode_width = 0;
-	int user_width = 0;
-	int group_width = 0;
-	int size_width = 0;
+// Reports to the standard error what was gathered in a_ctx->stats.
+void print_stats( struct ctx *a_ctx, uint32_t a_entry_count )
+{
+	const struct stats *stats = a_ctx->stats;
+	double total = stats_elapsed( &stats->start );
 
-	for (idx = 0; idx < a_ctx->entry_count; idx++) {
-		char buffer[11];
-		entry_p = &entries[idx];
-		result = parse_index_entry( a_ctx, entry_p );
+	fprintf( stderr, "Header: %.6f s\n", stats->header );
+	if (stats->load > 0) {
+		fprintf( stderr, "Entries decoded ahead: %.6f s\n", stats->load );
+	}
+	fprintf( stderr, "Entries decoded by the view: %.6f s\n", stats->decode );
+	fprintf( stderr, "View: %.6f s, decoding and output included\n", stats->view );
+	for (size_t idx = 0; idx < stats->extension_count; idx++) {
+		fprintf( stderr, "Extension %.4s: %.6f s, %u bytes\n", stats->extensions[idx].signature, stats->extensions[idx].seconds, stats->extensions[idx].len );
+	}
+	if (stats->checksum_thread > 0) {
+		fprintf( stderr, "Checksum: %.6f s on its own thread, %.6f s waited for\n", stats->checksum_thread, stats->checksum );
+	} else {
+		fprintf( stderr, "Checksum: %.6f s\n", stats->checksum );
+	}
+	fprintf( stderr, "Output: %.6f s\n", stats->output );
+	fprintf( stderr, "Total: %.6f s, %.1f MB/s, %.0f entries/s\n", total, a_ctx->file_pos / total / 1e6, a_entry_count / total );
+	fprintf( stderr, "Allocations: %lu from the arena, %lu arena chunks, %lu reallocs\n", stats->arena_allocs, stats->arena_chunks, stats->reallocs );
+	fprintf( stderr, "User names: %lu lookups, %lu cache hits\n", a_ctx->users->misses, a_ctx->users->hits );
+	fprintf( stderr, "Group names: %lu lookups, %lu cache hits\n", a_ctx->groups->misses, a_ctx->groups->hits );
+	fprintf( stderr, "Timestamps: %lu formatted, %lu cache hits, %lu localtime calls\n", a_ctx->times->misses, a_ctx->times->hits, a_ctx->times->localtime_calls );
+}
 
-		sprintf( buffer, "%u", entry_p->dev );
-		if (strlen( buffer ) > dev_width) dev_width = strlen( buffer );
 
-		sprintf( buffer, "%u", entry_p->ino );
-		if (strlen( buffer ) > inode_width) inode_width = strlen( buffer );
+// What print_extension needs from print_index.
+struct extension_walk {
+	struct ctx *ctx;
+	const struct options *options;
+	bool quiet; // Nothing but the answers of the view is printed
+	struct tree_index *tree_index; // Filled from the TREE extension for --cache-tree
+};
 
-		user = getpwuid( entry_p->uid );
-		if (user) {
-			user_str = user->pw_name;
-		} else {
-			sprintf( user_buffer, "%u", entry_p->uid );
-			user_str = user_buffer;
-		}
-		if (strlen( user_str ) > user_width) user_width = strlen( user_str );
 
-		group = getgrgid( entry_p->gid );
-		if (group) {
-			group_str = group->gr_name;
-		} else {
-			sprintf( group_buffer, "%u", entry_p->gid );
-			group_str = group_buffer;
+// Prints the extension a_signature of a_len bytes, whose content is at a_content in a mapped file, or at file_pos
+// of a stream when a_content is NULL. file_pos is then moved past it, as far as the printer reads.
+// Returns 0, going on with the following extensions, see gi_extension_cb.
+static int print_extension( void *a_walk, const char *a_signature, const uint8_t *a_content, uint32_t a_len )
+{
+	struct extension_walk *walk = a_walk;
+	struct ctx *ctx = walk->ctx;
+	const struct options *options = walk->options;
+	struct out *out = ctx->out;
+	struct timespec since;
+	uint32_t signature;
+
+	stats_start( ctx->stats, &since );
+	if (a_content) ctx->file_pos = a_content - ctx->data;
+	memcpy( &signature, a_signature, 4 );
+	long endpos = ctx->file_pos + a_len;
+	if (options->tree_query_count && signature == 0x45455254) { // TREE
+		walk_tree( ctx, endpos, false, walk->tree_index );
+	} else if (walk->quiet || options->spec_count) {
+		seek( ctx, a_len );
+	} else {
+		out_printf( out, "Extension %.4s, length %u, content starting at offset %zu (0x%zX):\n", a_signature, a_len, (size_t) ctx->file_pos, (size_t) ctx->file_pos );
+		switch (signature) {
+		case 0x45455254: // TREE
+			if (options->plain_tree) {
+				read_tree( ctx, endpos );
+			} else {
+				walk_tree( ctx, endpos, true, NULL );
+				out_char( out, '\n' );
+			}
+			break;
+		case 0x43554552: // REUC
+			read_resolve_undo( ctx, a_len );
+			break;
+		case 0x6B6E696C: // link
+			print_link( ctx, a_len );
+			break;
+		case 0x52544E55: // UNTR
+			read_untracked( ctx, a_len, options->untracked_tree );
+			break;
+		case 0x4E4D5346: // FSMN
+			print_fsmonitor( ctx, a_len );
+			break;
+		case 0x45494F45: // EOIE
+			out_str( out, "End of index entry, skipping\n" );
+			seek( ctx, a_len );
+			break;
+		case 0x544F4549: // IEOT
+			out_str( out, "Index entry offset table, skipping\n" );
+			seek( ctx, a_len );
+			break;
+		default:
+			out_str( out, "Unknown extension, skipping\n" );
+			seek( ctx, a_len );
 		}
-		if (strlen( group_str ) > group_width) group_width = strlen( group_str );
+	}
+
+	if (ctx->stats && ctx->stats->extension_count < STATS_EXTENSIONS) {
+		size_t idx = ctx->stats->extension_count++;
+		memcpy( ctx->stats->extensions[idx].signature, a_signature, 4 );
+		ctx->stats->extensions[idx].len = a_len;
+		ctx->stats->extensions[idx].seconds = stats_elapsed( &since );
+	}
+
+	return 0;
+}
 
-		sprintf( buffer, "%u", entry_p->file_size );
-		if (strlen( buffer ) > size_width) size_width = strlen( buffer );
+// Every extension of a mapped file goes to print_extension, which dispatches them as it does those of streams.
+static const struct gi_extension_callbacks g_extension_printers = {
+	.tree = print_extension,
+	.resolve_undo = print_extension,
+	.link = print_extension,
+	.untracked = print_extension,
+	.fsmonitor = print_extension,
+	.end_of_entries = print_extension,
+	.entry_offsets = print_extension,
+	.other = print_extension,
+};
+
+
+// Prints the index a_path, or the standard input if NULL, as a_options tell; a_ctx holds the rest of the setup
+// (output, caches, statistics, --no-verify…) and is left untouched.
+// Returns 1 if the index can't be read or its checksum doesn't match, 0 otherwise.
+int print_index( const struct options *a_options, const struct ctx *a_ctx, const char *a_path )
+{
+	struct ctx ctx = *a_ctx;
+	struct out *out = ctx.out;
+	struct tree_index tree_index;
+	struct bitmap fsmonitor_dirty = { .words = NULL };
+	struct ctx other;
+	bool other_open = false;
+	unsigned char md[GI_HASH_MAX_LEN];
+	int result = 1;
+
+	ctx.file_pos = 0;
+	ctx.data = NULL;
+	ctx.version = 0;
+	ctx.entry_count = 0;
+	ctx.entries = NULL;
+	ctx.entry_indexes = NULL;
+	ctx.extensions_pos = 0;
+	ctx.shared_slot = NULL;
+	ctx.merged = false;
+	ctx.cache_data = NULL;
+	ctx.fsmonitor_dirty = NULL;
+	tree_index_init( &tree_index, ctx.stats );
+
+	ctx.file = a_path ? fopen( a_path, "r" ) : stdin;
+	if (!ctx.file) {
+		perror( a_path );
+		goto pi_exit;
 	}
+	if (open_input( &ctx )) goto pi_exit;
 
-	char *path_name = NULL;
+	if (!ctx.hash) ctx.hash = detect_hash_algo( &ctx );
+	if (a_options->validate) {
+		result = validate_index( &ctx );
+		goto pi_exit;
+	}
+	if (a_options->diff_path) {
+		other_open = !open_other_index( &other, &ctx, a_options->diff_path, a_ctx->hash );
+		if (!other_open) goto pi_exit;
+	}
+	// The views of all the entries can take them from a cache, which was only written once the checksum matched.
+	enum view view = a_options->view;
+	bool all_entries = view != VIEW_DU && !a_options->spec_count && !a_options->tree_query_count && !a_options->diff_path && !a_options->check_wt;
+	char *cache_file = a_options->cache && all_entries && a_path ? cache_path( &ctx, a_path ) : NULL;
+	bool cached = cache_file && open_cache( &ctx, cache_file );
+	if (cached) ctx.verify = false;
+	start_checksum( &ctx );
+
+	struct timespec since;
+	stats_start( ctx.stats, &since );
+	if (parse_header( &ctx )) goto pi_exit;
+	if (ctx.stats) ctx.stats->header = stats_elapsed( &since );
+
+	stats_start( ctx.stats, &since );
+	if (cached && load_cached_entries( &ctx )) {
+		// Decoded from the index after all
+		cached = false;
+		ctx.verify = a_ctx->verify;
+		start_checksum( &ctx );
+	}
+	if (!cached && load_shared_index( &ctx, a_path, a_options->diff_path || a_options->check_wt )) goto pi_exit;
+	if (a_options->view == VIEW_LS) load_fsmonitor( &ctx, &fsmonitor_dirty );
+	uint32_t entry_count = ctx.entry_count;
 
-	for (idx = 0; idx < a_ctx->entry_count; idx++) {
-		entry_p = &entries[idx];
+	// These views print nothing but the entries or their summary, --cache-tree, --diff and --worktree nothing but
+	// their answers.
+	bool quiet = view == VIEW_FIELDS || view == VIEW_NDJSON || view == VIEW_BINARY || view == VIEW_SUMMARY || view == VIEW_DU || a_options->tree_query_count || a_options->diff_path || a_options->check_wt;
 
-		char ctimestr[37];
-		char mtimestr[37];
-		time2str( ctimestr, entry_p->ctime, entry_p->ctime_ns );
-		time2str( mtimestr, entry_p->mtime, entry_p->mtime_ns );
+	if (!quiet) {
+		out_printf( out, "git index version %u\n\nEntry count: %u\n\n", ctx.version, ctx.entry_count );
+	}
 
-		char objtype_c = '?';
-		switch ((entry_p->mode >> 12) & 0x0F) {
-		case 0x8: objtype_c = '-'; break;
-		case 0xA: objtype_c = 'l'; break;
-		case 0xE: objtype_c = 'g'; break;
+	if (a_options->spec_count) {
+		if (select_entries( &ctx, a_options->specs, a_options->spec_count )) goto pi_exit;
+	} else if (!ctx.entries && !cached && all_entries) {
+		load_entries_threaded( &ctx );
+		// The cache is written from all the entries.
+		if (cache_file && !ctx.entries) load_entries( &ctx );
+	}
+	size_t entries_end = ctx.file_pos;
+	if (ctx.stats && ctx.entries) ctx.stats->load = stats_elapsed( &since );
+
+	stats_start( ctx.stats, &since );
+	if (a_options->tree_query_count) {
+		if (skip_entries( &ctx )) goto pi_exit;
+	} else if (a_options->diff_path) {
+		bool failed = diff_indexes( &other, &ctx );
+		other_open = false;
+		if (close_other_index( &other, a_options->diff_path, !failed ) || failed) goto pi_exit;
+	} else if (a_options->check_wt) {
+		char *root = a_options->worktree ? NULL : find_worktree( a_path );
+		struct stat st;
+		bool index_mtime = fstat( fileno( ctx.file ), &st ) == 0 && S_ISREG( st.st_mode );
+		if (!a_options->worktree && !root) goto pi_exit;
+		bool failed = check_worktree( &ctx, a_options->worktree ? a_options->worktree : root, index_mtime ? &st.st_mtim : NULL );
+		free( root );
+		if (failed) goto pi_exit;
+	} else switch (view) {
+	case VIEW_STAT: parse_index_stat( &ctx ); break;
+	case VIEW_LS: parse_index_ls( &ctx ); break;
+	case VIEW_FIELDS: parse_index_fields( &ctx ); break;
+	case VIEW_NDJSON: parse_index_ndjson( &ctx ); break;
+	case VIEW_BINARY: parse_index_binary( &ctx ); break;
+	case VIEW_SUMMARY: parse_index_summary( &ctx ); break;
+	case VIEW_DU: parse_index_du( &ctx ); break;
+	}
+	if (ctx.stats) ctx.stats->view = stats_elapsed( &since );
+
+	// The file ends with the checksum, anything before it is an extension. Those of a mapped file are walked by
+	// libgitindex, those of a stream through the input window.
+	struct extension_walk walk = { .ctx = &ctx, .options = a_options, .quiet = quiet, .tree_index = &tree_index };
+	if (ctx.mapped && ctx.data_len >= ctx.file_pos + ctx.hash->len) {
+		struct gi_index index = index_view( &ctx );
+		int status = gi_walk_extensions( &index, ctx.file_pos, &g_extension_printers, &walk );
+		if (status) {
+			fprintf( stderr, "Reading extensions: %s\n", gi_strerror( status ) );
+			goto pi_exit;
+		}
+		ctx.file_pos = ctx.data_len - ctx.hash->len;
+	} else {
+		struct extension ext;
+		while (c_peek( &ctx, 8 + ctx.hash->len )) {
+			c_fread( &ext, 8, &ctx );
+			ext.len = ntohl( ext.len );
+			print_extension( &walk, ext.signature, NULL, ext.len );
 		}
+	}
 
-		user = getpwuid( entry_p->uid );
-		group = getgrgid( entry_p->gid );
-		if (user) {
-			user_str = user->pw_name;
+	for (size_t idx = 0; idx < a_options->tree_query_count; idx++) {
+		print_tree_query( &ctx, &tree_index, a_options->tree_queries[idx] );
+	}
+
+	finish_checksum( &ctx, md );
+
+	size_t hash_len = c_fill( &ctx, ctx.hash->len );
+	const uint8_t *hash = c_peek( &ctx, hash_len );
+	ctx.file_pos += hash_len;
+	bool checksum_failed = hash_len != ctx.hash->len || (ctx.verify && memcmp( hash, md, hash_len ));
+	if (hash_len != ctx.hash->len) {
+		fprintf( stderr, "%zu bytes read, %zu expected\n", hash_len, ctx.hash->len );
+	} else if (quiet) {
+		if (checksum_failed) fprintf( stderr, "Hash checksum mismatch\n" );
+	} else {
+		out_str( out, "Hash checksum: " );
+		out_hex( out, hash_len, hash );
+		if (!ctx.verify) {
+			out_str( out, cached ? " (verified when cached)\n" : " (not verified)\n" );
+		} else if (memcmp( hash, md, hash_len )) {
+			out_str( out, " (expected " );
+			out_hex( out, hash_len, md );
+			out_str( out, ")\n" );
 		} else {
-			sprintf( user_buffer, "%u", entry_p->uid );
-			user_str = user_buffer;
+			out_str( out, " ✓\n" );
 		}
-		if (group) {
-			group_str = group->gr_name;
-		} else {
-			sprintf( group_buffer, "%u", entry_p->gid );
-			group_str = group_buffer;
-		}
-
-		printf( "%*u/%*u ", dev_width, entry_p->dev, inode_width, entry_p->ino );
-		putchar( objtype_c );
-		print_perm( (entry_p->mode >> 6) & 7 );
-		print_perm( (entry_p->mode >> 3) & 7 );
-		print_perm( entry_p->mode & 7 );
-		putchar( ' ' );
-		print_flags( entry_p->flags );
-		if (a_ctx->version >= 3) {
-			putchar( ' ' );
-			print_extended_flags( entry_p->extended_flags );
-		}
-		printf( " %*s %-*s %*u %s %s ", user_width, user_str, group_width, group_str, size_width, entry_p->file_size, ctimestr, mtimestr );
-		print_hex_string( 20, entry_p->sha1 );
-		if (a_ctx->version >= 4) {
-			if (!path_name) {
-				assert( entry_p->prefix == 0 ); // Should be an error check, not an assert.
-				path_name = strdup( entry_p->file_name );
-			} else {
-				assert( entry_p->prefix <= strlen( path_name ) ); // Should be an error check, not an assert.
-				path_name = realloc( path_name, strlen( path_name ) - entry_p->prefix + strlen( entry_p->file_name ) + 1 );
-				path_name[strlen( path_name ) - entry_p->prefix] = 0;
-				strcat( path_name, entry_p->file_name );
+	}
+	result = checksum_failed;
+	if (cache_file && !cached && ctx.verify && !checksum_failed && ctx.entries) write_cache( &ctx, cache_file, entries_end );
+
+	if (ctx.stats) {
+		out_flush( out );
+		print_stats( &ctx, entry_count );
+	}
+
+pi_exit:
+	// The checksum thread reads the mapping until joined.
+	if (ctx.sha_threaded) finish_checksum( &ctx, md );
+	if (other_open) close_other_index( &other, a_options->diff_path, false );
+	tree_index_free( &tree_index );
+	free( ctx.entries );
+	free( ctx.entry_indexes );
+	free( fsmonitor_dirty.words );
+	release_shared_index( &ctx );
+	arena_free( &ctx.arena );
+	if (ctx.data) close_input( &ctx );
+	if (ctx.file && ctx.file != stdin) fclose( ctx.file );
+
+	return result;
+}
+
+
+#if 0
+#pragma mark Batch mode
+#endif
+
+// Index of a batch, printed into its own temporary file before being copied to the output in turn, see
+// BATCH_AHEAD
+struct batch_job {
+	const char *path;
+	FILE *output;
+	int result;
+	bool done;
+};
+
+// A thread of run_batch, which takes the jobs of its range from the front, and steals the back half of the range
+// of another worker once its own is empty.
+struct batch_worker {
+	struct batch *batch;
+	pthread_mutex_t lock; // Guards next and end
+	size_t next;
+	size_t end;
+	struct time_cache times;
+};
+
+// Jobs a worker may start past the one being copied to the output, by worker, so that the temporary files of
+// the jobs done but not copied yet don't run out of file descriptors.
+#define BATCH_AHEAD 2
+
+struct batch {
+	const struct options *options;
+	const struct ctx *ctx; // Setup of every index but its output and time cache
+	struct batch_job *jobs;
+	size_t job_count;
+	struct batch_worker *workers;
+	size_t worker_count;
+	pthread_mutex_t lock; // Guards the done flags of the jobs and copied
+	pthread_cond_t done; // Signaled when a job is done or copied
+	size_t copied; // Jobs copied to the output
+};
+
+
+// Returns the next job of a_worker, stolen from another worker if needed, or (-1) once there is none left.
+static ssize_t batch_take( struct batch_worker *a_worker )
+{
+	struct batch *batch = a_worker->batch;
+	ssize_t job = -1;
+
+	pthread_mutex_lock( &a_worker->lock );
+	if (a_worker->next < a_worker->end) job = a_worker->next++;
+	pthread_mutex_unlock( &a_worker->lock );
+
+	// Only one lock is held at a time, so that two workers stealing from each other can't deadlock.
+	size_t self = a_worker - batch->workers;
+	for (size_t idx = 1; job == -1 && idx < batch->worker_count; idx++) {
+		struct batch_worker *victim = &batch->workers[(self + idx) % batch->worker_count];
+		size_t next;
+		size_t end;
+
+		pthread_mutex_lock( &victim->lock );
+		next = victim->next + (victim->end - victim->next) / 2;
+		end = victim->end;
+		victim->end = next;
+		pthread_mutex_unlock( &victim->lock );
+
+		if (next < end) {
+			job = next;
+			pthread_mutex_lock( &a_worker->lock );
+			a_worker->next = next + 1;
+			a_worker->end = end;
+			pthread_mutex_unlock( &a_worker->lock );
+		}
+	}
+
+	return job;
+}
+
+
+// Prints job a_idx of the batch of a_worker into its temporary file.
+static void batch_run( struct batch_worker *a_worker, size_t a_idx )
+{
+	struct batch *batch = a_worker->batch;
+	struct batch_job *job = &batch->jobs[a_idx];
+	struct ctx ctx = *batch->ctx;
+	struct out out;
+	char *tag = NULL;
+
+	ctx.times = &a_worker->times;
+	job->result = 1;
+	job->output = tmpfile();
+	if (!job->output) {
+		perror( "tmpfile" );
+	} else if (!out_init( &out, fileno( job->output ) )) {
+		ctx.out = &out;
+		if (batch->options->view == VIEW_NDJSON) {
+			// "index":"<path>", built in a buffer large enough never to be flushed
+			struct out tag_out = { .fd = -1, .len = 0, .size = strlen( job->path ) * 6 + 16 };
+			tag_out.buf = malloc( tag_out.size );
+			if (tag_out.buf) {
+				OUT_LIT( &tag_out, "\"index\":\"" );
+				out_json_string( &tag_out, job->path, strlen( job->path ) );
+				OUT_LIT( &tag_out, "\"," );
+				tag_out.buf[tag_out.len] = 0;
+				tag = tag_out.buf;
 			}
-			printf( " %s\n", path_name );
-		} else {
-			printf( " %s\n", entry_p->file_name );
+			ctx.ndjson_tag = tag;
 		}
+		job->result = print_index( batch->options, &ctx, job->path ) | out_free( &out );
+		free( tag );
+	}
+
+	pthread_mutex_lock( &batch->lock );
+	job->done = true;
+	pthread_cond_broadcast( &batch->done );
+	pthread_mutex_unlock( &batch->lock );
+}
+
 
-		free( entry_p->file_name );
+// Jobs are started from the one being copied to the output on, up to BATCH_AHEAD jobs by worker past it. This can't
+// deadlock: the ranges of the workers being taken from the front, the first job not done is either being run, or
+// next in the range of a worker whose current job is done.
+static void *batch_worker_main( void *a_worker )
+{
+	struct batch_worker *worker = a_worker;
+	struct batch *batch = worker->batch;
+	ssize_t idx;
+
+	while ((idx = batch_take( worker )) != -1) {
+		pthread_mutex_lock( &batch->lock );
+		while ((size_t) idx >= batch->copied + BATCH_AHEAD * batch->worker_count) pthread_cond_wait( &batch->done, &batch->lock );
+		pthread_mutex_unlock( &batch->lock );
+
+		batch_run( worker, idx );
 	}
-	
-	putchar( '\n' );
 
-	free( entries );
-	free( path_name );
+	return NULL;
+}
 
-	return result;
+
+// Copies the temporary output of a_job to a_out.
+static void batch_copy_output( struct out *a_out, struct batch_job *a_job )
+{
+	char buf[65536];
+	ssize_t read_len;
+
+	if (!a_job->output) return;
+	if (lseek( fileno( a_job->output ), 0, SEEK_SET ) == -1) {
+		perror( "lseek" );
+		return;
+	}
+	while ((read_len = read( fileno( a_job->output ), buf, sizeof( buf ) )) > 0) {
+		out_mem( a_out, buf, read_len );
+	}
+	if (read_len == -1) perror( a_job->path );
 }
 
 
-int parse_header( struct ctx * a_ctx )
+// Prints each of the a_count indexes of a_paths as a_options and a_ctx tell, on a_ctx->threads threads sharing
+// the user and group caches, and the shared indexes of split indexes. Outputs are in the order of a_paths; each is preceded by a "==> path <==" line,
+// unless they are ndjson, each object of which then has an "index" member instead.
+// Returns 1 if any index can't be read, 0 otherwise.
+int run_batch( const struct options *a_options, const struct ctx *a_ctx, char **a_paths, size_t a_count )
 {
+	struct out *out = a_ctx->out;
+	struct ctx ctx = *a_ctx;
+	struct batch batch = { .options = a_options, .ctx = &ctx, .job_count = a_count, .copied = 0 };
+	pthread_mutex_t users_lock = PTHREAD_MUTEX_INITIALIZER;
+	pthread_mutex_t groups_lock = PTHREAD_MUTEX_INITIALIZER;
+	pthread_mutex_t shared_lock = PTHREAD_MUTEX_INITIALIZER;
 	int result = 0;
-	struct header header;
-	c_fread( &header, 12, a_ctx );
-	a_ctx->version = ntohl( header.version );
-	a_ctx->entry_count = ntohl( header.entry_count );
 
-	if (memcmp( header.signature, "DIRC", 4 )) {
-		fprintf( stderr, "Not a git index file.\n" );
-		result = 1;
-	} else {
-		printf( "git index version %u\n\nEntry count: %u\n\n", a_ctx->version, a_ctx->entry_count );
+	if (!a_count) return 0;
+
+	batch.worker_count = a_ctx->threads < a_count ? a_ctx->threads : a_count;
+	if (!batch.worker_count) batch.worker_count = 1;
+	batch.jobs = calloc( a_count, sizeof( struct batch_job ) );
+	batch.workers = calloc( batch.worker_count, sizeof( struct batch_worker ) );
+	pthread_t *thread_ids = calloc( batch.worker_count, sizeof( pthread_t ) );
+	if (!batch.jobs || !batch.workers || !thread_ids) {
+		perror( "calloc" );
+		free( batch.jobs );
+		free( batch.workers );
+		free( thread_ids );
+		return 1;
+	}
+
+	// Each index is read by a single thread.
+	ctx.threads = 1;
+	ctx.users->lock = &users_lock;
+	ctx.groups->lock = &groups_lock;
+	if (ctx.shared_cache) ctx.shared_cache->lock = &shared_lock;
+	pthread_mutex_init( &batch.lock, NULL );
+	pthread_cond_init( &batch.done, NULL );
+
+	for (size_t idx = 0; idx < a_count; idx++) {
+		batch.jobs[idx].path = a_paths[idx];
+	}
+	// Contiguous ranges of jobs, spread as evenly as possible.
+	size_t next = 0;
+	for (size_t idx = 0; idx < batch.worker_count; idx++) {
+		struct batch_worker *worker = &batch.workers[idx];
+		worker->batch = &batch;
+		pthread_mutex_init( &worker->lock, NULL );
+		worker->next = next;
+		next += (a_count - next) / (batch.worker_count - idx);
+		worker->end = next;
+		time_cache_init( &worker->times );
 	}
 
+	size_t started = 0;
+	for (; started < batch.worker_count; started++) {
+		if (pthread_create( &thread_ids[started], NULL, batch_worker_main, &batch.workers[started] )) break;
+	}
+	for (size_t idx = 0; idx < a_count; idx++) {
+		struct batch_job *job = &batch.jobs[idx];
+
+		// Without any thread, the jobs are run here, one at a time.
+		if (!started) batch_run( &batch.workers[0], idx );
+		pthread_mutex_lock( &batch.lock );
+		while (!job->done) pthread_cond_wait( &batch.done, &batch.lock );
+		pthread_mutex_unlock( &batch.lock );
+
+		if (a_options->view != VIEW_NDJSON) {
+			if (idx) out_char( out, '\n' );
+			OUT_LIT( out, "==> " );
+			out_str( out, job->path );
+			OUT_LIT( out, " <==\n" );
+		}
+		batch_copy_output( out, job );
+		if (job->output) fclose( job->output );
+		// print_index told why
+		if (job->result) result = 1;
+
+		pthread_mutex_lock( &batch.lock );
+		batch.copied = idx + 1;
+		pthread_cond_broadcast( &batch.done );
+		pthread_mutex_unlock( &batch.lock );
+	}
+
+	for (size_t idx = 0; idx < started; idx++) {
+		pthread_join( thread_ids[idx], NULL );
+	}
+	for (size_t idx = 0; idx < batch.worker_count; idx++) {
+		pthread_mutex_destroy( &batch.workers[idx].lock );
+	}
+	pthread_cond_destroy( &batch.done );
+	pthread_mutex_destroy( &batch.lock );
+	ctx.users->lock = NULL;
+	ctx.groups->lock = NULL;
+	if (ctx.shared_cache) ctx.shared_cache->lock = NULL;
+	free( thread_ids );
+	free( batch.workers );
+	free( batch.jobs );
+
 	return result;
 }
 
 
-void init_constants()
+// Reads the paths of a batch from a_file, one per line.
+// Returns their count, *a_paths being the array of them, or (-1) on error.
+ssize_t read_batch_paths( FILE *a_file, char ***a_paths )
 {
-	size_t pow7 = 0x80;
-	ssize_t max_val = SSIZE_MAX;
+	char **paths = NULL;
+	size_t count = 0;
+	size_t size = 0;
+	char *line = NULL;
+	size_t line_size = 0;
+	ssize_t len;
+
+	while ((len = getline( &line, &line_size, a_file )) != -1) {
+		if (len && line[len - 1] == '\n') line[--len] = 0;
+		if (!len) continue;
+		if (count == size) {
+			size = size ? size * 2 : 64;
+			char **new_paths = realloc( paths, size * sizeof( char * ) );
+			if (!new_paths) {
+				perror( "realloc" );
+				break;
+			}
+			paths = new_paths;
+		}
+		paths[count] = strdup( line );
+		if (!paths[count]) break;
+		count++;
+	}
+	free( line );
+	if (ferror( a_file ) || len != -1) {
+		while (count) free( paths[--count] );
+		free( paths );
+		return -1;
+	}
+	*a_paths = paths;
+
+	return count;
+}
+
 
-//	printf( "SSIZE_MAX = %zd (0x%zX), max_len = %zu, ", max_val, max_val, g_max_offset_delta_len );
+#if 0
+#pragma mark Repository discovery
+#endif
+
+// Paths of the indexes to print, see expand_paths.
+struct path_list {
+	char **paths;
+	size_t count;
+	size_t size;
+};
 
-	do {
-		max_val -= pow7;
-		pow7<<=7;
-	} while (pow7 && pow7 < max_val);
 
-	g_max_offset_delta = max_val;
+// Appends a_path, which is taken over, to a_list, freeing it if that fails.
+// Returns 0 on success.
+static int path_list_add( struct path_list *a_list, char *a_path )
+{
+	if (a_path && a_list->count == a_list->size) {
+		size_t new_size = a_list->size ? a_list->size * 2 : 16;
+		char **new_paths = realloc( a_list->paths, new_size * sizeof( char * ) );
+		if (!new_paths) {
+			free( a_path );
+			a_path = NULL;
+		} else {
+			a_list->paths = new_paths;
+			a_list->size = new_size;
+		}
+	}
+	if (!a_path) {
+		perror( "Listing the indexes" );
+		return 1;
+	}
+	a_list->paths[a_list->count++] = a_path;
 
-//	printf( "max_val = %zd (0x%zX)\n", max_val, max_val );
+	return 0;
 }
 
 
-int main( int argc, char * argv[] )
+// Returns a_dir/a_name, to free, or NULL if it can't be allocated.
+static char *path_join( const char *a_dir, const char *a_name )
 {
-	struct ctx ctx = { .file = NULL, .file_pos = 0, .version = 0, .entry_count = 0 };
-	int result;
+	size_t dir_len = strlen( a_dir );
+	char *path = malloc( dir_len + 1 + strlen( a_name ) + 1 );
+
+	if (path) {
+		memcpy( path, a_dir, dir_len );
+		path[dir_len] = '/';
+		strcpy( path + dir_len + 1, a_name );
+	}
+
+	return path;
+}
 
-	if (argc < 2) {
-		ctx.file = stdin;
+
+// The git directory of a_dir: its .git directory, the directory named by its .git file as in a linked working
+// tree, or else a_dir itself.
+// Returns a path to free, or NULL if it can't be allocated.
+static char *find_git_dir( const char *a_dir )
+{
+	char *dot_git = path_join( a_dir, ".git" );
+	struct stat st;
+
+	if (!dot_git || stat( dot_git, &st )) {
+		free( dot_git );
+		return strdup( a_dir );
+	}
+	if (S_ISDIR( st.st_mode )) return dot_git;
+
+	// "gitdir: <path>", relative to a_dir unless absolute
+	FILE *file = fopen( dot_git, "r" );
+	char line[PATH_MAX];
+	char *result = NULL;
+	if (file && fgets( line, sizeof( line ), file ) && !strncmp( line, "gitdir: ", 8 )) {
+		line[strcspn( line, "\n" )] = 0;
+		result = line[8] == '/' ? strdup( line + 8 ) : path_join( a_dir, line + 8 );
+	}
+	if (file) fclose( file );
+	free( dot_git );
+
+	return result ? result : strdup( a_dir );
+}
+
+
+// Adds to a_list the indexes of the repository or git directory a_dir, see find_git_dir: the index of the git
+// directory, then those of its linked working trees, worktrees/<name>/index, in the order of their names.
+// Their shared indexes, next to them, are found by load_shared_index.
+// Returns 0 on success, 1 if there is no index or on error, which is reported.
+static int find_indexes( const char *a_dir, struct path_list *a_list )
+{
+	char *git_dir = find_git_dir( a_dir );
+	char *path = git_dir ? path_join( git_dir, "index" ) : NULL;
+	char *worktrees = git_dir ? path_join( git_dir, "worktrees" ) : NULL;
+	size_t count = a_list->count;
+	int result = !worktrees;
+
+	if (!worktrees) perror( "malloc" );
+	if (path && access( path, F_OK ) == 0) {
+		result = path_list_add( a_list, path );
 	} else {
-		ctx.file = fopen( argv[1], "r" );
-		if (!ctx.file) {
-			perror( "Opening file" );
-			return 1;
+		free( path );
+	}
+
+	struct dirent **names = NULL;
+	int name_count = worktrees ? scandir( worktrees, &names, NULL, alphasort ) : -1;
+	for (int idx = 0; idx < name_count; idx++) {
+		if (!result && names[idx]->d_name[0] != '.') {
+			char *dir = path_join( worktrees, names[idx]->d_name );
+			path = dir ? path_join( dir, "index" ) : NULL;
+			free( dir );
+			if (path && access( path, F_OK ) == 0) {
+				result = path_list_add( a_list, path );
+			} else {
+				free( path );
+			}
 		}
+		free( names[idx] );
 	}
+	free( names );
 
-	init_constants();
-	SHA1_Init( &ctx.sha_ctx );
+	if (!result && a_list->count == count) {
+		fprintf( stderr, "%s: no index found\n", a_dir );
+		result = 1;
+	}
+	free( worktrees );
+	free( git_dir );
+
+	return result;
+}
 
-	result = parse_header( &ctx );
-	if (result) return 1;
 
-#if LS_ENTRIES
-	parse_index_ls( &ctx );
-#else
-	parse_index_stat( &ctx );
+// Lists the a_count paths of a_args, replacing the directories among them by their indexes, see find_indexes.
+// An index file named several times is listed once.
+// Returns the number of paths, *a_paths being the array of them, each to free, or (-1) on error. *a_expanded is
+// set if there was a directory.
+ssize_t expand_paths( char **a_args, size_t a_count, char ***a_paths, bool *a_expanded )
+{
+	struct path_list list = { .paths = NULL, .count = 0, .size = 0 };
+	int result = 0;
+
+	*a_expanded = false;
+	for (size_t idx = 0; idx < a_count && !result; idx++) {
+		struct stat st;
+		if (stat( a_args[idx], &st ) == 0 && S_ISDIR( st.st_mode )) {
+			*a_expanded = true;
+			result = find_indexes( a_args[idx], &list );
+		} else {
+			result = path_list_add( &list, strdup( a_args[idx] ) );
+		}
+	}
+	struct stat *seen = result ? NULL : malloc( (list.count ? list.count : 1) * sizeof( struct stat ) );
+	if (!result && !seen) {
+		perror( "malloc" );
+		result = 1;
+	}
+	if (result) {
+		for (size_t idx = 0; idx < list.count; idx++) free( list.paths[idx] );
+		free( list.paths );
+		return -1;
+	}
+
+	// Indexes named several times, such as those of a repository and of its .git directory
+	size_t kept = 0;
+	size_t seen_count = 0;
+	for (size_t idx = 0; idx < list.count; idx++) {
+		struct stat st;
+		bool known = false;
+		if (stat( list.paths[idx], &st ) == 0) {
+			for (size_t other = 0; other < seen_count && !known; other++) {
+				known = seen[other].st_dev == st.st_dev && seen[other].st_ino == st.st_ino;
+			}
+			if (!known) seen[seen_count++] = st;
+		}
+		if (known) {
+			free( list.paths[idx] );
+		} else {
+			list.paths[kept++] = list.paths[idx];
+		}
+	}
+	free( seen );
+	*a_paths = list.paths;
+
+	return kept;
+}
+
+
+#if 0
+#pragma mark Main
 #endif
 
-	struct extension ext;
+void usage( const char *a_name )
+{
+	fprintf( stderr, "Usage: %s [options] [index file or git directory...]\n", a_name );
+	fprintf( stderr, "Reads the index from the standard input when no file is given. A repository or git directory stands for\n" );
+	fprintf( stderr, "its index and those of its linked working trees.\n" );
+	fprintf( stderr, "\t--stat\t\tPrint entries like stat(1) does (default)\n" );
+	fprintf( stderr, "\t--ls\t\tPrint entries like ls -l does\n" );
+	fprintf( stderr, "\t--fields=<list>\tPrint only the listed entry fields, tab-separated, and nothing else\n" );
+	fprintf( stderr, "\t\t\t(path, oid, mode, stage, flags, size, ctime, mtime, dev, ino, uid, gid, user, group)\n" );
+	fprintf( stderr, "\t--ndjson\tPrint each entry as a JSON object on its own line, and nothing else\n" );
+	fprintf( stderr, "\t--binary\tPrint the entries as fixed-size little-endian records, and nothing else\n" );
+	fprintf( stderr, "\t--summary\tPrint only the number of entries by mode, stage and flag, their total size and extreme mtimes\n" );
+	fprintf( stderr, "\t--du[=<depth>]\tPrint only the number of entries and total size of each directory down to that depth,\n" );
+	fprintf( stderr, "\t\t\tand whether its cache tree is valid\n" );
+	fprintf( stderr, "\t--path=<path>\tPrint only the entries of that path, or below it, and no extension (repeatable)\n" );
+	fprintf( stderr, "\t--plain-tree\tPrint the TREE extension as a list rather than as a tree\n" );
+	fprintf( stderr, "\t--untracked-tree\tPrint the directories of the UNTR extension, not only its summary\n" );
+	fprintf( stderr, "\t--diff=<index>\tPrint only the entries added, removed or modified since that index\n" );
+	fprintf( stderr, "\t--worktree[=<dir>]\tPrint only the entries whose stat data doesn't match the working tree\n" );
+	fprintf( stderr, "\t\t\t(the one of the index by default), their files being checked by --threads threads\n" );
+	fprintf( stderr, "\t--cache-tree=<dir>\tPrint only whether the TREE extension has a valid tree for that directory (repeatable)\n" );
+	fprintf( stderr, "\t--object-format=<sha1|sha256>\n" );
+	fprintf( stderr, "\t\t\tObject format of the repository, guessed from the index by default\n" );
+	fprintf( stderr, "\t--no-verify\tDon't check the trailing checksum\n" );
+	fprintf( stderr, "\t--threads=<n>\tNumber of threads decoding entries when the index has an IEOT extension (default: one per CPU)\n" );
+	fprintf( stderr, "\t--ls-widths=<dev>,<inode>,<user>,<group>,<size>\n" );
+	fprintf( stderr, "\t\t\tFixed column widths of the ls view, which then never keeps entries in memory\n" );
+	fprintf( stderr, "\t--stats\t\tPrint statistics to the standard error when done\n" );
+	fprintf( stderr, "\t--batch\t\tPrint each of the index files, or those listed on the standard input, on --threads threads\n" );
+	fprintf( stderr, "\t--cache\t\tTake the entries from <index>.gpi-cache when it matches the index, and write it otherwise\n" );
+	fprintf( stderr, "\t--watch\t\tPrint the entries which change each time git replaces the index, until it is deleted\n" );
+	fprintf( stderr, "\t--validate\tCheck the structure and the checksum, printing nothing but the problems found\n" );
+}
 
-	while (8 == fread( &ext, 1, 8, ctx.file )) { // Can't use c_fread here as we might be reading the final SHA-1.
-		ctx.file_pos += 8;
-		ext.len = ntohl( ext.len );
-		long endpos = ctx.file_pos + ext.len;
-		switch (*((uint32_t*)ext.signature)) {
-		case 0x45455254: // TREE
-			printf( "Extension %.4s, length %u, content starting at offset %lu (0x%lX):\n", ext.signature, ext.len, ctx.file_pos, ctx.file_pos );
-			ext.len = ntohl( ext.len ); // Reverses the byte-swap
-			SHA1_Update( &ctx.sha_ctx, &ext, 8 );
+
+int main( int argc, char * argv[] )
+{
+	struct ctx ctx = { .file = NULL, .file_pos = 0, .verify = true, .version = 0, .entry_count = 0, .entries = NULL, .entry_indexes = NULL, .ls_widths = NULL, .fields = NULL, .stats = NULL, .hash = NULL, .fsmonitor_dirty = NULL };
+	int result;
+
+	static const struct option options[] = {
+		{ "no-verify", no_argument, NULL, 'V' },
+		{ "threads", required_argument, NULL, 'j' },
+		{ "stats", no_argument, NULL, 'S' },
+		{ "ls-widths", required_argument, NULL, 'W' },
+		{ "stat", no_argument, NULL, 's' },
+		{ "ls", no_argument, NULL, 'l' },
+		{ "fields", required_argument, NULL, 'F' },
+		{ "ndjson", no_argument, NULL, 'J' },
+		{ "binary", no_argument, NULL, 'B' },
+		{ "summary", no_argument, NULL, 'Y' },
+		{ "du", optional_argument, NULL, 'u' },
+		{ "plain-tree", no_argument, NULL, 'P' },
+		{ "pretty-tree", no_argument, NULL, 'T' },
+		{ "untracked-tree", no_argument, NULL, 'U' },
+		{ "path", required_argument, NULL, 'p' },
+		{ "cache-tree", required_argument, NULL, 'C' },
+		{ "diff", required_argument, NULL, 'D' },
+		{ "worktree", optional_argument, NULL, 'w' },
+		{ "object-format", required_argument, NULL, 'O' },
+		{ "batch", no_argument, NULL, 'b' },
+		{ "cache", no_argument, NULL, 'K' },
+		{ "watch", no_argument, NULL, 'X' },
+		{ "validate", no_argument, NULL, 'A' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	int opt;
+	long cpus = sysconf( _SC_NPROCESSORS_ONLN );
+	bool stats = false;
+	struct stats run_stats;
+	struct options opts = { .specs = NULL, .spec_count = 0, .tree_queries = NULL, .tree_query_count = 0, .diff_path = NULL, .check_wt = false, .worktree = NULL, .batch = false, .cache = false, .watch = false, .validate = false };
+	struct name_cache users;
+	struct name_cache groups;
+	struct time_cache times;
+	struct ls_widths ls_widths;
+	struct shared_cache shared_indexes;
+	struct out out;
+	// The compile-time options only set the defaults.
+#if LS_ENTRIES
+	opts.view = VIEW_LS;
+#else
+	opts.view = VIEW_STAT;
+#endif
 #if PLAIN_TREE
-			read_tree( &ctx, endpos );
+	opts.plain_tree = true;
 #else
-			while (ctx.file_pos < endpos ) {
-				pretty_read_tree( &ctx, endpos, 0, true, "" );
-			}
-			printf( "\n" );
+	opts.plain_tree = false;
 #endif
+	opts.untracked_tree = false;
+
+	ctx.threads = cpus > 0 ? cpus : 1;
+
+	while ((opt = getopt_long( argc, argv, "hj:", options, NULL )) != -1) {
+		switch (opt) {
+		case 'V': ctx.verify = false; break;
+		case 'j': ctx.threads = strtoul( optarg, NULL, 10 ); break;
+		case 'S': stats = true; break;
+		case 'W':
+			if (sscanf( optarg, "%d,%d,%d,%d,%d", &ls_widths.dev, &ls_widths.inode, &ls_widths.user, &ls_widths.group, &ls_widths.size ) != 5) {
+				fprintf( stderr, "Invalid column widths '%s'\n", optarg );
+				return 1;
+			}
+			ctx.ls_widths = &ls_widths;
 			break;
-		case 0x43554552: // REUC
-			printf( "Extension %.4s, length %u, content starting at offset %lu (0x%lX):\n", ext.signature, ext.len, ctx.file_pos, ctx.file_pos );
-			printf( "Resolve undo, skipping\n" );
-			seek( &ctx, ext.len );
+		case 's': opts.view = VIEW_STAT; break;
+		case 'l': opts.view = VIEW_LS; break;
+		case 'F':
+			free( ctx.fields );
+			ctx.field_count = parse_field_list( optarg, &ctx.fields );
+			if (!ctx.field_count) return 1;
+			opts.view = VIEW_FIELDS;
 			break;
-		case 0x6B6E696C: // link
-			printf( "Extension %.4s, length %u, content starting at offset %lu (0x%lX):\n", ext.signature, ext.len, ctx.file_pos, ctx.file_pos );
-			printf( "Split index, skipping\n" );
-			seek( &ctx, ext.len );
+		case 'J': opts.view = VIEW_NDJSON; break;
+		case 'B': opts.view = VIEW_BINARY; break;
+		case 'Y': opts.view = VIEW_SUMMARY; break;
+		case 'u':
+			opts.view = VIEW_DU;
+			ctx.du_depth = optarg ? strtoul( optarg, NULL, 10 ) : UINT_MAX;
 			break;
-		case 0x52544E55: // UNTR
-			printf( "Extension %.4s, length %u, content starting at offset %lu (0x%lX):\n", ext.signature, ext.len, ctx.file_pos, ctx.file_pos );
-			printf( "Untracked cache, skipping\n" );
-			seek( &ctx, ext.len );
+		case 'P': opts.plain_tree = true; break;
+		case 'T': opts.plain_tree = false; break;
+		case 'U': opts.untracked_tree = true; break;
+		case 'p': {
+			char **new_specs = realloc( opts.specs, (opts.spec_count + 1) * sizeof( char * ) );
+			if (!new_specs) {
+				perror( "realloc" );
+				return 1;
+			}
+			opts.specs = new_specs;
+			opts.specs[opts.spec_count++] = optarg;
 			break;
-		case 0x4E4D5346: // FSMN
-			printf( "Extension %.4s, length %u, content starting at offset %lu (0x%lX):\n", ext.signature, ext.len, ctx.file_pos, ctx.file_pos );
-			printf( "File system monitor cache, skipping\n" );
-			seek( &ctx, ext.len );
+		}
+		case 'D': opts.diff_path = optarg; break;
+		case 'w':
+			opts.check_wt = true;
+			opts.worktree = optarg;
 			break;
-		case 0x45494F45: // EOIE
-			printf( "Extension %.4s, length %u, content starting at offset %lu (0x%lX):\n", ext.signature, ext.len, ctx.file_pos, ctx.file_pos );
-			printf( "End of index entry, skipping\n" );
-			seek( &ctx, ext.len );
+		case 'C': {
+			char **new_queries = realloc( opts.tree_queries, (opts.tree_query_count + 1) * sizeof( char * ) );
+			if (!new_queries) {
+				perror( "realloc" );
+				return 1;
+			}
+			opts.tree_queries = new_queries;
+			opts.tree_queries[opts.tree_query_count++] = optarg;
 			break;
-		case 0x544F4549: // IEOT
-			printf( "Extension %.4s, length %u, content starting at offset %lu (0x%lX):\n", ext.signature, ext.len, ctx.file_pos, ctx.file_pos );
-			printf( "Index entry offset table, skipping\n" );
-			seek( &ctx, ext.len );
+		}
+		case 'O':
+			ctx.hash = find_hash_algo( optarg );
+			if (!ctx.hash) {
+				fprintf( stderr, "Unknown object format '%s'\n", optarg );
+				return 1;
+			}
 			break;
-		default: {
-				// Assume hash
-				unsigned char md[20];
-				SHA1_Final( md, &ctx.sha_ctx );
-
-				char hash[20];
-				ext.len = htonl( ext.len ); // Reverses the byte-swap
-				memcpy( hash, &ext, 8 );
-				result = fread( &hash[8], 1, 12, ctx.file );
-				ctx.file_pos += result;
-				if (result != 12) {
-					fprintf( stderr, "%d bytes read, 12 expected\n", result );
-				}
-				printf( "Hash checksum: " );
-				print_hex_string( 20, hash );
-				if (memcmp( hash, md, 20)) {
-					printf( " (expected " );
-					print_hex_string( 20, md );
-					printf( ")\n" );
-				} else {
-					printf( " ✓\n" );
-				}
+		case 'b': opts.batch = true; break;
+		case 'K': opts.cache = true; break;
+		case 'X': opts.watch = true; break;
+		case 'A': opts.validate = true; break;
+		case 'h': usage( argv[0] ); return 0;
+		default: usage( argv[0] ); return 1;
+		}
+	}
+
+	if ((opts.spec_count != 0) + (opts.tree_query_count != 0) + (opts.diff_path != NULL) + opts.check_wt + opts.watch + opts.validate > 1) {
+		fprintf( stderr, "--path, --cache-tree, --diff, --worktree, --watch and --validate can't be combined\n" );
+		return 1;
+	}
+	// Repositories and git directories stand for their indexes, which are printed as a batch when there are several.
+	char **paths = NULL;
+	bool expanded = false;
+	ssize_t path_count = optind < argc ? expand_paths( argv + optind, argc - optind, &paths, &expanded ) : 0;
+	if (path_count == -1) return 1;
+	if (expanded && path_count > 1) opts.batch = true;
+	if (opts.watch && (opts.batch || path_count != 1)) {
+		fprintf( stderr, "--watch needs a single index file\n" );
+		return 1;
+	}
+	if (opts.check_wt && !opts.worktree && optind >= argc && !opts.batch) {
+		fprintf( stderr, "--worktree needs a directory when the index is read from the standard input\n" );
+		return 1;
+	}
+	// Neither can tell which index they are about.
+	if (opts.batch && (stats || opts.view == VIEW_BINARY)) {
+		fprintf( stderr, "--batch and git directories can't be combined with --stats or --binary\n" );
+		return 1;
+	}
+
+	if (stats) {
+		memset( &run_stats, 0, sizeof( run_stats ) );
+		clock_gettime( CLOCK_MONOTONIC, &run_stats.start );
+		ctx.stats = &run_stats;
+		ctx.arena.stats = &run_stats;
+	}
+
+	if (out_init( &out, STDOUT_FILENO )) return 1;
+	out.stats = ctx.stats;
+	ctx.out = &out;
+
+	name_cache_init( &users, resolve_user );
+	name_cache_init( &groups, resolve_group );
+	ctx.users = &users;
+	ctx.groups = &groups;
+	time_cache_init( &times );
+	ctx.times = &times;
+	shared_cache_init( &shared_indexes );
+	ctx.shared_cache = &shared_indexes;
+
+	init_constants();
+
+	if (opts.watch) {
+		result = watch_index( &ctx, paths[0] );
+	} else if (!opts.batch) {
+		result = print_index( &opts, &ctx, path_count ? paths[0] : NULL );
+	} else if (path_count) {
+		result = run_batch( &opts, &ctx, paths, path_count );
+	} else {
+		char **paths;
+		ssize_t count = read_batch_paths( stdin, &paths );
+		if (count == -1) {
+			perror( "Reading paths" );
+			result = 1;
+		} else {
+			result = run_batch( &opts, &ctx, paths, count );
+			for (ssize_t idx = 0; idx < count; idx++) {
+				free( paths[idx] );
 			}
+			free( paths );
 		}
-	};
+	}
 
-	return 0;
+	name_cache_free( &users );
+	name_cache_free( &groups );
+	shared_cache_free( &shared_indexes );
+	for (ssize_t idx = 0; idx < path_count; idx++) {
+		free( paths[idx] );
+	}
+	free( paths );
+	free( opts.specs );
+	free( opts.tree_queries );
+	free( ctx.fields );
+
+	return out_free( &out ) || result;
 }
@@ -0,0 +1,746 @@
+#include <arpa/inet.h>
+#include <assert.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "gitindex.h"
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <immintrin.h>
+#elif defined( __ARM_NEON )
+#include <arm_neon.h>
+#endif
+
+// The loader resolves the stat data decoder once, from CPUID, where GNU indirect functions are supported.
+#if (defined( __x86_64__ ) || defined( __i386__ )) && defined( __GNUC__ ) && defined( __ELF__ ) && defined( __GLIBC__ )
+#define STAT_DATA_IFUNC 1
+#else
+#define STAT_DATA_IFUNC 0
+#endif
+
+
+#if 0
+#pragma mark Header
+#endif
+
+const char *gi_strerror( int a_status )
+{
+	switch (a_status) {
+	case GI_OK: return "Success";
+	case GI_END: return "No more entries";
+	case GI_TRUNCATED: return "Unexpected end of file";
+	case GI_BAD_SIGNATURE: return "Not a git index file";
+	case GI_BAD_VERSION: return "Unsupported index version";
+	case GI_BAD_ENTRY: return "Invalid index entry";
+	case GI_OVERFLOW: return "Encoded offset overflow";
+	case GI_PATH_TOO_LONG: return "Path too long";
+	case GI_BAD_EXTENSION: return "Invalid extension";
+	case GI_BAD_FLAGS: return "Extended flag in a version 2 entry";
+	case GI_BAD_NAME_LENGTH: return "Name length of the flags doesn't match the path";
+	case GI_BAD_PADDING: return "Padding isn't NUL";
+	case GI_BAD_PREFIX: return "Prefix longer than the previous path";
+	case GI_BAD_TREE: return "Invalid TREE extension";
+	case GI_BAD_CHECKSUM: return "Hash checksum mismatch";
+	default: return "Unknown error";
+	}
+}
+
+
+const char *gi_status_name( int a_status )
+{
+	switch (a_status) {
+	case GI_OK: return "ok";
+	case GI_END: return "end";
+	case GI_TRUNCATED: return "truncated";
+	case GI_BAD_SIGNATURE: return "bad-signature";
+	case GI_BAD_VERSION: return "bad-version";
+	case GI_BAD_ENTRY: return "bad-entry";
+	case GI_OVERFLOW: return "overflow";
+	case GI_PATH_TOO_LONG: return "path-too-long";
+	case GI_BAD_EXTENSION: return "bad-extension";
+	case GI_BAD_FLAGS: return "bad-flags";
+	case GI_BAD_NAME_LENGTH: return "bad-name-length";
+	case GI_BAD_PADDING: return "bad-padding";
+	case GI_BAD_PREFIX: return "bad-prefix";
+	case GI_BAD_TREE: return "bad-tree";
+	case GI_BAD_CHECKSUM: return "bad-checksum";
+	default: return "unknown";
+	}
+}
+
+
+int gi_parse_header( const uint8_t *a_data, size_t a_len, struct gi_header *a_header )
+{
+	uint32_t u32;
+
+	if (a_len < 12) return GI_TRUNCATED;
+	if (memcmp( a_data, "DIRC", 4 )) return GI_BAD_SIGNATURE;
+	memcpy( &u32, a_data + 4, 4 );
+	a_header->version = ntohl( u32 );
+	memcpy( &u32, a_data + 8, 4 );
+	a_header->entry_count = ntohl( u32 );
+
+	return GI_OK;
+}
+
+
+// Whether the first entry of an index of a_version, at the start of a_data, is well-formed with a_hash_len-byte object ids.
+static bool first_entry_fits( const uint8_t *a_data, size_t a_len, uint32_t a_version, size_t a_hash_len )
+{
+	size_t pos = 12 + 40 + a_hash_len;
+
+	if (pos + 2 > a_len) return false;
+	uint16_t flags = (a_data[pos] << 8) | a_data[pos + 1];
+	pos += 2;
+	if (flags & 0x4000) {
+		if (a_version < 3) return false;
+		pos += 2;
+	}
+	if (a_version >= 4) {
+		// Nothing to strip from the previous path
+		if (pos >= a_len || a_data[pos]) return false;
+		pos++;
+	}
+
+	size_t name_len = flags & 0xFFF;
+	// Empty in split indexes, for the entries replacing those of the shared index
+	if (pos + name_len >= a_len) return false;
+	if (name_len == 0xFFF) {
+		const uint8_t *nul = memchr( a_data + pos + name_len, '\0', a_len - pos - name_len );
+		if (!nul) return false;
+		name_len = nul - (a_data + pos);
+	}
+	if (memchr( a_data + pos, '\0', name_len ) || a_data[pos + name_len]) return false;
+
+	// NUL padding, as in gi_decode_entry
+	for (size_t end = pos + name_len + 1; a_version < 4 && end % 8 != 4 && end < a_len; end++) {
+		if (a_data[end]) return false;
+	}
+
+	return true;
+}
+
+
+// Whether the extensions of an index without entries end where a a_hash_len-byte checksum starts.
+static bool extensions_fit( const uint8_t *a_data, size_t a_len, size_t a_hash_len )
+{
+	size_t pos = 12;
+	uint32_t ext_len;
+
+	if (a_len < pos + a_hash_len) return false;
+	while (pos + 8 <= a_len - a_hash_len) {
+		memcpy( &ext_len, a_data + pos + 4, 4 );
+		pos += 8 + (size_t) ntohl( ext_len );
+	}
+
+	return pos == a_len - a_hash_len;
+}
+
+
+size_t gi_detect_hash_len( const uint8_t *a_data, size_t a_len, bool a_complete )
+{
+	static const size_t hash_lens[] = { GI_SHA1_LEN, GI_SHA256_LEN };
+	struct gi_header header;
+
+	if (gi_parse_header( a_data, a_len, &header )) return GI_SHA1_LEN;
+
+	for (size_t idx = 0; idx < sizeof( hash_lens ) / sizeof( hash_lens[0] ); idx++) {
+		bool fits;
+		if (header.entry_count) {
+			fits = first_entry_fits( a_data, a_len, header.version, hash_lens[idx] );
+		} else {
+			fits = a_complete && extensions_fit( a_data, a_len, hash_lens[idx] );
+		}
+		if (fits) return hash_lens[idx];
+	}
+
+	return GI_SHA1_LEN;
+}
+
+
+int gi_index_init( struct gi_index *a_index, const void *a_data, size_t a_len, size_t a_hash_len )
+{
+	assert( a_index );
+
+	struct gi_header header;
+	int result = gi_parse_header( a_data, a_len, &header );
+
+	if (result) return result;
+	if (header.version < 2 || header.version > 4) return GI_BAD_VERSION;
+	if (!a_hash_len) a_hash_len = gi_detect_hash_len( a_data, a_len, true );
+	if (a_len < 12 + a_hash_len) return GI_TRUNCATED;
+
+	a_index->data = a_data;
+	a_index->len = a_len;
+	a_index->hash_len = a_hash_len;
+	a_index->version = header.version;
+	a_index->entry_count = header.entry_count;
+
+	return GI_OK;
+}
+
+
+const uint8_t *gi_index_checksum( const struct gi_index *a_index )
+{
+	return a_index->data + a_index->len - a_index->hash_len;
+}
+
+
+#if 0
+#pragma mark Entries
+#endif
+
+// Implementation according to:
+//	https://kernel.org/pub/software/scm/git/docs/technical/pack-format.txt
+// (see OFS_DELTA, offset encoding).
+ssize_t gi_decode_varint( const uint8_t *a_ptr, size_t a_len, size_t *a_used )
+{
+	assert( a_used );
+
+	size_t idx = 0;
+	size_t offset;
+	uint8_t byte;
+	bool overflow = false;
+
+	*a_used = 0;
+	if (!a_len) return -1;
+
+	byte = a_ptr[idx++];
+	offset = byte & 0x7F;
+	while (byte & 0x80) {
+		if (idx == a_len) return -1;
+		byte = a_ptr[idx++];
+		// Each continuation byte adds 2^(7n), which is where the +1 comes from.
+		if (offset + 1 > (SSIZE_MAX >> 7)) overflow = true;
+		offset = ((offset + 1) << 7) | (byte & 0x7F);
+	}
+
+	*a_used = idx;
+
+	return overflow ? -2 : (ssize_t) offset;
+}
+
+
+// The stat data is decoded in place of the ten fields, which must follow each other.
+_Static_assert( offsetof( struct gi_entry, file_size ) - offsetof( struct gi_entry, ctime ) == 36, "stat data fields aren't contiguous" );
+
+static void decode_stat_data_scalar( const uint8_t *a_fixed, struct gi_entry *a_entry )
+{
+	uint32_t stat_data[10];
+
+	memcpy( stat_data, a_fixed, 40 );
+	a_entry->ctime = ntohl( stat_data[0] );
+	a_entry->ctime_ns = ntohl( stat_data[1] );
+	a_entry->mtime = ntohl( stat_data[2] );
+	a_entry->mtime_ns = ntohl( stat_data[3] );
+	a_entry->dev = ntohl( stat_data[4] );
+	a_entry->ino = ntohl( stat_data[5] );
+	a_entry->mode = ntohl( stat_data[6] );
+	a_entry->uid = ntohl( stat_data[7] );
+	a_entry->gid = ntohl( stat_data[8] );
+	a_entry->file_size = ntohl( stat_data[9] );
+}
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+
+// Reverses the bytes of each 32-bit word.
+#define BSWAP32_SHUFFLE 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12
+
+// Two 16-byte shuffles, then one of the last 8 bytes
+__attribute__(( target( "ssse3" ) ))
+static void decode_stat_data_ssse3( const uint8_t *a_fixed, struct gi_entry *a_entry )
+{
+	const __m128i shuffle = _mm_setr_epi8( BSWAP32_SHUFFLE );
+	__m128i *dest = (__m128i *) &a_entry->ctime;
+
+	_mm_storeu_si128( dest, _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *) a_fixed ), shuffle ) );
+	_mm_storeu_si128( dest + 1, _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *) (a_fixed + 16) ), shuffle ) );
+	_mm_storel_epi64( dest + 2, _mm_shuffle_epi8( _mm_loadl_epi64( (const __m128i *) (a_fixed + 32) ), shuffle ) );
+}
+
+// One 32-byte shuffle, which works within each 16-byte lane, then one of the last 8 bytes
+__attribute__(( target( "avx2" ) ))
+static void decode_stat_data_avx2( const uint8_t *a_fixed, struct gi_entry *a_entry )
+{
+	const __m256i shuffle = _mm256_setr_epi8( BSWAP32_SHUFFLE, BSWAP32_SHUFFLE );
+	__m256i *dest = (__m256i *) &a_entry->ctime;
+
+	_mm256_storeu_si256( dest, _mm256_shuffle_epi8( _mm256_loadu_si256( (const __m256i *) a_fixed ), shuffle ) );
+	_mm_storel_epi64( (__m128i *) (dest + 1), _mm_shuffle_epi8( _mm_loadl_epi64( (const __m128i *) (a_fixed + 32) ), _mm256_castsi256_si128( shuffle ) ) );
+}
+
+#elif defined( __ARM_NEON )
+
+static void decode_stat_data_neon( const uint8_t *a_fixed, struct gi_entry *a_entry )
+{
+	uint8_t *dest = (uint8_t *) &a_entry->ctime;
+
+	vst1q_u8( dest, vrev32q_u8( vld1q_u8( a_fixed ) ) );
+	vst1q_u8( dest + 16, vrev32q_u8( vld1q_u8( a_fixed + 16 ) ) );
+	vst1_u8( dest + 32, vrev32_u8( vld1_u8( a_fixed + 32 ) ) );
+}
+
+#endif
+
+#if STAT_DATA_IFUNC
+
+typedef void (*decode_stat_data_fn)( const uint8_t *a_fixed, struct gi_entry *a_entry );
+
+// Called by the loader, before constructors and sanitizer runtimes are set up: __builtin_cpu_init has to be called
+// first, and nothing can be instrumented.
+__attribute__(( no_sanitize( "address", "thread", "undefined" ) ))
+static decode_stat_data_fn resolve_decode_stat_data( void )
+{
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports( "avx2" )) return decode_stat_data_avx2;
+	if (__builtin_cpu_supports( "ssse3" )) return decode_stat_data_ssse3;
+
+	return decode_stat_data_scalar;
+}
+
+void gi_decode_stat_data( const uint8_t *a_fixed, struct gi_entry *a_entry ) __attribute__(( ifunc( "resolve_decode_stat_data" ) ));
+
+#else
+
+void gi_decode_stat_data( const uint8_t *a_fixed, struct gi_entry *a_entry )
+{
+#if defined( __AVX2__ )
+	decode_stat_data_avx2( a_fixed, a_entry );
+#elif defined( __SSSE3__ )
+	decode_stat_data_ssse3( a_fixed, a_entry );
+#elif defined( __ARM_NEON )
+	decode_stat_data_neon( a_fixed, a_entry );
+#else
+	decode_stat_data_scalar( a_fixed, a_entry );
+#endif
+}
+
+#endif
+
+
+// Decodes what follows the flags of an entry, at a_pos, a_entry->flags being set. See gi_decode_entry.
+static inline int decode_entry_name( const struct gi_index *a_index, size_t a_pos, struct gi_entry *a_entry, size_t *a_next )
+{
+	const uint8_t *data = a_index->data;
+	// The entries can't overlap the checksum.
+	const size_t end = a_index->len - a_index->hash_len;
+	size_t pos = a_pos;
+
+	if (a_index->version >= 3 && (a_entry->flags & 0x4000)) {
+		if (pos + 2 > end) return GI_TRUNCATED;
+		a_entry->extended_flags = (data[pos] << 8) | data[pos + 1];
+		pos += 2;
+	} else {
+		a_entry->extended_flags = 0;
+	}
+
+	a_entry->prefix = 0;
+	if (a_index->version >= 4) {
+		size_t used;
+		ssize_t prefix = gi_decode_varint( data + pos, end - pos, &used );
+		if (prefix == -1) return GI_TRUNCATED;
+		if (prefix == -2) return GI_OVERFLOW;
+		a_entry->prefix = prefix;
+		pos += used;
+	}
+
+	const uint8_t *nul = memchr( data + pos, '\0', end - pos );
+	if (!nul) return GI_TRUNCATED;
+	a_entry->file_name = (const char *) data + pos;
+	a_entry->file_name_len = nul - (data + pos);
+	pos += a_entry->file_name_len + 1;
+
+	// v2 and v3 entries are NUL-padded to a multiple of 8 bytes, the header being 12 bytes long.
+	a_entry->pad_bytes = (const char *) data + pos;
+	a_entry->pad_bytes_len = a_index->version < 4 && pos % 8 != 4 ? 8 - ((pos - 4) % 8) : 0;
+	if (pos + a_entry->pad_bytes_len > end) return GI_TRUNCATED;
+	*a_next = pos + a_entry->pad_bytes_len;
+
+	return GI_OK;
+}
+
+
+int gi_decode_entry( const struct gi_index *a_index, size_t a_offset, struct gi_entry *a_entry, size_t *a_next )
+{
+	size_t pos = a_offset + 40 + a_index->hash_len + 2;
+
+	if (a_index->len < a_index->hash_len || pos > a_index->len - a_index->hash_len) return GI_TRUNCATED;
+	gi_decode_stat( a_index->data + a_offset, a_index->hash_len, a_entry );
+
+	return decode_entry_name( a_index, pos, a_entry, a_next );
+}
+
+
+size_t gi_skip_entry( const struct gi_index *a_index, size_t a_offset )
+{
+	const uint8_t *data = a_index->data;
+	size_t data_len = a_index->len < a_index->hash_len ? 0 : a_index->len - a_index->hash_len;
+	size_t flags_pos = 40 + a_index->hash_len;
+
+	if (a_offset + flags_pos + 2 > data_len) return 0;
+
+	uint16_t flags = (data[a_offset + flags_pos] << 8) | data[a_offset + flags_pos + 1];
+	size_t name_pos = a_offset + flags_pos + 2 + (a_index->version >= 3 && (flags & 0x4000) ? 2 : 0);
+	size_t name_len = flags & 0xFFF;
+	if (a_index->version >= 4) {
+		// The prefix length, then the NUL-terminated rest of the path, without padding
+		size_t used;
+		if (name_pos >= data_len || gi_decode_varint( data + name_pos, data_len - name_pos, &used ) < 0) return 0;
+		name_pos += used;
+		const uint8_t *nul = name_pos < data_len ? memchr( data + name_pos, '\0', data_len - name_pos ) : NULL;
+		return nul ? (size_t) (nul - data) + 1 : 0;
+	}
+	if (name_len == 0xFFF || name_pos + name_len >= data_len || data[name_pos + name_len]) {
+		const uint8_t *nul = name_pos < data_len ? memchr( data + name_pos, '\0', data_len - name_pos ) : NULL;
+		if (!nul) return 0;
+		name_len = nul - (data + name_pos);
+	}
+
+	// Same padding as gi_decode_entry
+	size_t offset = name_pos + name_len + 1;
+	if (offset % 8 != 4) offset += 8 - ((offset - 4) % 8);
+
+	return offset;
+}
+
+
+void gi_iter_init( struct gi_iter *a_iter, const struct gi_index *a_index, char *a_buf, size_t a_buf_size )
+{
+	a_iter->index = a_index;
+	a_iter->pos = 12;
+	a_iter->next = 0;
+	a_iter->path = NULL;
+	a_iter->path_len = 0;
+	a_iter->buf = a_buf;
+	a_iter->buf_size = a_buf_size;
+}
+
+
+void gi_iter_set_buf( struct gi_iter *a_iter, char *a_buf, size_t a_buf_size )
+{
+	if (a_iter->path == a_iter->buf) a_iter->path = a_buf;
+	a_iter->buf = a_buf;
+	a_iter->buf_size = a_buf_size;
+}
+
+
+int gi_iter_next( struct gi_iter *a_iter, struct gi_entry *a_entry )
+{
+	assert( a_iter );
+
+	size_t next;
+
+	if (a_iter->next >= a_iter->index->entry_count) return GI_END;
+
+	int result = gi_decode_entry( a_iter->index, a_iter->pos, a_entry, &next );
+	if (result) return result;
+
+	if (a_iter->index->version < 4) {
+		a_iter->path = a_entry->file_name;
+		a_iter->path_len = a_entry->file_name_len;
+	} else {
+		// The buffer still holds the previous path.
+		if (a_entry->prefix > a_iter->path_len) return GI_BAD_ENTRY;
+		size_t kept = a_iter->path_len - a_entry->prefix;
+		if (kept + a_entry->file_name_len >= a_iter->buf_size) return GI_PATH_TOO_LONG;
+		memcpy( a_iter->buf + kept, a_entry->file_name, a_entry->file_name_len + 1 );
+		a_iter->path = a_iter->buf;
+		a_iter->path_len = kept + a_entry->file_name_len;
+	}
+	a_iter->pos = next;
+	a_iter->next++;
+
+	return GI_OK;
+}
+
+
+#if 0
+#pragma mark Extensions
+#endif
+
+bool gi_find_extension( const struct gi_index *a_index, size_t a_offset, const char *a_signature, const uint8_t **a_content, uint32_t *a_len )
+{
+	const size_t end = a_index->len - a_index->hash_len;
+	uint32_t u32;
+
+	*a_content = NULL;
+	if (a_index->len < a_index->hash_len) return false;
+	while (a_offset + 8 <= end) {
+		memcpy( &u32, a_index->data + a_offset + 4, 4 );
+		u32 = ntohl( u32 );
+		if (u32 > end - a_offset - 8) return false;
+		if (a_signature && !memcmp( a_index->data + a_offset, a_signature, 4 )) {
+			*a_content = a_index->data + a_offset + 8;
+			*a_len = u32;
+			return true;
+		}
+		a_offset += 8 + u32;
+	}
+
+	return a_offset == end;
+}
+
+
+size_t gi_extensions_pos( const struct gi_index *a_index )
+{
+	const size_t hash_len = a_index->hash_len;
+	const size_t eoie_len = 8 + 4 + hash_len;
+	const uint8_t *content;
+	uint32_t len;
+	uint32_t u32;
+	size_t offset = 0;
+
+	if (a_index->len >= 12 + eoie_len + hash_len) {
+		const uint8_t *eoie = a_index->data + a_index->len - hash_len - eoie_len;
+		memcpy( &u32, eoie + 4, 4 );
+		if (!memcmp( eoie, "EOIE", 4 ) && ntohl( u32 ) == eoie_len - 8) {
+			memcpy( &u32, eoie + 8, 4 );
+			offset = ntohl( u32 );
+			if (offset < 12 || !gi_find_extension( a_index, offset, NULL, &content, &len )) offset = 0;
+		}
+	}
+	if (!offset) {
+		offset = 12;
+		for (uint32_t idx = 0; idx < a_index->entry_count && offset; idx++) offset = gi_skip_entry( a_index, offset );
+		if (offset && !gi_find_extension( a_index, offset, NULL, &content, &len )) offset = 0;
+	}
+
+	return offset;
+}
+
+
+int gi_walk_extensions( const struct gi_index *a_index, size_t a_offset, const struct gi_extension_callbacks *a_callbacks, void *a_data )
+{
+	const size_t end = a_index->len - a_index->hash_len;
+	uint32_t signature;
+	uint32_t len;
+
+	if (a_index->len < a_index->hash_len) return GI_TRUNCATED;
+
+	while (a_offset + 8 <= end) {
+		memcpy( &signature, a_index->data + a_offset, 4 );
+		memcpy( &len, a_index->data + a_offset + 4, 4 );
+		len = ntohl( len );
+		if (len > end - a_offset - 8) return GI_BAD_EXTENSION;
+
+		gi_extension_cb callback;
+		switch (signature) {
+		case 0x45455254: callback = a_callbacks->tree; break; // TREE
+		case 0x43554552: callback = a_callbacks->resolve_undo; break; // REUC
+		case 0x6B6E696C: callback = a_callbacks->link; break; // link
+		case 0x52544E55: callback = a_callbacks->untracked; break; // UNTR
+		case 0x4E4D5346: callback = a_callbacks->fsmonitor; break; // FSMN
+		case 0x45494F45: callback = a_callbacks->end_of_entries; break; // EOIE
+		case 0x544F4549: callback = a_callbacks->entry_offsets; break; // IEOT
+		default: callback = a_callbacks->other;
+		}
+		if (callback) {
+			int result = callback( a_data, (const char *) a_index->data + a_offset, a_index->data + a_offset + 8, len );
+			if (result) return result;
+		}
+		a_offset += 8 + len;
+	}
+
+	return a_offset == end ? GI_OK : GI_BAD_EXTENSION;
+}
+
+
+// Parses a count of a TREE entry: an optional '-', at most 10 digits, then a_terminator.
+// Returns the position following a_terminator, or NULL if there is no such count before a_end.
+static const char *parse_tree_count( const char *a_ptr, const char *a_end, char a_terminator, long *a_value )
+{
+	bool negative = a_ptr < a_end && *a_ptr == '-';
+	const char *digits = a_ptr + negative;
+	long value = 0;
+
+	for (a_ptr = digits; a_ptr < a_end && *a_ptr >= '0' && *a_ptr <= '9' && a_ptr - digits < 10; a_ptr++) {
+		value = value * 10 + (*a_ptr - '0');
+	}
+	if (a_ptr == digits || a_ptr >= a_end || *a_ptr != a_terminator) return NULL;
+	*a_value = negative ? -value : value;
+
+	return a_ptr + 1;
+}
+
+
+int gi_parse_tree_entry( const char *a_ptr, const char *a_end, size_t a_hash_len, struct gi_tree *a_tree, const char **a_next )
+{
+	const char *nul = memchr( a_ptr, '\0', a_end - a_ptr );
+	long entry_count;
+	long subtrees;
+
+	if (!nul) return GI_TRUNCATED;
+	const char *ptr = parse_tree_count( nul + 1, a_end, ' ', &entry_count );
+	if (ptr) ptr = parse_tree_count( ptr, a_end, '\n', &subtrees );
+	if (!ptr || subtrees < 0) return GI_BAD_EXTENSION;
+	if (entry_count >= 0) {
+		if ((size_t) (a_end - ptr) < a_hash_len) return GI_TRUNCATED;
+		memcpy( a_tree->oid, ptr, a_hash_len );
+		ptr += a_hash_len;
+	}
+
+	a_tree->path = a_ptr;
+	a_tree->path_len = nul - a_ptr;
+	a_tree->entry_count = entry_count;
+	a_tree->subtrees = subtrees;
+	*a_next = ptr;
+
+	return GI_OK;
+}
+
+
+#if 0
+#pragma mark Validation
+#endif
+
+struct validation {
+	const struct gi_index *index;
+	gi_problem_cb callback;
+	void *data;
+	int first; // Status of the first problem
+};
+
+
+// Reports a problem to the callback of a_validation, a_extension being a signature or NULL.
+// Returns non-zero if the validation must stop.
+static int report( struct validation *a_validation, int a_status, size_t a_offset, uint32_t a_entry, const void *a_extension )
+{
+	struct gi_problem problem = { .status = a_status, .offset = a_offset, .entry = a_entry, .extension = "" };
+
+	if (a_extension) memcpy( problem.extension, a_extension, 4 );
+	if (!a_validation->first) a_validation->first = a_status;
+
+	return !a_validation->callback || a_validation->callback( a_validation->data, &problem );
+}
+
+
+// Checks the entries, storing the offset following them in *a_end.
+// Returns non-zero if the validation must stop.
+static int validate_entries( struct validation *a_validation, size_t *a_end )
+{
+	const struct gi_index *index = a_validation->index;
+	struct gi_entry entry;
+	size_t pos = 12;
+	size_t path_len = 0;
+
+	// Each entry holds at least its fixed part and the NUL ending its path, padded or preceded by a prefix.
+	size_t min_len = 40 + index->hash_len + 2 + 1;
+	min_len = index->version < 4 ? (min_len + 7) & ~(size_t) 7 : min_len + 1;
+	if ((uint64_t) index->entry_count * min_len > index->len - 12 - index->hash_len) {
+		report( a_validation, GI_TRUNCATED, 8, GI_NO_ENTRY, NULL );
+		return 1;
+	}
+
+	for (uint32_t idx = 0; idx < index->entry_count; idx++) {
+		// Only the flags of the fixed part matter.
+		size_t flags_pos = pos + 40 + index->hash_len;
+		size_t next;
+		int status = GI_TRUNCATED;
+		if (flags_pos + 2 <= index->len - index->hash_len) {
+			entry.flags = (index->data[flags_pos] << 8) | index->data[flags_pos + 1];
+			status = decode_entry_name( index, flags_pos + 2, &entry, &next );
+		}
+		if (status) {
+			report( a_validation, status, pos, idx, NULL );
+			return 1;
+		}
+		if (index->version < 3 && (entry.flags & 0x4000) && report( a_validation, GI_BAD_FLAGS, pos, idx, NULL )) return 1;
+
+		// The paths of the following v4 entries are unknown once a prefix is wrong.
+		if (index->version >= 4 && entry.prefix > path_len) {
+			report( a_validation, GI_BAD_PREFIX, pos, idx, NULL );
+			return 1;
+		}
+		path_len = index->version < 4 ? entry.file_name_len : path_len - entry.prefix + entry.file_name_len;
+		// Longer paths are flagged with 0xFFF.
+		size_t declared = entry.flags & 0xFFF;
+		if (declared != (path_len < 0xFFF ? path_len : 0xFFF) && report( a_validation, GI_BAD_NAME_LENGTH, pos, idx, NULL )) return 1;
+
+		for (size_t pad = 0; pad < entry.pad_bytes_len; pad++) {
+			if (!entry.pad_bytes[pad]) continue;
+			if (report( a_validation, GI_BAD_PADDING, pos, idx, NULL )) return 1;
+			break;
+		}
+		pos = next;
+	}
+	*a_end = pos;
+
+	return 0;
+}
+
+
+// Checks that the TREE entries of the a_len bytes at a_content nest as their subtree counts tell, the root
+// coming first, and that they don't count more entries than the index has.
+// Returns non-zero if the validation must stop.
+static int validate_tree( struct validation *a_validation, const uint8_t *a_content, uint32_t a_len )
+{
+	const struct gi_index *index = a_validation->index;
+	const char *ptr = (const char *) a_content;
+	const char *end = ptr + a_len;
+	uint64_t pending = 1; // Trees still to come, the root to begin with
+	struct gi_tree tree;
+
+	while (ptr < end) {
+		size_t offset = (const uint8_t *) ptr - index->data;
+		int status = pending ? gi_parse_tree_entry( ptr, end, index->hash_len, &tree, &ptr ) : GI_BAD_TREE;
+		if (!status) {
+			bool root = offset == (size_t) (a_content - index->data);
+			bool bad_path = root ? tree.path_len != 0 : tree.path_len == 0 || memchr( tree.path, '/', tree.path_len );
+			if (bad_path || (tree.entry_count > 0 && (uint32_t) tree.entry_count > index->entry_count)) status = GI_BAD_TREE;
+		}
+		if (status) return report( a_validation, status, offset, GI_NO_ENTRY, "TREE" );
+		pending += tree.subtrees;
+		pending--;
+	}
+	if (pending) return report( a_validation, GI_BAD_TREE, end - (const char *) index->data, GI_NO_ENTRY, "TREE" );
+
+	return 0;
+}
+
+
+// Checks the extensions from a_offset, where the entries end.
+static void validate_extensions( struct validation *a_validation, size_t a_offset )
+{
+	const struct gi_index *index = a_validation->index;
+	const size_t entries_end = a_offset;
+	const size_t end = index->len - index->hash_len;
+	uint32_t u32 = 0;
+
+	while (a_offset + 8 <= end) {
+		const uint8_t *ext = index->data + a_offset;
+		memcpy( &u32, ext + 4, 4 );
+		uint32_t len = ntohl( u32 );
+		if (len > end - a_offset - 8) {
+			report( a_validation, GI_BAD_EXTENSION, a_offset, GI_NO_ENTRY, ext );
+			return;
+		}
+
+		if (!memcmp( ext, "TREE", 4 )) {
+			if (validate_tree( a_validation, ext + 8, len )) return;
+		} else if (!memcmp( ext, "EOIE", 4 )) {
+			// A 32-bit offset, then a hash of the extension headers
+			if (len == 4 + index->hash_len) memcpy( &u32, ext + 8, 4 );
+			if ((len != 4 + index->hash_len || ntohl( u32 ) != entries_end) && report( a_validation, GI_BAD_EXTENSION, a_offset, GI_NO_ENTRY, ext )) return;
+		}
+		a_offset += 8 + len;
+	}
+	// Bytes too short for an extension header
+	if (a_offset != end) report( a_validation, GI_TRUNCATED, a_offset, GI_NO_ENTRY, NULL );
+}
+
+
+int gi_validate( const struct gi_index *a_index, gi_problem_cb a_callback, void *a_data )
+{
+	assert( a_index );
+
+	struct validation validation = { .index = a_index, .callback = a_callback, .data = a_data, .first = GI_OK };
+	size_t entries_end;
+
+	if (!validate_entries( &validation, &entries_end )) validate_extensions( &validation, entries_end );
+
+	return validation.first;
+}
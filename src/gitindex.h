@@ -0,0 +1,234 @@
+// libgitindex: decoding of git index files held in memory.
+// See https://git-scm.com/docs/index-format
+//
+// Nothing here allocates, prints or keeps global state: every function only works on what it is given, and
+// struct gi_index is never modified once set up. A mapped index can thus be shared by any number of threads,
+// each walking it with its own struct gi_iter.
+
+#ifndef GITINDEX_H
+#define GITINDEX_H
+
+#include <arpa/inet.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+
+#define GI_HASH_MAX_LEN 32 // SHA-256
+#define GI_SHA1_LEN 20
+#define GI_SHA256_LEN 32
+
+// No valid offset encoding is longer than this.
+#define GI_VARINT_MAX_LEN ((8 * sizeof( ssize_t ) - 1 + 6) / 7)
+
+// Results of the functions returning an int
+enum gi_status {
+	GI_OK = 0,
+	GI_END, // gi_iter_next: no entry left
+	GI_TRUNCATED, // The file ends in the middle of something
+	GI_BAD_SIGNATURE, // Not "DIRC"
+	GI_BAD_VERSION, // Neither 2, 3 nor 4
+	GI_BAD_ENTRY,
+	GI_OVERFLOW, // Offset encoding too large for a ssize_t
+	GI_PATH_TOO_LONG, // gi_iter_next: the path doesn't fit in the buffer of the iterator
+	GI_BAD_EXTENSION,
+	// Found by gi_validate
+	GI_BAD_FLAGS, // Extended flag set in a v2 entry
+	GI_BAD_NAME_LENGTH, // The name length of the flags doesn't match the path
+	GI_BAD_PADDING, // Padding bytes which aren't NUL
+	GI_BAD_PREFIX, // v4 prefix longer than the previous path
+	GI_BAD_TREE, // TREE entries which don't nest as their subtree counts tell
+	GI_BAD_CHECKSUM, // Left to the caller, which has the hash function
+};
+
+// gi_problem.entry of problems which aren't about an entry
+#define GI_NO_ENTRY UINT32_MAX
+
+struct gi_header {
+	uint32_t version;
+	uint32_t entry_count;
+};
+
+struct gi_entry {
+	// ctime and mtime should be struct timespec as they correspond to stat(2) values.
+	// However struct timespec { time_t tv_sec; long tv_nsec; } are 64-bit fields
+	int32_t ctime;
+	int32_t ctime_ns;
+	int32_t mtime;
+	int32_t mtime_ns;
+	uint32_t dev;
+	uint32_t ino;
+	uint32_t mode;
+	uint32_t uid;
+	uint32_t gid;
+	uint32_t file_size;
+	char oid[GI_HASH_MAX_LEN]; // hash_len bytes
+	uint16_t flags;
+	const char * file_name; // 62th byte in v2 with SHA-1; in v4, what follows the prefix of the previous path
+	const char * pad_bytes;
+	// v3
+	uint16_t extended_flags;
+	// v4
+	size_t prefix; // Number of bytes dropped from the end of the previous path
+	// Added members
+	size_t file_name_len;
+	size_t pad_bytes_len;
+};
+
+// Entry of the TREE extension
+struct gi_tree {
+	const char *path; // Name of the directory in its parent, "" for the root
+	size_t path_len;
+	int entry_count; // -1 when invalidated
+	unsigned subtrees;
+	char oid[GI_HASH_MAX_LEN];
+};
+
+// A whole index file in memory, see gi_index_init.
+struct gi_index {
+	const uint8_t *data;
+	size_t len;
+	size_t hash_len;
+	uint32_t version;
+	uint32_t entry_count;
+};
+
+// Pull-style walk of the entries of an index, see gi_iter_next.
+struct gi_iter {
+	const struct gi_index *index;
+	size_t pos; // Offset of the next entry, then of the first extension once gi_iter_next returned GI_END
+	uint32_t next; // Number of the next entry
+	// Whole path of the last entry returned, pointing into the index, or into buf for v4 indexes
+	const char *path;
+	size_t path_len;
+	char *buf;
+	size_t buf_size;
+};
+
+// A problem found by gi_validate.
+struct gi_problem {
+	int status; // One of enum gi_status
+	size_t offset; // Of the entry, extension or TREE entry at fault
+	uint32_t entry; // Number of the entry, or GI_NO_ENTRY
+	char extension[5]; // Signature of the extension, "" if it isn't about one
+};
+
+// Called by gi_validate for each problem. A non-zero result stops the validation.
+typedef int (*gi_problem_cb)( void *a_data, const struct gi_problem *a_problem );
+
+// Called by gi_walk_extensions with the content of an extension.
+// A non-zero result stops the walk, which returns it.
+typedef int (*gi_extension_cb)( void *a_data, const char *a_signature, const uint8_t *a_content, uint32_t a_len );
+
+// What gi_walk_extensions calls for each extension, NULL members skipping theirs.
+struct gi_extension_callbacks {
+	gi_extension_cb tree; // TREE
+	gi_extension_cb resolve_undo; // REUC
+	gi_extension_cb link; // link
+	gi_extension_cb untracked; // UNTR
+	gi_extension_cb fsmonitor; // FSMN
+	gi_extension_cb end_of_entries; // EOIE
+	gi_extension_cb entry_offsets; // IEOT
+	gi_extension_cb other; // Any other
+};
+
+
+// Message for a_status, one of enum gi_status.
+const char *gi_strerror( int a_status );
+
+// Short name of a_status for machine-readable output, such as "bad-padding".
+const char *gi_status_name( int a_status );
+
+// Decodes the 12-byte header at a_data. The version is not checked.
+// Returns GI_OK, GI_TRUNCATED or GI_BAD_SIGNATURE.
+int gi_parse_header( const uint8_t *a_data, size_t a_len, struct gi_header *a_header );
+
+// Guesses the object id length of the index starting at a_data, which the index itself doesn't tell: from the layout
+// of the first entry, or without entries from where the checksum starts if a_complete, a_data being the whole file.
+// Returns GI_SHA1_LEN when both fit, or when neither does.
+size_t gi_detect_hash_len( const uint8_t *a_data, size_t a_len, bool a_complete );
+
+// Decodes the offset encoding of the v4 path prefixes from the a_len bytes at a_ptr, setting *a_used to the number
+// of bytes of the encoded integer, or to 0 if a_len bytes don't hold it entirely.
+// Returns the decoded integer, (-1) if it is incomplete, or (-2) on overflow (*a_used being set then).
+ssize_t gi_decode_varint( const uint8_t *a_ptr, size_t a_len, size_t *a_used );
+
+// Decodes the 40 bytes of big-endian stat data at a_fixed into the ten fields of a_entry from ctime to file_size,
+// which are laid out in the same order. Byte shuffles of SSSE3, AVX2 or NEON swap several words at once, the widest
+// being picked by CPUID when the program is loaded; without them, words are swapped one at a time.
+void gi_decode_stat_data( const uint8_t *a_fixed, struct gi_entry *a_entry );
+
+// Decodes the fixed-size part of an entry at a_fixed: 40 bytes of stat data, the object id and the flags.
+// Inline so that a constant a_hash_len makes every offset and copy length known at compile time.
+static inline void gi_decode_stat( const uint8_t *a_fixed, size_t a_hash_len, struct gi_entry *a_entry )
+{
+	gi_decode_stat_data( a_fixed, a_entry );
+	memcpy( a_entry->oid, a_fixed + 40, a_hash_len );
+	a_entry->flags = (a_fixed[40 + a_hash_len] << 8) | a_fixed[40 + a_hash_len + 1];
+}
+
+// Sets up a_index over the a_len bytes of an index file at a_data, which must stay valid as long as a_index is used.
+// a_hash_len is the object id length, 0 to guess it with gi_detect_hash_len.
+// Returns GI_OK, GI_TRUNCATED, GI_BAD_SIGNATURE or GI_BAD_VERSION.
+int gi_index_init( struct gi_index *a_index, const void *a_data, size_t a_len, size_t a_hash_len );
+
+// Trailing checksum of a_index, of a_index->hash_len bytes. Checking it is up to the caller.
+const uint8_t *gi_index_checksum( const struct gi_index *a_index );
+
+// Decodes the entry at a_offset of a_index without copying anything: a_entry->file_name points into the index.
+// Returns GI_OK, the offset of the following entry being stored in *a_next, or GI_TRUNCATED, GI_BAD_ENTRY or
+// GI_OVERFLOW.
+int gi_decode_entry( const struct gi_index *a_index, size_t a_offset, struct gi_entry *a_entry, size_t *a_next );
+
+// Offset following the entry at a_offset of a_index, found from its name without decoding anything else.
+// Returns 0 if the entry doesn't fit in the file.
+size_t gi_skip_entry( const struct gi_index *a_index, size_t a_offset );
+
+// Starts walking the entries of a_index. v4 paths are rebuilt in the a_buf_size bytes of a_buf, which may be NULL
+// for the other versions.
+void gi_iter_init( struct gi_iter *a_iter, const struct gi_index *a_index, char *a_buf, size_t a_buf_size );
+
+// Decodes the next entry into a_entry, a_iter->path being its whole path, NUL-terminated, until the next call.
+// Returns GI_OK, GI_END once every entry was returned, or an error of gi_decode_entry or GI_PATH_TOO_LONG.
+// Nothing is consumed on error: after GI_PATH_TOO_LONG, the same entry can be read again once gi_iter_set_buf
+// gave a larger buffer.
+int gi_iter_next( struct gi_iter *a_iter, struct gi_entry *a_entry );
+
+// Replaces the buffer of a_iter, which must already hold the path of the last entry returned, as realloc does.
+void gi_iter_set_buf( struct gi_iter *a_iter, char *a_buf, size_t a_buf_size );
+
+// Walks the extensions of a_index from a_offset, looking for the first one of a_signature, unless it is NULL:
+// its content and length are stored in *a_content and *a_len, *a_content being NULL if there is no such extension.
+// Returns whether a_offset is really where the extensions start, that is, whether the extension was found or the
+// extensions end where the checksum starts.
+bool gi_find_extension( const struct gi_index *a_index, size_t a_offset, const char *a_signature, const uint8_t **a_content, uint32_t *a_len );
+
+// Offset of the first extension of a_index: the end of the entries, given by the EOIE extension if there is one,
+// and otherwise found with gi_skip_entry.
+// Returns 0 if the extensions can't be found.
+size_t gi_extensions_pos( const struct gi_index *a_index );
+
+// Calls the callback of a_callbacks for each extension of a_index from a_offset, with a_data.
+// Returns GI_OK, GI_BAD_EXTENSION if an extension goes past the checksum, GI_TRUNCATED if there is no room for the
+// checksum, or the result of the callback which stopped the walk.
+int gi_walk_extensions( const struct gi_index *a_index, size_t a_offset, const struct gi_extension_callbacks *a_callbacks, void *a_data );
+
+// Decodes the TREE entry at a_ptr, whose path must be NUL-terminated before a_end, without copying anything:
+// a_tree->path points to a_ptr.
+// Returns GI_OK, the position following the entry being stored in *a_next, GI_BAD_EXTENSION if it is malformed,
+// or GI_TRUNCATED if its object id goes past a_end.
+int gi_parse_tree_entry( const char *a_ptr, const char *a_end, size_t a_hash_len, struct gi_tree *a_tree, const char **a_next );
+
+// Checks the structure of a_index without decoding more than it needs: that every entry fits in the file, that the
+// name lengths of their flags match their paths, that their padding is NUL, that the extensions fit before the
+// checksum, that EOIE points to where the entries end, and that the TREE entries nest as their subtree counts tell.
+// a_callback is called with a_data for each problem; when it is NULL, the first problem stops the validation.
+// Problems making the entries unreadable stop it too, as nothing after them can be found, and so do v4 prefixes
+// stripping more than the previous path, the following paths being unknown.
+// The checksum is left to the caller.
+// Returns GI_OK if there is no problem, the status of the first one otherwise.
+int gi_validate( const struct gi_index *a_index, gi_problem_cb a_callback, void *a_data );
+
+#endif